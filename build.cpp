@@ -10,8 +10,15 @@ void configure(anvil::Project& project) {
     project.add_executable("anvil", [](anvil::CppApplication& app) {
         app.add_include("src");
         app.add_dependency("nlohmann_json/3.11.2");
+#ifdef __linux__
+        // dlopen() for in-process build scripts
+        app.add_link_flag("-ldl");
+#endif
     });
 
     project.add_test("anvil_tests", [](anvil::CppApplication& app) {
+#ifdef __linux__
+        app.add_link_flag("-ldl");
+#endif
     });
 }
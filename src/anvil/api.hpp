@@ -1,4 +1,8 @@
 #pragma once
+// Classic guard as well: the precompiled script API and a build.cpp that includes
+// this header through another path (e.g. "src/anvil/api.hpp") must not both define it.
+#ifndef ANVIL_API_HPP
+#define ANVIL_API_HPP
 #include <string>
 #include <vector>
 #include <functional>
@@ -6,14 +10,22 @@
 #include <filesystem>
 #include <iostream>
 #include <fstream>
+#include <optional>
+#include <algorithm>
+#include <cctype>
 
 namespace anvil {
 
     enum class CppStandard { CPP_11, CPP_14, CPP_17, CPP_20, CPP_23 };
     enum class Linkage { Static, Dynamic };
-    enum class Optimization { Debug, Release };
+    // Build profiles. Each one is built in its own directory under .anvil_build.
+    enum class Optimization { Debug, Release, RelWithDebInfo, MinSize };
     enum class CompilerId { Clang, GCC, MSVC };
-    enum class AppType { Executable, Test };
+    enum class AppType { Executable, Test, StaticLibrary, SharedLibrary };
+
+    inline bool is_library(AppType type) {
+        return type == AppType::StaticLibrary || type == AppType::SharedLibrary;
+    }
 
     struct CppApplication {
         std::string name;
@@ -28,13 +40,58 @@ namespace anvil {
 
         std::vector<std::string> dependencies;
 
+        // Library targets this one links, by name. Their public include dirs and defines
+        // apply to this target's sources as well, transitively.
+        std::vector<std::string> links;
+        std::vector<std::string> public_include_dirs;
+        std::vector<std::string> public_defines;
+
+        // Overrides the profile the project is built with, for this target only
+        std::optional<Optimization> optimization;
+
+        // Ninja pools for this target's compile and link steps; empty uses the defaults
+        // (compiles unrestricted, links in the RAM-sized "link" pool)
+        std::string compile_pool;
+        std::string link_pool;
+
+        // Header precompiled once per target and force-included into each of its sources
+        std::string precompiled_header;
+
+        // Unity build: when > 0, sources are compiled in merged batches of about this many.
+        // Sources listed in unity_exclude are always compiled on their own.
+        int unity_batch_size = 0;
+        std::vector<std::string> unity_exclude;
+
+        // C++20 module interface units (e.g. .cppm). Targets that have them, link a library
+        // that does, or set import_std have their sources scanned for imports.
+        std::vector<std::string> module_sources;
+        bool import_std = false;
+
         void add_source(const std::string& src) { sources.push_back(src); }
         void add_include(const std::string& dir) { include_dirs.push_back(dir); }
         void add_define(const std::string& def) { defines.push_back(def); }
         void add_link_flag(const std::string& flag) { link_flags.push_back(flag); }
         void set_compiler(CompilerId id) { compilerId = id; }
+        void set_optimization(Optimization level) { optimization = level; }
+        void set_compile_pool(const std::string& pool) { compile_pool = pool; }
+        void set_link_pool(const std::string& pool) { link_pool = pool; }
+        void add_precompiled_header(const std::string& header) { precompiled_header = header; }
+        void exclude_from_unity(const std::string& src) { unity_exclude.push_back(src); }
+        void add_module(const std::string& src) { module_sources.push_back(src); }
 
         void add_dependency(const std::string& dep) { dependencies.push_back(dep); }
+
+        void link(const std::string& library) { links.push_back(library); }
+        void link(const CppApplication& library) { links.push_back(library.name); }
+        void add_public_include(const std::string& dir) { public_include_dirs.push_back(dir); }
+        void add_public_define(const std::string& def) { public_defines.push_back(def); }
+    };
+
+    // The fast linker chosen for a toolchain at configure time: the flag that selects it
+    // and its --version line
+    struct FastLinker {
+        std::string flag;
+        std::string version;
     };
 
     class Project {
@@ -43,6 +100,25 @@ namespace anvil {
         std::string version;
         std::vector<CppApplication> targets;
 
+        // Profile used when none is given on the command line (--profile=<name>)
+        Optimization profile = Optimization::Debug;
+
+        // Ninja pools by name and depth. "link" is always defined and sized from physical
+        // memory unless declared here; "console" is built into ninja.
+        std::map<std::string, int> pools;
+
+        void add_pool(const std::string& poolName, int depth) { pools[poolName] = depth; }
+
+        // Serve unchanged compiles from Anvil's object cache (~/.cache/anvil, or ANVIL_CACHE_DIR)
+        bool compile_cache = true;
+
+        // Link with mold or lld when installed; Debug builds also get split DWARF and a gdb index
+        bool fast_link = true;
+
+        // Filled in when the project is resolved, by toolchain name; no entry means the
+        // system default. Kept in the config cache, so builds don't probe again.
+        std::map<std::string, FastLinker> fast_linkers;
+
         // Legacy support for older versions of Anvil that might expect this member
         CppApplication application;
 
@@ -102,6 +178,16 @@ namespace anvil {
             }
         }
 
+        // Libraries get no default sources. Their TUs are compiled once, however many targets
+        // link them; see CppApplication::link().
+        void add_static_library(const std::string& name, const std::function<void(CppApplication&)> &config) {
+            add_library(name, AppType::StaticLibrary, config);
+        }
+
+        void add_shared_library(const std::string& name, const std::function<void(CppApplication&)> &config) {
+            add_library(name, AppType::SharedLibrary, config);
+        }
+
         void add_test(const std::string& name, std::function<void(CppApplication&)> config) {
             CppApplication app;
             app.name = name;
@@ -164,11 +250,51 @@ namespace anvil {
                 }
             }
 
+            config(app);
+            targets.push_back(app);
+        }
+
+    private:
+        void add_library(const std::string& name, AppType type, const std::function<void(CppApplication&)> &config) {
+            CppApplication app;
+            app.name = name;
+            app.type = type;
+            app.standard = CppStandard::CPP_20;
+
+            // Same default include dir as executables
+            if (std::filesystem::exists("src/main")) {
+                app.add_include("src/main");
+            } else if (std::filesystem::exists("src")) {
+                app.add_include("src");
+            }
+
             config(app);
             targets.push_back(app);
         }
     };
 
+    inline std::string profile_name(Optimization profile) {
+        switch (profile) {
+            case Optimization::Release: return "release";
+            case Optimization::RelWithDebInfo: return "relwithdebinfo";
+            case Optimization::MinSize: return "minsize";
+            case Optimization::Debug: break;
+        }
+        return "debug";
+    }
+
+    // Accepts the names above in any case; returns false for anything else
+    inline bool parse_profile(std::string name, Optimization& profile) {
+        std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        for (Optimization candidate : { Optimization::Debug, Optimization::Release, Optimization::RelWithDebInfo, Optimization::MinSize }) {
+            if (profile_name(candidate) == name) {
+                profile = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+
     class BuildScript {
     public:
         virtual ~BuildScript() = default;
@@ -176,4 +302,6 @@ namespace anvil {
     };
 }
 
-extern "C" void configure(anvil::Project& project);
\ No newline at end of file
+extern "C" void configure(anvil::Project& project);
+
+#endif
@@ -0,0 +1,70 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <utility>
+#include <functional>
+
+namespace anvil {
+    using Bindings = std::vector<std::pair<std::string, std::string>>;
+
+    // The graph NinjaWriter renders into build.ninja, kept in memory so the native executor
+    // can run it without reading the manifest back. Values are the unevaluated strings
+    // written to the manifest ($var, $$), and evaluate the way ninja evaluates them.
+    struct BuildRule {
+        Bindings bindings;  // command, description, depfile, deps, restat, pool, generator
+    };
+
+    struct BuildEdge {
+        std::string rule;
+        std::vector<std::string> outputs;
+        std::vector<std::string> implicitOutputs;
+        std::vector<std::string> inputs;
+        std::vector<std::string> implicitInputs;
+        std::vector<std::string> orderOnly;
+        Bindings bindings;  // pool, dyndep and the edge's own variables
+        int scope = -1;     // target scope whose variables it sees, -1 for build.ninja
+    };
+
+    struct BuildGraph {
+        Bindings globals;  // builddir and the interned values, in order
+        std::map<std::string, int> pools;
+        std::map<std::string, BuildRule> rules;
+        std::vector<Bindings> scopes;  // one per target file
+        std::vector<BuildEdge> edges;
+    };
+
+    inline bool is_ninja_varname_char(char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-';
+    }
+
+    // Evaluates a ninja string: $name and ${name} are looked up, "$$", "$ " and "$:" are
+    // the escaped characters. Unknown variables expand to nothing.
+    inline std::string expand_ninja(std::string_view text, const std::function<std::string(const std::string&)>& lookup) {
+        std::string result;
+        for (size_t i = 0; i < text.size(); ++i) {
+            if (text[i] != '$' || i + 1 == text.size()) {
+                result += text[i];
+                continue;
+            }
+            const char next = text[++i];
+            if (next == '$' || next == ' ' || next == ':') {
+                result += next;
+            } else if (next == '{') {
+                const size_t close = text.find('}', i);
+                if (close == std::string_view::npos) break;
+                result += lookup(std::string(text.substr(i + 1, close - i - 1)));
+                i = close;
+            } else if (next == '\n') {
+                while (i + 1 < text.size() && text[i + 1] == ' ') ++i;
+            } else {
+                size_t end = i;
+                while (end < text.size() && is_ninja_varname_char(text[end])) ++end;
+                result += lookup(std::string(text.substr(i, end - i)));
+                i = end - 1;
+            }
+        }
+        return result;
+    }
+}
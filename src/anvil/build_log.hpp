@@ -0,0 +1,187 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <fstream>
+#include <filesystem>
+#include <cstdint>
+#include "file_util.hpp"
+
+namespace anvil {
+    namespace fs = std::filesystem;
+
+    // What the native executor knows about earlier builds, per output: the hash of the
+    // command that built it, when that command started, how long it ran and the files its
+    // depfile named. An output is up to date while its command is unchanged and none of its
+    // inputs or deps were modified after the command started.
+    //
+    // The file is append-only while building, so an interrupted build keeps what finished.
+    // Paths are stored once and referred to by index:
+    //   "ANVILLOG" u32 version, then records of
+    //   'p' u32 size, bytes                                     the next path index
+    //   'e' u32 output, u64 command, i64 started, u32 ms, u32 count, u32 deps[count]
+    // Superseded entries are dropped when the file is loaded with more than twice as many
+    // entry records as outputs.
+    class BuildLog {
+    public:
+        struct Entry {
+            uint64_t command = 0;
+            int64_t started = 0;  // fs::file_time_type ticks
+            uint32_t durationMs = 0;
+            std::vector<uint32_t> deps;
+        };
+
+    private:
+        fs::path file;
+        std::vector<std::string> paths;
+        std::unordered_map<std::string, uint32_t> pathIds;
+        std::map<uint32_t, Entry> entries;
+        std::ofstream appender;
+
+        static constexpr std::string_view magic = "ANVILLOG";
+        static constexpr uint32_t format_version = 1;
+
+        static void put_u32(std::string& out, uint32_t value) {
+            for (int i = 0; i < 4; ++i) out += static_cast<char>((value >> (8 * i)) & 0xff);
+        }
+        static void put_u64(std::string& out, uint64_t value) {
+            for (int i = 0; i < 8; ++i) out += static_cast<char>((value >> (8 * i)) & 0xff);
+        }
+
+        // Returns the path's index, appending a path record to out if it is new
+        uint32_t intern(const std::string& path, std::string& out) {
+            auto [it, inserted] = pathIds.emplace(path, static_cast<uint32_t>(paths.size()));
+            if (inserted) {
+                paths.push_back(path);
+                out += 'p';
+                put_u32(out, static_cast<uint32_t>(path.size()));
+                out += path;
+            }
+            return it->second;
+        }
+
+        static void put_entry(std::string& out, uint32_t output, const Entry& entry) {
+            out += 'e';
+            put_u32(out, output);
+            put_u64(out, entry.command);
+            put_u64(out, static_cast<uint64_t>(entry.started));
+            put_u32(out, entry.durationMs);
+            put_u32(out, static_cast<uint32_t>(entry.deps.size()));
+            for (uint32_t dep : entry.deps) put_u32(out, dep);
+        }
+
+        // Rewrites the file with only the current entries, and the paths they use
+        void compact() {
+            std::vector<std::string> oldPaths = std::move(paths);
+            std::map<uint32_t, Entry> oldEntries = std::move(entries);
+            paths.clear();
+            pathIds.clear();
+            entries.clear();
+
+            std::string data(magic);
+            put_u32(data, format_version);
+            for (auto& [output, entry] : oldEntries) {
+                const uint32_t id = intern(oldPaths[output], data);
+                for (uint32_t& dep : entry.deps) dep = intern(oldPaths[dep], data);
+                put_entry(data, id, entry);
+                entries.emplace(id, std::move(entry));
+            }
+            write_file_atomic(file, data);
+        }
+
+    public:
+        explicit BuildLog(fs::path path) : file(std::move(path)) {}
+
+        // Reads the log, if any, and opens it for appending. A truncated or unreadable tail
+        // (e.g. from a killed build) is dropped. Without append the file is left untouched.
+        void load(bool append = true) {
+            std::string data;
+            size_t records = 0;
+            bool clean = false;
+            if (read_file(file, data) && data.compare(0, magic.size(), magic) == 0) {
+                size_t pos = magic.size();
+                auto u32 = [&](uint32_t& value) {
+                    if (data.size() - pos < 4) return false;
+                    value = 0;
+                    for (int i = 0; i < 4; ++i) value |= static_cast<uint32_t>(static_cast<unsigned char>(data[pos + i])) << (8 * i);
+                    pos += 4;
+                    return true;
+                };
+                auto u64 = [&](uint64_t& value) {
+                    uint32_t low = 0, high = 0;
+                    if (!u32(low) || !u32(high)) return false;
+                    value = (static_cast<uint64_t>(high) << 32) | low;
+                    return true;
+                };
+
+                uint32_t version = 0;
+                clean = u32(version) && version == format_version;
+                while (clean && pos < data.size()) {
+                    const char kind = data[pos++];
+                    if (kind == 'p') {
+                        uint32_t size = 0;
+                        clean = u32(size) && data.size() - pos >= size;
+                        if (!clean) break;
+                        std::string path = data.substr(pos, size);
+                        pos += size;
+                        pathIds.emplace(path, static_cast<uint32_t>(paths.size()));
+                        paths.push_back(std::move(path));
+                    } else if (kind == 'e') {
+                        uint32_t output = 0, count = 0;
+                        uint64_t started = 0;
+                        Entry entry;
+                        clean = u32(output) && u64(entry.command) && u64(started) && u32(entry.durationMs) && u32(count) &&
+                                output < paths.size() && (data.size() - pos) / 4 >= count;
+                        for (uint32_t i = 0; clean && i < count; ++i) {
+                            uint32_t dep = 0;
+                            clean = u32(dep) && dep < paths.size();
+                            entry.deps.push_back(dep);
+                        }
+                        if (!clean) break;
+                        entry.started = static_cast<int64_t>(started);
+                        entries[output] = std::move(entry);
+                        ++records;
+                    } else {
+                        clean = false;
+                    }
+                }
+            }
+
+            if (!append) return;
+            if (!clean || records > 2 * entries.size() + 1000) {
+                compact();
+            }
+            appender.open(file, std::ios::out | std::ios::binary | std::ios::app);
+        }
+
+        [[nodiscard]] const std::map<uint32_t, Entry>& all() const {
+            return entries;
+        }
+
+        [[nodiscard]] const Entry* find(const std::string& output) const {
+            auto id = pathIds.find(output);
+            if (id == pathIds.end()) return nullptr;
+            auto it = entries.find(id->second);
+            return it == entries.end() ? nullptr : &it->second;
+        }
+
+        [[nodiscard]] const std::string& path(uint32_t id) const {
+            return paths[id];
+        }
+
+        void record(const std::string& output, const Entry& entry, const std::vector<std::string>& deps) {
+            std::string data;
+            const uint32_t id = intern(output, data);
+            Entry stored = entry;
+            stored.deps.clear();
+            for (const auto& dep : deps) stored.deps.push_back(intern(dep, data));
+            put_entry(data, id, stored);
+            entries[id] = std::move(stored);
+
+            appender.write(data.data(), static_cast<std::streamsize>(data.size()));
+            appender.flush();
+        }
+    };
+}
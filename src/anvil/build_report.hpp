@@ -0,0 +1,426 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <set>
+#include <chrono>
+#include <sstream>
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <filesystem>
+#include <cstdint>
+#include <cstdlib>
+#include <nlohmann/json.hpp>
+#include "build_graph.hpp"
+#include "build_log.hpp"
+#include "file_util.hpp"
+
+namespace anvil {
+    namespace fs = std::filesystem;
+
+    // A build edge as read back from build.ninja, with its paths evaluated. The target is
+    // the name of the subninja file that declares it (empty for build.ninja itself).
+    struct ManifestEdge {
+        std::string rule;
+        std::string target;
+        std::vector<std::string> outputs;  // explicit and implicit
+        std::vector<std::string> inputs;   // explicit, implicit and order-only
+        std::string dyndep;
+    };
+
+    struct BuildManifest {
+        std::string builddir;
+        std::vector<ManifestEdge> edges;
+    };
+
+    // Splits a manifest into logical lines, joining "$\\n" continuations
+    inline std::vector<std::string> split_ninja_lines(const std::string& content) {
+        std::vector<std::string> lines;
+        std::string line;
+        for (size_t i = 0; i < content.size(); ++i) {
+            const char c = content[i];
+            if (c == '$' && i + 1 < content.size()) {
+                if (content[i + 1] == '\n') {
+                    ++i;
+                    while (i + 1 < content.size() && content[i + 1] == ' ') ++i;
+                } else {
+                    line += c;
+                    line += content[++i];
+                }
+            } else if (c == '\n') {
+                lines.push_back(std::move(line));
+                line.clear();
+            } else if (c != '\r') {
+                line += c;
+            }
+        }
+        if (!line.empty()) lines.push_back(std::move(line));
+        return lines;
+    }
+
+    // Splits the part of a build line after "build " into unevaluated paths, with ":",
+    // "|" and "||" as tokens of their own
+    inline std::vector<std::string> split_ninja_build_line(std::string_view text) {
+        std::vector<std::string> tokens;
+        std::string word;
+        auto flush = [&] {
+            if (!word.empty()) tokens.push_back(std::move(word));
+            word.clear();
+        };
+        for (size_t i = 0; i < text.size(); ++i) {
+            const char c = text[i];
+            if (c == '$' && i + 1 < text.size()) {
+                word += c;
+                word += text[++i];
+            } else if (c == ' ') {
+                flush();
+            } else if (c == ':') {
+                flush();
+                tokens.emplace_back(":");
+            } else {
+                word += c;
+            }
+        }
+        flush();
+        return tokens;
+    }
+
+    // Scopes variables as ninja does: a subninja file sees build.ninja's, not the others'
+    struct ManifestReader {
+        BuildManifest& manifest;
+        std::vector<std::map<std::string, std::string>> scopes;  // build.ninja, then one per subninja
+
+        std::string lookup(size_t scope, const std::string& name) const {
+            auto it = scopes[scope].find(name);
+            if (it != scopes[scope].end()) return it->second;
+            return scope == 0 ? std::string() : lookup(0, name);
+        }
+
+        std::string eval(size_t scope, std::string_view text) const {
+            return expand_ninja(text, [&](const std::string& name) { return lookup(scope, name); });
+        }
+
+        void read(const fs::path& file, size_t scope, const std::string& target) {
+            std::string content;
+            if (!read_file(file, content)) {
+                throw std::runtime_error("Could not read " + file.string());
+            }
+
+            ManifestEdge* edge = nullptr;
+            for (const auto& line : split_ninja_lines(content)) {
+                const size_t indent = line.find_first_not_of(' ');
+                if (indent == std::string::npos || line[indent] == '#') continue;
+
+                if (indent > 0) {
+                    // Rule and pool bindings don't matter here; an edge's dyndep does
+                    if (edge && line.compare(indent, 6, "dyndep") == 0) {
+                        const size_t eq = line.find('=', indent);
+                        if (eq != std::string::npos) {
+                            const size_t value = line.find_first_not_of(' ', eq + 1);
+                            edge->dyndep = value == std::string::npos ? "" : eval(scope, std::string_view(line).substr(value));
+                        }
+                    }
+                    continue;
+                }
+                edge = nullptr;
+
+                if (line.rfind("build ", 0) == 0) {
+                    manifest.edges.push_back({});
+                    edge = &manifest.edges.back();
+                    edge->target = target;
+                    bool afterColon = false;
+                    bool ruleNext = false;
+                    for (const auto& token : split_ninja_build_line(std::string_view(line).substr(6))) {
+                        if (token == ":") {
+                            afterColon = true;
+                            ruleNext = true;
+                        } else if (token == "|" || token == "||") {
+                            continue;
+                        } else if (ruleNext) {
+                            edge->rule = token;
+                            ruleNext = false;
+                        } else {
+                            (afterColon ? edge->inputs : edge->outputs).push_back(eval(scope, token));
+                        }
+                    }
+                } else if (line.rfind("subninja ", 0) == 0 || line.rfind("include ", 0) == 0) {
+                    const bool sub = line[0] == 's';
+                    const fs::path path = eval(scope, std::string_view(line).substr(sub ? 9 : 8));
+                    if (sub) {
+                        scopes.emplace_back();
+                        read(path, scopes.size() - 1, path.stem().string());
+                    } else {
+                        read(path, scope, target);
+                    }
+                } else if (line.rfind("rule ", 0) != 0 && line.rfind("pool ", 0) != 0 && line.rfind("default ", 0) != 0) {
+                    const size_t eq = line.find('=');
+                    if (eq == std::string::npos) continue;
+                    std::string name = line.substr(0, eq);
+                    name.erase(name.find_last_not_of(' ') + 1);
+                    const size_t value = line.find_first_not_of(' ', eq + 1);
+                    scopes[scope][name] = value == std::string::npos ? "" : eval(scope, std::string_view(line).substr(value));
+                }
+            }
+        }
+    };
+
+    // Reads build.ninja and the target files it includes, plus the dyndep files of the
+    // last build, into the edges that were built and what each needs
+    inline BuildManifest read_build_manifest(const fs::path& file) {
+        BuildManifest manifest;
+        ManifestReader reader{ manifest, { {} } };
+        reader.read(file, 0, "");
+        manifest.builddir = reader.lookup(0, "builddir");
+
+        // Module dependencies are only known from the dyndep files
+        std::map<std::string, size_t> producers;
+        for (size_t i = 0; i < manifest.edges.size(); ++i) {
+            for (const auto& output : manifest.edges[i].outputs) producers.emplace(output, i);
+        }
+        std::set<std::string> loaded;
+        for (size_t i = 0; i < manifest.edges.size(); ++i) {
+            const std::string dyndep = manifest.edges[i].dyndep;
+            if (dyndep.empty() || !loaded.insert(dyndep).second) continue;
+
+            if (!fs::exists(dyndep)) continue;
+            BuildManifest described;
+            ManifestReader dyndepReader{ described, { {} } };
+            dyndepReader.read(dyndep, 0, "");
+            for (auto& line : described.edges) {
+                if (line.outputs.empty()) continue;
+                auto producer = producers.find(line.outputs[0]);
+                if (producer == producers.end()) continue;
+                ManifestEdge& edge = manifest.edges[producer->second];
+                for (size_t o = 1; o < line.outputs.size(); ++o) {
+                    edge.outputs.push_back(line.outputs[o]);
+                    producers.emplace(line.outputs[o], producer->second);
+                }
+                edge.inputs.insert(edge.inputs.end(), line.inputs.begin(), line.inputs.end());
+            }
+        }
+        return manifest;
+    }
+
+    // When a command of the last build ran, in milliseconds from the start of that build
+    struct ActionTiming {
+        std::string output;
+        int64_t start = 0;
+        int64_t end = 0;
+    };
+
+    // .ninja_log lines are "<start> <end> <mtime> <output> <hash>", appended as commands
+    // finish with times relative to the start of each ninja run, so a run begins wherever
+    // the end time goes backwards
+    inline std::vector<ActionTiming> read_ninja_build_timings(const fs::path& log) {
+        std::string content;
+        if (!read_file(log, content)) return {};
+
+        std::vector<ActionTiming> timings;
+        std::istringstream in(content);
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line.empty() || line[0] == '#') continue;
+            std::istringstream fields(line);
+            std::string start, end, mtime, output;
+            if (!std::getline(fields, start, '\t') || !std::getline(fields, end, '\t') || !std::getline(fields, mtime, '\t') ||
+                !std::getline(fields, output, '\t')) {
+                continue;
+            }
+            ActionTiming timing{ output, std::atoll(start.c_str()), std::atoll(end.c_str()) };
+            if (!timings.empty() && timing.end < timings.back().end) timings.clear();
+            timings.push_back(std::move(timing));
+        }
+        return timings;
+    }
+
+    // The native executor's log keeps the latest run of each output with its start time.
+    // Something is always running during a build, so the last build is the last stretch
+    // of commands without a gap between them.
+    inline std::vector<ActionTiming> read_native_build_timings(const fs::path& file) {
+        BuildLog log(file);
+        log.load(false);
+
+        std::vector<ActionTiming> timings;
+        for (const auto& [output, entry] : log.all()) {
+            const auto started = fs::file_time_type(fs::file_time_type::duration(entry.started));
+            const int64_t start = std::chrono::duration_cast<std::chrono::milliseconds>(started.time_since_epoch()).count();
+            timings.push_back({ log.path(output), start, start + entry.durationMs });
+        }
+        std::sort(timings.begin(), timings.end(), [](const ActionTiming& a, const ActionTiming& b) { return a.start < b.start; });
+
+        // A build starts with the first command that began over a second after everything
+        // before it had finished
+        constexpr int64_t gap = 1000;
+        size_t first = 0;
+        int64_t busyUntil = INT64_MIN;
+        for (size_t i = 0; i < timings.size(); ++i) {
+            if (i > 0 && timings[i].start > busyUntil + gap) first = i;
+            busyUntil = std::max(busyUntil, timings[i].end);
+        }
+        timings.erase(timings.begin(), timings.begin() + static_cast<long>(first));
+        const int64_t origin = timings.empty() ? 0 : timings.front().start;
+        for (auto& timing : timings) {
+            timing.start -= origin;
+            timing.end -= origin;
+        }
+        return timings;
+    }
+
+    // Where the last build spent its time: its critical path (the longest chain of
+    // commands that each waited for the one before), time per target, the slowest
+    // compiles and links, and how busy the jobs were. The result is what
+    // `anvil report build --json` prints.
+    inline nlohmann::json analyze_build(const BuildManifest& manifest, const std::vector<ActionTiming>& timings, int jobs, size_t top) {
+        const auto& edges = manifest.edges;
+        std::map<std::string, size_t> producers;
+        for (size_t i = 0; i < edges.size(); ++i) {
+            for (const auto& output : edges[i].outputs) producers.emplace(output, i);
+        }
+
+        // Edge -> when it ran; edges with several outputs are logged once per output
+        std::map<size_t, std::pair<int64_t, int64_t>> ran;
+        for (const auto& timing : timings) {
+            auto producer = producers.find(timing.output);
+            if (producer == producers.end()) continue;
+            auto [it, inserted] = ran.emplace(producer->second, std::make_pair(timing.start, timing.end));
+            if (!inserted) {
+                it->second.first = std::min(it->second.first, timing.start);
+                it->second.second = std::max(it->second.second, timing.end);
+            }
+        }
+        auto duration = [&](size_t edge) -> int64_t {
+            auto it = ran.find(edge);
+            return it == ran.end() ? 0 : it->second.second - it->second.first;
+        };
+
+        // Longest chain of work ending at each edge; edges that didn't run cost nothing
+        std::vector<int64_t> chain(edges.size(), -1);
+        std::vector<long> via(edges.size(), -1);
+        std::function<int64_t(size_t)> longest = [&](size_t edge) -> int64_t {
+            if (chain[edge] >= 0) return chain[edge];
+            chain[edge] = 0;  // a cycle ends here
+            int64_t before = 0;
+            for (const auto& input : edges[edge].inputs) {
+                auto producer = producers.find(input);
+                if (producer == producers.end() || producer->second == edge) continue;
+                const int64_t length = longest(producer->second);
+                if (length > before) {
+                    before = length;
+                    via[edge] = static_cast<long>(producer->second);
+                }
+            }
+            return chain[edge] = before + duration(edge);
+        };
+
+        long last = -1;
+        for (const auto& [edge, time] : ran) {
+            if (last < 0 || longest(edge) > chain[static_cast<size_t>(last)]) last = static_cast<long>(edge);
+        }
+        std::vector<size_t> path;
+        for (long edge = last; edge >= 0; edge = via[static_cast<size_t>(edge)]) {
+            if (ran.count(static_cast<size_t>(edge))) path.push_back(static_cast<size_t>(edge));
+        }
+        std::reverse(path.begin(), path.end());
+
+        auto name_of = [&](const std::string& target) { return target.empty() ? std::string("build.ninja") : target; };
+
+        struct TargetTime {
+            int64_t actions = 0, total = 0, first = INT64_MAX, last = 0, critical = 0;
+        };
+        std::map<std::string, TargetTime> targets;
+        int64_t wall = 0, total = 0;
+        for (const auto& [edge, time] : ran) {
+            TargetTime& target = targets[name_of(edges[edge].target)];
+            ++target.actions;
+            target.total += time.second - time.first;
+            target.first = std::min(target.first, time.first);
+            target.last = std::max(target.last, time.second);
+            total += time.second - time.first;
+            wall = std::max(wall, time.second);
+        }
+        if (!ran.empty()) {
+            int64_t start = INT64_MAX;
+            for (const auto& [edge, time] : ran) start = std::min(start, time.first);
+            wall -= start;
+        }
+
+        nlohmann::json criticalPath = nlohmann::json::array();
+        int64_t criticalMs = 0;
+        for (size_t edge : path) {
+            const int64_t ms = duration(edge);
+            criticalMs += ms;
+            targets[name_of(edges[edge].target)].critical += ms;
+            criticalPath.push_back({ { "output", edges[edge].outputs[0] }, { "target", name_of(edges[edge].target) }, { "rule", edges[edge].rule }, { "ms", ms } });
+        }
+
+        // A target whose part of the critical path ends in another target holds back the
+        // targets that depend on it until all of it is built; split, they could start on
+        // the part they need. Only worth it for a stretch of more than one command.
+        std::map<std::string, std::pair<int64_t, size_t>> waits;  // target -> time on the path, commands
+        for (size_t i = 0; i < path.size();) {
+            const std::string& target = edges[path[i]].target;
+            size_t end = i;
+            int64_t ms = 0;
+            while (end < path.size() && edges[path[end]].target == target) ms += duration(path[end++]);
+            if (end < path.size() && !target.empty() && end - i > 1) {
+                auto& wait = waits[target];
+                wait.first += ms;
+                wait.second += end - i;
+            }
+            i = end;
+        }
+        std::vector<std::pair<std::string, std::pair<int64_t, size_t>>> splits(waits.begin(), waits.end());
+        std::sort(splits.begin(), splits.end(), [](const auto& a, const auto& b) { return a.second.first > b.second.first; });
+        nlohmann::json splitCandidates = nlohmann::json::array();
+        for (const auto& [target, wait] : splits) {
+            if (criticalMs == 0 || wait.first * 20 < criticalMs) continue;  // under 5% of the path
+            splitCandidates.push_back({ { "target", target }, { "criticalMs", wait.first }, { "commands", wait.second } });
+        }
+
+        nlohmann::json targetList = nlohmann::json::array();
+        std::vector<std::pair<std::string, TargetTime>> sortedTargets(targets.begin(), targets.end());
+        std::sort(sortedTargets.begin(), sortedTargets.end(), [](const auto& a, const auto& b) { return a.second.total > b.second.total; });
+        for (const auto& [name, time] : sortedTargets) {
+            if (time.actions == 0) continue;
+            targetList.push_back({ { "target", name }, { "actions", time.actions }, { "totalMs", time.total },
+                                   { "spanMs", time.last - time.first }, { "criticalMs", time.critical } });
+        }
+
+        // Slowest commands of a kind, by rule name (cxx_/pch_ compile, link_/ar_ link)
+        auto slowest = [&](std::initializer_list<std::string_view> prefixes) {
+            std::vector<size_t> matching;
+            for (const auto& [edge, time] : ran) {
+                for (auto prefix : prefixes) {
+                    if (edges[edge].rule.rfind(prefix, 0) == 0) matching.push_back(edge);
+                }
+            }
+            std::sort(matching.begin(), matching.end(), [&](size_t a, size_t b) { return duration(a) > duration(b); });
+            if (matching.size() > top) matching.resize(top);
+            nlohmann::json list = nlohmann::json::array();
+            for (size_t edge : matching) {
+                nlohmann::json item = { { "output", edges[edge].outputs[0] }, { "target", name_of(edges[edge].target) }, { "ms", duration(edge) } };
+                if (!edges[edge].inputs.empty()) item["input"] = edges[edge].inputs[0];
+                list.push_back(std::move(item));
+            }
+            return list;
+        };
+
+        const double parallelism = wall > 0 ? static_cast<double>(total) / static_cast<double>(wall) : 0.0;
+        return {
+            { "actions", ran.size() },
+            { "wallMs", wall },
+            { "totalMs", total },
+            { "criticalPathMs", criticalMs },
+            { "jobs", jobs },
+            { "parallelism", parallelism },
+            { "utilization", jobs > 0 ? parallelism / jobs : 0.0 },
+            { "criticalPath", criticalPath },
+            { "targets", targetList },
+            { "slowestCompiles", slowest({ "cxx_", "pch_" }) },
+            { "slowestLinks", slowest({ "link_", "ar_" }) },
+            { "splitCandidates", splitCandidates },
+        };
+    }
+}
@@ -0,0 +1,168 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+
+namespace anvil {
+
+    // LZ77 block codec in the LZ4 sequence layout: a token byte holding the literal length
+    // (high nibble) and match length - 4 (low nibble), each extended by 255-runs, the
+    // literals, then a 2-byte little-endian match offset. The final sequence has no match.
+    // Headers compress 4-6x with it and decoding is a tight copy loop.
+    namespace lz {
+        constexpr size_t min_match = 4;
+        constexpr size_t max_offset = 65535;
+
+        inline void write_length(std::string& out, size_t length) {
+            while (length >= 255) {
+                out += static_cast<char>(255);
+                length -= 255;
+            }
+            out += static_cast<char>(length);
+        }
+
+        inline void write_sequence(std::string& out, std::string_view literals, size_t matchLength, size_t offset) {
+            const size_t litLen = literals.size();
+            const size_t matchCode = matchLength ? matchLength - min_match : 0;
+            unsigned char token = static_cast<unsigned char>((std::min<size_t>(litLen, 15) << 4) | std::min<size_t>(matchCode, 15));
+            out += static_cast<char>(token);
+            if (litLen >= 15) write_length(out, litLen - 15);
+            out.append(literals);
+            if (matchLength) {
+                out += static_cast<char>(offset & 0xff);
+                out += static_cast<char>((offset >> 8) & 0xff);
+                if (matchCode >= 15) write_length(out, matchCode - 15);
+            }
+        }
+
+        inline std::string compress(std::string_view input) {
+            std::string out;
+            out.reserve(input.size() / 2 + 16);
+
+            constexpr int hashBits = 16;
+            std::vector<int64_t> table(size_t(1) << hashBits, -1);
+            auto hash4 = [&](size_t pos) {
+                uint32_t v;
+                std::memcpy(&v, input.data() + pos, 4);
+                return (v * 2654435761u) >> (32 - hashBits);
+            };
+
+            size_t anchor = 0;
+            size_t pos = 0;
+            while (pos + min_match <= input.size()) {
+                const uint32_t h = hash4(pos);
+                const int64_t candidate = table[h];
+                table[h] = static_cast<int64_t>(pos);
+
+                if (candidate >= 0 && pos - static_cast<size_t>(candidate) <= max_offset &&
+                    std::memcmp(input.data() + candidate, input.data() + pos, min_match) == 0) {
+                    size_t matchLength = min_match;
+                    while (pos + matchLength < input.size() && input[candidate + matchLength] == input[pos + matchLength]) {
+                        ++matchLength;
+                    }
+
+                    write_sequence(out, input.substr(anchor, pos - anchor), matchLength, pos - static_cast<size_t>(candidate));
+                    pos += matchLength;
+                    anchor = pos;
+                } else {
+                    ++pos;
+                }
+            }
+
+            write_sequence(out, input.substr(anchor), 0, 0);
+            return out;
+        }
+
+        // Returns false on malformed input instead of reading or writing out of bounds
+        inline bool decompress(const unsigned char* src, size_t srcSize, char* dst, size_t dstSize) {
+            const unsigned char* ip = src;
+            const unsigned char* const iend = src + srcSize;
+            size_t op = 0;
+
+            auto read_length = [&](size_t& length) {
+                unsigned char b;
+                do {
+                    if (ip >= iend) return false;
+                    b = *ip++;
+                    length += b;
+                } while (b == 255);
+                return true;
+            };
+
+            while (ip < iend) {
+                const unsigned char token = *ip++;
+
+                size_t litLen = token >> 4;
+                if (litLen == 15 && !read_length(litLen)) return false;
+                if (litLen > static_cast<size_t>(iend - ip) || litLen > dstSize - op) return false;
+                std::memcpy(dst + op, ip, litLen);
+                ip += litLen;
+                op += litLen;
+
+                if (ip >= iend) break;
+
+                if (iend - ip < 2) return false;
+                const size_t offset = ip[0] | (static_cast<size_t>(ip[1]) << 8);
+                ip += 2;
+                if (offset == 0 || offset > op) return false;
+
+                size_t matchLength = token & 0x0f;
+                if (matchLength == 15 && !read_length(matchLength)) return false;
+                matchLength += min_match;
+                if (matchLength > dstSize - op) return false;
+
+                // Byte-wise: matches may overlap their own output
+                for (size_t i = 0; i < matchLength; ++i, ++op) {
+                    dst[op] = dst[op - offset];
+                }
+            }
+            return op == dstSize;
+        }
+    }
+
+    struct EmbeddedFile {
+        std::string_view name;
+        uint32_t offset;          // into the compressed blob
+        uint32_t compressedSize;
+        uint32_t size;
+        uint64_t hash;            // FNV-1a of the uncompressed content
+    };
+
+    // View over the generated bundle: a name-sorted index and one blob of individually
+    // compressed files. Lookups are a binary search over the index and allocate nothing;
+    // a file is only decompressed when extracted.
+    class EmbeddedBundle {
+        const EmbeddedFile* first;
+        const EmbeddedFile* last;
+        const unsigned char* blob;
+        size_t blobSize;
+        uint64_t bundleDigest;
+
+    public:
+        constexpr EmbeddedBundle(const EmbeddedFile* files, size_t count, const unsigned char* data, size_t dataSize, uint64_t digest)
+            : first(files), last(files + count), blob(data), blobSize(dataSize), bundleDigest(digest) {}
+
+        [[nodiscard]] constexpr const EmbeddedFile* begin() const { return first; }
+        [[nodiscard]] constexpr const EmbeddedFile* end() const { return last; }
+        [[nodiscard]] constexpr size_t size() const { return static_cast<size_t>(last - first); }
+
+        // Identifies the Anvil build the bundle was generated for
+        [[nodiscard]] constexpr uint64_t digest() const { return bundleDigest; }
+
+        [[nodiscard]] constexpr const EmbeddedFile* find(std::string_view name) const {
+            const EmbeddedFile* it = std::lower_bound(first, last, name, [](const EmbeddedFile& file, std::string_view key) {
+                return file.name < key;
+            });
+            return (it != last && it->name == name) ? it : nullptr;
+        }
+
+        [[nodiscard]] bool extract(const EmbeddedFile& file, std::string& content) const {
+            if (static_cast<size_t>(file.offset) + file.compressedSize > blobSize) return false;
+            content.resize(file.size);
+            return lz::decompress(blob + file.offset, file.compressedSize, content.data(), content.size());
+        }
+    };
+}
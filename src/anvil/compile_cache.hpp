@@ -0,0 +1,486 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <filesystem>
+#include <cstdlib>
+#include "hash.hpp"
+#include "depfile.hpp"
+#include "file_util.hpp"
+#include "toolchain.hpp"
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
+
+namespace anvil {
+    namespace fs = std::filesystem;
+
+    // Parses a size such as "500M" or "5G"; plain numbers are bytes. Returns 0 if invalid.
+    inline unsigned long long parse_size(const std::string& text) {
+        char* end = nullptr;
+        const double value = std::strtod(text.c_str(), &end);
+        if (end == text.c_str() || value <= 0) return 0;
+
+        double scale = 1;
+        switch (*end) {
+            case 'k': case 'K': scale = 1024.0; break;
+            case 'm': case 'M': scale = 1024.0 * 1024; break;
+            case 'g': case 'G': scale = 1024.0 * 1024 * 1024; break;
+            case '\0': break;
+            default: return 0;
+        }
+        return static_cast<unsigned long long>(value * scale);
+    }
+
+    // Quotes an argument for the shell std::system() runs
+    inline std::string shell_quote(const std::string& arg) {
+        if (!arg.empty() && arg.find_first_of(" \t\n\"'\\$`*?[]{}()<>|&;#~") == std::string::npos) {
+            return arg;
+        }
+#ifdef _WIN32
+        return "\"" + arg + "\"";
+#else
+        std::string quoted = "'";
+        for (char c : arg) {
+            if (c == '\'') quoted += "'\\''";
+            else quoted += c;
+        }
+        return quoted + "'";
+#endif
+    }
+
+    // Content-addressed store of compiled objects, shared by every project on the machine,
+    // so keys and input hashes are SHA-256: a collision would restore the wrong object.
+    //
+    // Lookups work in "direct mode", without running the preprocessor. The compiler's
+    // identity and arguments (minus the object and depfile paths) select a manifest; each
+    // manifest entry lists the files an earlier compile read, as reported by its depfile,
+    // with their content hashes. If every file still hashes the same, the entry's object
+    // (and .dwo, with split DWARF), depfile and diagnostics are restored instead of compiling.
+    //
+    // Entries are evicted least recently used first once the store grows past its limit
+    // (ANVIL_CACHE_SIZE, 5G by default). A hit refreshes the entry's mtime.
+    class CompileCache {
+        fs::path root;
+        unsigned long long maxSize;
+        std::map<std::string, std::optional<std::string>> fileHashes;
+
+        static constexpr size_t max_manifest_entries = 8;
+
+        struct ManifestEntry {
+            std::string result;
+            std::vector<std::pair<std::string, std::string>> files;  // hash, path
+        };
+
+    public:
+        CompileCache(fs::path dir, unsigned long long limit) : root(std::move(dir)), maxSize(limit) {}
+
+        // ANVIL_CACHE_DIR, else $XDG_CACHE_HOME/anvil, else ~/.cache/anvil
+        static CompileCache open() {
+            fs::path dir;
+            if (const char* env = std::getenv("ANVIL_CACHE_DIR"); env && *env) {
+                dir = env;
+            } else if (const char* xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg) {
+                dir = fs::path(xdg) / "anvil";
+            } else if (const char* home = std::getenv("HOME"); home && *home) {
+                dir = fs::path(home) / ".cache" / "anvil";
+#ifdef _WIN32
+            } else if (const char* local = std::getenv("LOCALAPPDATA"); local && *local) {
+                dir = fs::path(local) / "anvil" / "cache";
+#endif
+            } else {
+                dir = fs::temp_directory_path() / "anvil-cache";
+            }
+
+            unsigned long long limit = 5ULL << 30;
+            if (const char* size = std::getenv("ANVIL_CACHE_SIZE")) {
+                if (unsigned long long parsed = parse_size(size)) limit = parsed;
+            }
+            return CompileCache(dir, limit);
+        }
+
+        [[nodiscard]] const fs::path& directory() const { return root; }
+        [[nodiscard]] unsigned long long limit() const { return maxSize; }
+
+        struct Invocation {
+            std::vector<std::string> args;
+            std::string object;
+            std::string depfile;
+            std::string dwo;  // split DWARF, written next to the object
+        };
+
+        // Where a compile writes its outputs, or nothing if it isn't a command the cache handles
+        static std::optional<Invocation> parse_invocation(const std::vector<std::string>& args) {
+            Invocation invocation;
+            invocation.args = args;
+            bool compileOnly = false;
+            for (size_t i = 1; i < args.size(); ++i) {
+                // Imported modules are missing from the depfile, so their BMIs can't be checked
+                if (args[i].rfind("-fmodule", 0) == 0 || args[i].rfind("@", 0) == 0) {
+                    return std::nullopt;
+                }
+                if (args[i] == "-c") {
+                    compileOnly = true;
+                } else if (args[i] == "-o" && i + 1 < args.size()) {
+                    invocation.object = args[++i];
+                } else if (args[i] == "-MF" && i + 1 < args.size()) {
+                    invocation.depfile = args[++i];
+                } else if (args[i] == "-gsplit-dwarf") {
+                    invocation.dwo = "split";
+                }
+            }
+            if (args.empty() || !compileOnly || invocation.object.empty() || invocation.depfile.empty()) {
+                return std::nullopt;
+            }
+            if (!invocation.dwo.empty()) {
+                invocation.dwo = fs::path(invocation.object).replace_extension(".dwo").string();
+            }
+            return invocation;
+        }
+
+        // Compiler identity and every argument except where the outputs go. Debug info records
+        // the working directory, so it is part of the key whenever -g is given, and a split
+        // DWARF object names its .dwo, so then the object's path is too.
+        static std::string base_key(const Invocation& invocation) {
+            Sha256 key;
+            key.field("anvil-compile-cache-2");
+            key.field(program_identity(invocation.args[0]));
+            bool debugInfo = false;
+            for (size_t i = 1; i < invocation.args.size(); ++i) {
+                const std::string& arg = invocation.args[i];
+                if (arg == "-o" || arg == "-MF") {
+                    ++i;
+                    continue;
+                }
+                if (arg.rfind("-g", 0) == 0 && arg != "-g0") debugInfo = true;
+                key.field(arg);
+            }
+            if (debugInfo) key.field(fs::current_path().string());
+            if (!invocation.dwo.empty()) key.field(invocation.object);
+            return key.hex();
+        }
+
+        // Runs "<compiler> -c ... -o <object>" through the cache and returns the compiler's
+        // exit code. Commands that aren't a plain compile with a depfile are just run.
+        int compile(const std::vector<std::string>& args, bool& hit) {
+            hit = false;
+            std::optional<Invocation> invocation = parse_invocation(args);
+            if (!invocation) {
+                return run(args, "");
+            }
+
+            const std::string base = base_key(*invocation);
+            const fs::path manifestPath = entry_path("manifests", base);
+            std::vector<ManifestEntry> manifest = read_manifest(manifestPath);
+
+            for (const auto& entry : manifest) {
+                if (matches(entry) && restore(entry, *invocation)) {
+                    touch(manifestPath);
+                    hit = true;
+                    return 0;
+                }
+            }
+
+            const fs::path stderrPath = invocation->object + ".stderr";
+            const int result = run(invocation->args, stderrPath);
+            std::string diagnostics;
+            read_file(stderrPath, diagnostics);
+            std::error_code ec;
+            fs::remove(stderrPath, ec);
+            std::cerr << diagnostics;
+
+            if (result == 0) {
+                try {
+                    store(base, manifestPath, manifest, *invocation, diagnostics);
+                } catch (const std::exception& e) {
+                    // The object is built either way; a full disk only costs the next build a miss
+                    std::cerr << "[Anvil] Warning: could not store " << invocation->object << " in the compile cache: " << e.what() << std::endl;
+                }
+            }
+            return result;
+        }
+
+        struct Usage {
+            size_t entries = 0;
+            unsigned long long bytes = 0;
+        };
+
+        [[nodiscard]] Usage usage() const {
+            Usage usage;
+            for (const auto& [key, info] : collect_entries()) {
+                if (info.isResult) ++usage.entries;
+                usage.bytes += info.bytes;
+            }
+            return usage;
+        }
+
+        // Removes the least recently used entries until the store is at 90% of its limit
+        void trim() const {
+            std::map<std::string, EntryInfo> entries = collect_entries();
+            unsigned long long total = 0;
+            std::vector<std::pair<fs::file_time_type, std::string>> byAge;
+            for (const auto& [key, info] : entries) {
+                total += info.bytes;
+                byAge.emplace_back(info.used, key);
+            }
+            if (total <= maxSize) return;
+
+            std::sort(byAge.begin(), byAge.end());
+            const unsigned long long target = maxSize / 10 * 9;
+            for (const auto& [used, key] : byAge) {
+                if (total <= target) break;
+                std::error_code ec;
+                for (const auto& file : entries[key].files) fs::remove(file, ec);
+                total -= entries[key].bytes;
+            }
+        }
+
+        void clear() const {
+            std::error_code ec;
+            fs::remove_all(root / "objects", ec);
+            fs::remove_all(root / "manifests", ec);
+        }
+
+    private:
+        struct EntryInfo {
+            bool isResult = false;
+            unsigned long long bytes = 0;
+            fs::file_time_type used{};
+            std::vector<fs::path> files;
+        };
+
+        // Groups the store's files by entry: an object, its depfile and diagnostics share a key
+        [[nodiscard]] std::map<std::string, EntryInfo> collect_entries() const {
+            std::map<std::string, EntryInfo> entries;
+            std::error_code ec;
+            for (auto it = fs::recursive_directory_iterator(root, ec); !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+                std::error_code fileEc;
+                if (!it->is_regular_file(fileEc)) continue;
+
+                const fs::path& file = it->path();
+                EntryInfo& info = entries[(file.parent_path() / file.stem()).string()];
+                info.files.push_back(file);
+                info.bytes += it->file_size(fileEc);
+                info.used = std::max(info.used, it->last_write_time(fileEc));
+                if (file.extension() == ".o") info.isResult = true;
+            }
+            return entries;
+        }
+
+        [[nodiscard]] fs::path entry_path(const std::string& kind, const std::string& key) const {
+            return root / kind / key.substr(0, 2) / key;
+        }
+
+        // Hash of a file's contents, or nothing if it can't be read or expands to something
+        // that differs between compiles (__DATE__, __TIME__, __TIMESTAMP__)
+        std::optional<std::string> hash_input(const std::string& path) {
+            auto it = fileHashes.find(path);
+            if (it != fileHashes.end()) return it->second;
+
+            std::optional<std::string> hash;
+            std::string content;
+            if (read_file(path, content) && content.find("__DATE__") == std::string::npos &&
+                content.find("__TIME__") == std::string::npos && content.find("__TIMESTAMP__") == std::string::npos) {
+                hash = Sha256().update(content).hex();
+            }
+            fileHashes.emplace(path, hash);
+            return hash;
+        }
+
+        bool matches(const ManifestEntry& entry) {
+            for (const auto& [hash, path] : entry.files) {
+                std::optional<std::string> current = hash_input(path);
+                if (!current || *current != hash) return false;
+            }
+            return true;
+        }
+
+        static std::string result_key(const std::string& base, const std::vector<std::pair<std::string, std::string>>& files) {
+            Sha256 key;
+            key.field(base);
+            for (const auto& [hash, path] : files) {
+                key.field(path);
+                key.field(hash);
+            }
+            return key.hex();
+        }
+
+        static std::vector<ManifestEntry> read_manifest(const fs::path& path) {
+            std::vector<ManifestEntry> entries;
+            std::string content;
+            if (!read_file(path, content)) return entries;
+
+            std::istringstream in(content);
+            std::string line;
+            while (std::getline(in, line)) {
+                if (line.rfind("entry ", 0) == 0) {
+                    entries.push_back({ line.substr(6), {} });
+                } else if (!entries.empty() && line.size() > Sha256::hex_size + 1 && line[Sha256::hex_size] == ' ') {
+                    entries.back().files.emplace_back(line.substr(0, Sha256::hex_size), line.substr(Sha256::hex_size + 1));
+                }
+            }
+            return entries;
+        }
+
+        static std::string escape_dep(const std::string& path) {
+            std::string escaped;
+            for (char c : path) {
+                if (c == ' ' || c == '#' || c == '\\') escaped += '\\';
+                else if (c == '$') escaped += '$';
+                escaped += c;
+            }
+            return escaped;
+        }
+
+        bool restore(const ManifestEntry& entry, const Invocation& invocation) const {
+            const fs::path result = entry_path("objects", entry.result);
+            fs::path object = result;
+            object += ".o";
+            fs::path diagnostics = result;
+            diagnostics += ".stderr";
+
+            std::error_code ec;
+            fs::create_directories(fs::path(invocation.object).parent_path(), ec);
+            if (!fs::copy_file(object, invocation.object, fs::copy_options::overwrite_existing, ec) || ec) {
+                return false;
+            }
+            if (!invocation.dwo.empty()) {
+                fs::path dwo = result;
+                dwo += ".dwo";
+                if (!fs::copy_file(dwo, invocation.dwo, fs::copy_options::overwrite_existing, ec) || ec) {
+                    return false;
+                }
+            }
+
+            // The depfile is written for this object: the stored one may name another
+            std::string depfile = escape_dep(invocation.object) + ":";
+            for (const auto& [hash, path] : entry.files) depfile += " \\\n " + escape_dep(path);
+            write_file_atomic(invocation.depfile, depfile + "\n");
+
+            std::string stderrText;
+            if (read_file(diagnostics, stderrText)) std::cerr << stderrText;
+            touch(object);
+            return true;
+        }
+
+        void store(const std::string& base, const fs::path& manifestPath, std::vector<ManifestEntry> manifest,
+                   const Invocation& invocation, const std::string& diagnostics) {
+            ManifestEntry entry;
+            for (const auto& path : read_depfile(invocation.depfile)) {
+                std::optional<std::string> hash = hash_input(path);
+                if (!hash) return;
+                entry.files.emplace_back(*hash, path);
+            }
+            if (entry.files.empty()) return;
+            entry.result = result_key(base, entry.files);
+
+            const fs::path result = entry_path("objects", entry.result);
+            std::string object;
+            if (!read_file(invocation.object, object)) return;
+            std::string dwo;
+            if (!invocation.dwo.empty() && !read_file(invocation.dwo, dwo)) return;
+            if (!invocation.dwo.empty()) {
+                fs::path dwoPath = result;
+                dwoPath += ".dwo";
+                write_unique(dwoPath, dwo);
+            }
+            fs::path objectPath = result;
+            objectPath += ".o";
+            write_unique(objectPath, object);
+            if (!diagnostics.empty()) {
+                fs::path stderrPath = result;
+                stderrPath += ".stderr";
+                write_unique(stderrPath, diagnostics);
+            }
+
+            // Newest first, so the entry matching the current tree is usually tried first
+            manifest.erase(std::remove_if(manifest.begin(), manifest.end(), [&](const ManifestEntry& e) { return e.result == entry.result; }), manifest.end());
+            manifest.insert(manifest.begin(), std::move(entry));
+            if (manifest.size() > max_manifest_entries) manifest.resize(max_manifest_entries);
+
+            std::string content;
+            for (const auto& e : manifest) {
+                content += "entry " + e.result + "\n";
+                for (const auto& [hash, path] : e.files) content += hash + " " + path + "\n";
+            }
+            write_unique(manifestPath, content);
+        }
+
+        // Like write_file_atomic, but other compiles may be storing the same key concurrently
+        static void write_unique(const fs::path& path, std::string_view content) {
+            fs::create_directories(path.parent_path());
+#ifdef _WIN32
+            const int pid = _getpid();
+#else
+            const int pid = static_cast<int>(getpid());
+#endif
+            fs::path tmpPath = path;
+            tmpPath += ".tmp" + std::to_string(pid);
+            {
+                std::ofstream out(tmpPath, std::ios::out | std::ios::binary | std::ios::trunc);
+                out.write(content.data(), static_cast<std::streamsize>(content.size()));
+                if (!out) {
+                    throw std::runtime_error("Could not write " + tmpPath.string());
+                }
+            }
+            fs::rename(tmpPath, path);
+        }
+
+        static void touch(const fs::path& path) {
+            std::error_code ec;
+            fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+        }
+
+        static int run(const std::vector<std::string>& args, const fs::path& stderrPath) {
+            std::string cmd;
+            for (const auto& arg : args) {
+                if (!cmd.empty()) cmd += " ";
+                cmd += shell_quote(arg);
+            }
+            if (!stderrPath.empty()) {
+                cmd += " 2> " + shell_quote(stderrPath.string());
+            }
+
+            const int status = std::system(cmd.c_str());
+#ifdef _WIN32
+            return status;
+#else
+            if (WIFEXITED(status)) return WEXITSTATUS(status);
+            return 1;
+#endif
+        }
+    };
+
+    // Where the compile launcher counts this build's hits and misses, relative to the project
+    inline fs::path compile_cache_log() {
+        return fs::path(".anvil_build") / "compile_cache.log";
+    }
+
+    // Per-build hit/miss counts. Every compile appends one line to the log, which is
+    // atomic for a write this small, so parallel compiles don't need a lock.
+    inline void record_compile_cache_result(const fs::path& log, bool hit) {
+        std::ofstream out(log, std::ios::out | std::ios::app);
+        out << (hit ? "hit\n" : "miss\n");
+    }
+
+    inline std::pair<int, int> read_compile_cache_results(const fs::path& log) {
+        std::pair<int, int> counts{ 0, 0 };
+        std::ifstream in(log);
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line == "hit") ++counts.first;
+            else if (line == "miss") ++counts.second;
+        }
+        return counts;
+    }
+}
@@ -0,0 +1,257 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <optional>
+#include <filesystem>
+#include <cstdint>
+#include "api.hpp"
+#include "hash.hpp"
+#include "file_util.hpp"
+
+namespace anvil {
+    namespace fs = std::filesystem;
+
+    // Hash of the directory listings configure() and dependency resolution look at: the top
+    // of the project and of src/ (whether src/main, test/ or a test runner exist), everything
+    // under src/main, src/test and test, and the top of the wrapper and full_deploy trees.
+    // Names only, so editing a source doesn't count, and editors that save through a
+    // temporary file leave it unchanged. A script that globs anywhere else needs --reconfigure.
+    inline std::string config_snapshot(const fs::path& rootDir) {
+        Hasher hasher;
+
+        auto walk = [&](const fs::path& dir, bool recursive, bool dependency) {
+            std::vector<std::string> names;
+            const size_t prefix = dir.generic_string().size() + 1;
+            std::error_code ec;
+            for (auto it = fs::recursive_directory_iterator(dir, ec); !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+                const std::string name = it->path().filename().string();
+                const bool isDir = it->is_directory(ec);
+                const bool generated = dir == rootDir && (name == "bin" || name == "build.ninja");
+                if (name.empty() || name[0] == '.' || generated) {
+                    if (isDir) it.disable_recursion_pending();
+                    continue;
+                }
+                // A top-level listing stops here, and headers inside dependency trees are never
+                // globbed, only the directories holding them
+                if (isDir && (!recursive || (dependency && name == "include"))) {
+                    it.disable_recursion_pending();
+                }
+                names.push_back(it->path().generic_string().substr(prefix) + (isDir ? "/" : ""));
+            }
+            std::sort(names.begin(), names.end());
+
+            hasher.field(dir.generic_string());
+            for (const auto& name : names) {
+                hasher.field(name);
+            }
+        };
+
+        walk(rootDir, false, false);
+        walk(rootDir / "src", false, false);
+        walk(rootDir / "src" / "main", true, false);
+        walk(rootDir / "src" / "test", true, false);
+        walk(rootDir / "test", true, false);
+        walk(rootDir / ".anvil" / "wrapper", true, true);
+        walk(rootDir / ".anvil" / "libraries" / "full_deploy", true, true);
+        return hasher.hex();
+    }
+
+    // .anvil/config.cache: the fully resolved Project, so an unchanged configuration can go
+    // straight to ninja without compiling or running the build script or asking conan.
+    // The caller supplies the key (script fingerprint, Anvil binary, environment); the
+    // directory snapshot is taken and checked here.
+    class ConfigCache {
+        fs::path cachePath;
+
+        static constexpr std::string_view magic = "ANVILCFG";
+        static constexpr uint32_t format_version = 10;
+
+        class Writer {
+        public:
+            std::string data;
+
+            void u32(uint32_t value) {
+                for (int i = 0; i < 4; ++i) data += static_cast<char>((value >> (8 * i)) & 0xff);
+            }
+            void str(std::string_view value) {
+                u32(static_cast<uint32_t>(value.size()));
+                data.append(value);
+            }
+            void strings(const std::vector<std::string>& values) {
+                u32(static_cast<uint32_t>(values.size()));
+                for (const auto& value : values) str(value);
+            }
+        };
+
+        class Reader {
+            std::string_view data;
+            size_t pos = 0;
+        public:
+            bool ok = true;
+
+            explicit Reader(std::string_view input) : data(input) {}
+
+            uint32_t u32() {
+                if (data.size() - pos < 4) { ok = false; return 0; }
+                uint32_t value = 0;
+                for (int i = 0; i < 4; ++i) value |= static_cast<uint32_t>(static_cast<unsigned char>(data[pos + i])) << (8 * i);
+                pos += 4;
+                return value;
+            }
+            std::string str() {
+                const uint32_t size = u32();
+                if (!ok || data.size() - pos < size) { ok = false; return ""; }
+                std::string value(data.substr(pos, size));
+                pos += size;
+                return value;
+            }
+            std::vector<std::string> strings() {
+                const uint32_t count = u32();
+                std::vector<std::string> values;
+                for (uint32_t i = 0; ok && i < count; ++i) values.push_back(str());
+                return values;
+            }
+            [[nodiscard]] bool at_end() const { return pos == data.size(); }
+        };
+
+        static void write_target(Writer& w, const CppApplication& app) {
+            w.str(app.name);
+            w.u32(static_cast<uint32_t>(app.type));
+            w.u32(static_cast<uint32_t>(app.standard));
+            w.u32(static_cast<uint32_t>(app.linkage));
+            w.u32(static_cast<uint32_t>(app.compilerId));
+            w.strings(app.sources);
+            w.strings(app.include_dirs);
+            w.strings(app.defines);
+            w.strings(app.link_flags);
+            w.strings(app.dependencies);
+            w.u32(app.optimization ? static_cast<uint32_t>(*app.optimization) + 1 : 0);
+            w.str(app.compile_pool);
+            w.str(app.link_pool);
+            w.str(app.precompiled_header);
+            w.u32(static_cast<uint32_t>(app.unity_batch_size));
+            w.strings(app.unity_exclude);
+            w.strings(app.links);
+            w.strings(app.public_include_dirs);
+            w.strings(app.public_defines);
+            w.strings(app.module_sources);
+            w.u32(app.import_std ? 1 : 0);
+        }
+
+        static CppApplication read_target(Reader& r) {
+            CppApplication app;
+            app.name = r.str();
+            app.type = static_cast<AppType>(r.u32());
+            app.standard = static_cast<CppStandard>(r.u32());
+            app.linkage = static_cast<Linkage>(r.u32());
+            app.compilerId = static_cast<CompilerId>(r.u32());
+            app.sources = r.strings();
+            app.include_dirs = r.strings();
+            app.defines = r.strings();
+            app.link_flags = r.strings();
+            app.dependencies = r.strings();
+            if (const uint32_t level = r.u32()) {
+                app.optimization = static_cast<Optimization>(level - 1);
+            }
+            app.compile_pool = r.str();
+            app.link_pool = r.str();
+            app.precompiled_header = r.str();
+            app.unity_batch_size = static_cast<int>(r.u32());
+            app.unity_exclude = r.strings();
+            app.links = r.strings();
+            app.public_include_dirs = r.strings();
+            app.public_defines = r.strings();
+            app.module_sources = r.strings();
+            app.import_std = r.u32() != 0;
+            return app;
+        }
+
+    public:
+        explicit ConfigCache(fs::path path) : cachePath(std::move(path)) {}
+
+        void save(const Project& project, const std::string& key, const fs::path& rootDir) const {
+            Writer w;
+            w.data.append(magic);
+            w.u32(format_version);
+            w.str(key);
+            w.str(config_snapshot(rootDir));
+            w.str(project.name);
+            w.str(project.version);
+            w.u32(static_cast<uint32_t>(project.profile));
+            w.u32(project.compile_cache ? 1 : 0);
+            w.u32(project.fast_link ? 1 : 0);
+            w.u32(static_cast<uint32_t>(project.fast_linkers.size()));
+            for (const auto& [toolchainName, linker] : project.fast_linkers) {
+                w.str(toolchainName);
+                w.str(linker.flag);
+                w.str(linker.version);
+            }
+            w.u32(static_cast<uint32_t>(project.pools.size()));
+            for (const auto& [poolName, depth] : project.pools) {
+                w.str(poolName);
+                w.u32(static_cast<uint32_t>(depth));
+            }
+            w.u32(static_cast<uint32_t>(project.targets.size()));
+            for (const auto& target : project.targets) {
+                write_target(w, target);
+            }
+            write_file_atomic(cachePath, w.data);
+        }
+
+        // Returns the cached project if it was saved under this key, the tree's listings are
+        // unchanged and every source it names (including generated test runners) still exists
+        [[nodiscard]] std::optional<Project> load(const std::string& key, const fs::path& rootDir) const {
+            std::string data;
+            if (key.empty() || !read_file(cachePath, data) || data.compare(0, magic.size(), magic) != 0) {
+                return std::nullopt;
+            }
+
+            Reader r(std::string_view(data).substr(magic.size()));
+            if (r.u32() != format_version || r.str() != key || !r.ok) {
+                return std::nullopt;
+            }
+            const std::string snapshot = r.str();
+
+            Project project;
+            project.name = r.str();
+            project.version = r.str();
+            project.profile = static_cast<Optimization>(r.u32());
+            project.compile_cache = r.u32() != 0;
+            project.fast_link = r.u32() != 0;
+            const uint32_t linkerCount = r.u32();
+            for (uint32_t i = 0; r.ok && i < linkerCount; ++i) {
+                std::string toolchainName = r.str();
+                FastLinker& linker = project.fast_linkers[toolchainName];
+                linker.flag = r.str();
+                linker.version = r.str();
+            }
+            const uint32_t poolCount = r.u32();
+            for (uint32_t i = 0; r.ok && i < poolCount; ++i) {
+                std::string poolName = r.str();
+                project.pools[poolName] = static_cast<int>(r.u32());
+            }
+            const uint32_t count = r.u32();
+            for (uint32_t i = 0; r.ok && i < count; ++i) {
+                project.targets.push_back(read_target(r));
+            }
+            if (!r.ok || !r.at_end()) {
+                return std::nullopt;
+            }
+
+            for (const auto& target : project.targets) {
+                for (const auto& src : target.sources) {
+                    if (!fs::exists(rootDir / src)) return std::nullopt;
+                }
+                for (const auto& src : target.module_sources) {
+                    if (!fs::exists(rootDir / src)) return std::nullopt;
+                }
+            }
+            if (snapshot != config_snapshot(rootDir)) {
+                return std::nullopt;
+            }
+            return project;
+        }
+    };
+}
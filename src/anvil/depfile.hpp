@@ -0,0 +1,74 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+namespace anvil {
+    namespace fs = std::filesystem;
+
+    // Parses a Makefile-style depfile as written by -MD/-MMD and returns the
+    // prerequisites of its rule(s). Targets are skipped.
+    inline std::vector<std::string> parse_depfile(const std::string& content) {
+        std::vector<std::string> deps;
+        std::string current;
+        bool inTargets = true;
+
+        auto flush = [&]() {
+            if (current.empty()) return;
+            if (inTargets) {
+                if (current.back() == ':') {
+                    inTargets = false;
+                }
+            } else {
+                deps.push_back(current);
+            }
+            current.clear();
+        };
+
+        for (size_t i = 0; i < content.size(); ++i) {
+            char c = content[i];
+            if (c == '\\' && i + 1 < content.size()) {
+                char next = content[i + 1];
+                if (next == '\n' || next == '\r') {
+                    // Line continuation
+                    flush();
+                    ++i;
+                    if (next == '\r' && i + 1 < content.size() && content[i + 1] == '\n') ++i;
+                    continue;
+                }
+                if (next == ' ' || next == '#' || next == '\\') {
+                    current += next;
+                    ++i;
+                    continue;
+                }
+                current += c;
+            } else if (c == '$' && i + 1 < content.size() && content[i + 1] == '$') {
+                current += '$';
+                ++i;
+            } else if (c == ':' && inTargets && (i + 1 >= content.size() || content[i + 1] == ' ' || content[i + 1] == '\n' || content[i + 1] == '\r')) {
+                // "target:" - a colon followed by whitespace ends the target list
+                current += c;
+                flush();
+            } else if (c == ' ' || c == '\t') {
+                flush();
+            } else if (c == '\n' || c == '\r') {
+                flush();
+                // A new rule starts on the next non-continued line
+                inTargets = true;
+            } else {
+                current += c;
+            }
+        }
+        flush();
+        return deps;
+    }
+
+    inline std::vector<std::string> read_depfile(const fs::path& path) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) return {};
+        std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        return parse_depfile(content);
+    }
+}
@@ -1,574 +1,35 @@
-#include "api.hpp"
-#include "ninja.hpp"
-#include "dependency_manager.hpp"
-#include "pkg.hpp"
-#include <iostream>
-#include <filesystem>
-#include <vector>
+#include "driver.hpp"
+#include "config_cache.hpp"
+#include "trace.hpp"
 #include <string>
-#include <fstream>
-#include <map>
-#include <nlohmann/json.hpp>
-#include <cstdio>
-#include <memory>
-#include <array>
-#include <sstream>
-
-using json = nlohmann::json;
+#include <vector>
+#include <cstdlib>
 
 extern "C" void configure(anvil::Project& project);
 
-namespace fs = std::filesystem;
-
-// Helper to read file content
-std::string read_file_content(const fs::path& path) {
-    std::ifstream f(path, std::ios::in | std::ios::binary);
-    if (!f) return "";
-    return std::string((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
-}
-
-// Helper to escape string for C++ source
-std::string escape_string(const std::string& input) {
-    std::string output;
-    output.reserve(input.size() * 1.1);
-    for (char c : input) {
-        if (c == '\\') output += "\\\\";
-        else if (c == '"') output += "\\\"";
-        else if (c == '\n') output += "\\n";
-        else if (c == '\r') output += "\\r";
-        else if (c == '\t') output += "\\t";
-        else output += c;
-    }
-    return output;
-}
-
-// Helper to convert path to URI
-std::string path_to_uri(const fs::path& p) {
-    fs::path absPath = fs::absolute(p);
-    std::string pathStr = absPath.string();
-    std::string uri;
-
-    // Replace backslashes with forward slashes
-    for (char& c : pathStr) {
-        if (c == '\\') c = '/';
-    }
-
-    // Prepend file://
-    if (pathStr.length() > 0 && (pathStr[0] == '/' || pathStr.find(':') != std::string::npos)) {
-        // If it starts with / (unix absolute) or has a drive letter (windows absolute), ensure we have enough slashes
-        if (pathStr[0] != '/') {
-             uri = "file:///" + pathStr;
-        } else {
-             uri = "file://" + pathStr;
-        }
-    } else {
-        uri = "file://" + pathStr;
-    }
-
-    return uri;
-}
-
-void generate_embedded_resources(const fs::path& libDir) {
-    fs::path outputHeader = fs::current_path() / "src" / "anvil" / "embedded_resources.hpp";
-    std::cerr << "[Anvil] Generating embedded resources to " << outputHeader << "..." << std::endl;
-
-    std::ofstream out(outputHeader);
-    out << "#pragma once\n";
-    out << "#include <string_view>\n";
-    out << "#include <map>\n";
-    out << "#include <string>\n\n";
-    out << "namespace anvil {\n";
-
-    std::map<std::string, fs::path> files_to_embed;
-
-    // Iterate through libDir/full_deploy to find "include" directories
-    fs::path fullDeployDir = libDir / "full_deploy";
-    if (fs::exists(fullDeployDir)) {
-        for (auto it = fs::recursive_directory_iterator(fullDeployDir); it != fs::recursive_directory_iterator(); ++it) {
-            if (it->is_directory() && it->path().filename() == "include") {
-                fs::path includeDir = it->path();
-                for (const auto& fileEntry : fs::recursive_directory_iterator(includeDir)) {
-                    if (fileEntry.is_regular_file()) {
-                        fs::path relativePath = fs::relative(fileEntry.path(), includeDir);
-                        std::string key = relativePath.generic_string();
-                        files_to_embed[key] = fileEntry.path();
-                    }
-                }
-                it.disable_recursion_pending();
-            }
-        }
-    }
-
-    // Embed source files from src/anvil
-    fs::path srcDir = fs::current_path() / "src" / "anvil";
-    if (fs::exists(srcDir)) {
-        for (const auto& entry : fs::directory_iterator(srcDir)) {
-            if (entry.path().extension() == ".hpp" || entry.path().extension() == ".cpp") {
-                if (entry.path().filename() != "embedded_resources.hpp") {
-                    files_to_embed["anvil/" + entry.path().filename().string()] = entry.path();
-                }
-            }
-        }
-    }
-
-    // Write file contents as variables
-    int counter = 0;
-    for (const auto& [name, path] : files_to_embed) {
-        std::string content = read_file_content(path);
-        out << "inline const char file_" << counter << "[] = \"" << escape_string(content) << "\";\n";
-        counter++;
-    }
-
-    out << "\ninline std::map<std::string, std::string_view> get_embedded_files() {\n";
-    out << "    return {\n";
-
-    counter = 0;
-    for (const auto& [name, path] : files_to_embed) {
-        out << "        {\"" << name << "\", file_" << counter << "},\n";
-        counter++;
-    }
-
-    out << "    };\n";
-    out << "}\n";
-    out << "}\n";
-}
-
-// Helper to get system include paths
-std::vector<std::string> get_system_include_paths() {
-    std::vector<std::string> paths;
-    std::string cmd;
-#ifdef _WIN32
-    cmd = "g++ -E -x c++ - -v < NUL 2>&1";
-#else
-    cmd = "c++ -E -x c++ - -v < /dev/null 2>&1";
-#endif
-
-    std::array<char, 128> buffer;
-    std::string result;
-
-#ifdef _WIN32
-    std::unique_ptr<FILE, decltype(&_pclose)> pipe(_popen(cmd.c_str(), "r"), _pclose);
-#else
-    std::unique_ptr<FILE, decltype(&pclose)> pipe(popen(cmd.c_str(), "r"), pclose);
-#endif
-
-    if (!pipe) {
-        std::cerr << "[Anvil] Failed to run compiler to detect include paths." << std::endl;
-        return paths;
-    }
-
-    while (fgets(buffer.data(), buffer.size(), pipe.get()) != nullptr) {
-        result += buffer.data();
-    }
-
-    std::istringstream stream(result);
-    std::string line;
-    bool capturing = false;
-    while (std::getline(stream, line)) {
-        if (line.find("#include <...> search starts here:") != std::string::npos) {
-            capturing = true;
-            continue;
-        }
-        if (line.find("End of search list.") != std::string::npos) {
-            capturing = false;
-            break;
-        }
-        if (capturing) {
-            size_t first = line.find_first_not_of(" \t");
-            if (first == std::string::npos) continue;
-            size_t last = line.find_last_not_of(" \t");
-            std::string path = line.substr(first, (last - first + 1));
-            if (!path.empty()) {
-                paths.push_back(path);
-            }
-        }
-    }
-    return paths;
-}
-
-// BSP Loop
-int run_bsp_loop(const anvil::Project& project) {
-    while (true) {
-        std::string line;
-        std::getline(std::cin, line);
-        if (line.empty()) continue;
-
-        if (line.starts_with("Content-Length: ")) {
-            int length = std::stoi(line.substr(16));
-            std::getline(std::cin, line); // Skip empty line
-
-            std::vector<char> buffer(length);
-            std::cin.read(buffer.data(), length);
-            std::string content(buffer.begin(), buffer.end());
-
-            try {
-                json request = json::parse(content);
-                std::string method = request["method"];
-                json response;
-                response["jsonrpc"] = "2.0";
-                response["id"] = request["id"];
-
-                if (method == "build/initialize") {
-                    response["result"] = {
-                        {"displayName", "Anvil"},
-                        {"version", "0.1.0"},
-                        {"bspVersion", "2.0.0"},
-                        {"capabilities", {
-                            {"compileProvider", {
-                                {"languageIds", {"cpp"}}
-                            }}
-                        }}
-                    };
-                } else if (method == "workspace/buildTargets") {
-                    json targets = json::array();
-                    for (const auto& target : project.targets) {
-                        targets.push_back({
-                            {"id", {{"uri", "target:" + target.name}}},
-                            {"displayName", target.name},
-                            {"baseDirectory", path_to_uri(fs::current_path())},
-                            {"tags", json::array()},
-                            {"languageIds", {"cpp"}},
-                            {"dependencies", json::array()},
-                            {"capabilities", {
-                                {"canCompile", true},
-                                {"canTest", target.type == anvil::AppType::Test},
-                                {"canRun", target.type == anvil::AppType::Executable}
-                            }}
-                        });
-                    }
-                    response["result"] = {{"targets", targets}};
-                } else if (method == "buildTarget/sources") {
-                    json items = json::array();
-                    for (const auto& target : project.targets) {
-                        json sources = json::array();
-                        for (const auto& src : target.sources) {
-                            sources.push_back({
-                                {"uri", path_to_uri(fs::current_path() / src)},
-                                {"kind", 1},
-                                {"generated", false}
-                            });
-                        }
-                        items.push_back({
-                            {"target", {{"uri", "target:" + target.name}}},
-                            {"sources", sources}
-                        });
-                    }
-                    response["result"] = {{"items", items}};
-                } else if (method == "buildTarget/cppOptions") {
-                    static std::vector<std::string> system_includes = get_system_include_paths();
-
-                    json items = json::array();
-                    for (const auto& target : project.targets) {
-                        std::vector<std::string> copts;
-
-                        for (const auto& path : system_includes) {
-                            copts.push_back("-isystem" + path);
-                        }
-
-                        switch (target.standard) {
-                            case anvil::CppStandard::CPP_11: copts.push_back("-std=c++11"); break;
-                            case anvil::CppStandard::CPP_14: copts.push_back("-std=c++14"); break;
-                            case anvil::CppStandard::CPP_17: copts.push_back("-std=c++17"); break;
-                            case anvil::CppStandard::CPP_20: copts.push_back("-std=c++20"); break;
-                            case anvil::CppStandard::CPP_23: copts.push_back("-std=c++23"); break;
-                        }
-
-                        for (const auto& inc : target.include_dirs) {
-                            copts.push_back("-I" + (fs::current_path() / inc).string());
-                        }
-
-                        for (const auto& def : target.defines) {
-                            copts.push_back("-D" + def);
-                        }
-
-                        items.push_back({
-                            {"target", {{"uri", "target:" + target.name}}},
-                            {"copts", copts},
-                            {"defines", target.defines},
-                            {"linkopts", target.link_flags}
-                        });
-                    }
-                    response["result"] = {{"items", items}};
-                } else if (method == "buildTarget/compile") {
-                    anvil::DependencyManager deps(fs::current_path() / ".anvil" / "tools");
-                    fs::path ninjaExe = deps.get_ninja();
-
-                    // Regenerate build.ninja to be safe
-                    {
-                        anvil::NinjaWriter writer("build.ninja");
-                        writer.generate(project);
-                    }
-
-                    std::string cmd = ninjaExe.string();
-                    int result = std::system(cmd.c_str());
-
-                    response["result"] = {{"statusCode", result == 0 ? 1 : 2}};
-                } else if (method == "buildTarget/cleanCache") {
-                    anvil::DependencyManager deps(fs::current_path() / ".anvil" / "tools");
-                    fs::path ninjaExe = deps.get_ninja();
-
-                    std::string cmd = ninjaExe.string() + " -t clean";
-                    std::system(cmd.c_str());
-
-                    response["result"] = {{"cleaned", true}};
-                } else if (method == "buildTarget/run") {
-                    // 1. Build first
-                    anvil::DependencyManager deps(fs::current_path() / ".anvil" / "tools");
-                    fs::path ninjaExe = deps.get_ninja();
-
-                    {
-                        anvil::NinjaWriter writer("build.ninja");
-                        writer.generate(project);
-                    }
-
-                    std::string buildCmd = ninjaExe.string();
-                    int buildResult = std::system(buildCmd.c_str());
-
-                    if (buildResult != 0) {
-                        response["result"] = {{"statusCode", 2}}; // Error
-                    } else {
-                        // 2. Parse target and run
-                        std::string targetUri = request["params"]["target"]["uri"];
-                        std::string targetName = targetUri.substr(7); // Remove "target:"
-
-                        fs::path binPath = fs::current_path() / "bin" / targetName;
-#ifdef _WIN32
-                        binPath += ".exe";
-#endif
-                        if (fs::exists(binPath)) {
-                            int runResult = std::system(binPath.string().c_str());
-                            response["result"] = {{"statusCode", runResult == 0 ? 1 : 2}};
-                        } else {
-                            std::cerr << "[BSP] Executable not found: " << binPath << std::endl;
-                            response["result"] = {{"statusCode", 2}};
-                        }
-                    }
-                } else if (method == "buildTarget/test") {
-                    // 1. Build first
-                    anvil::DependencyManager deps(fs::current_path() / ".anvil" / "tools");
-                    fs::path ninjaExe = deps.get_ninja();
-
-                    {
-                        anvil::NinjaWriter writer("build.ninja");
-                        writer.generate(project);
-                    }
-
-                    std::string buildCmd = ninjaExe.string();
-                    int buildResult = std::system(buildCmd.c_str());
-
-                    if (buildResult != 0) {
-                        response["result"] = {{"statusCode", 2}};
-                    } else {
-                        // 2. Run all test targets
-                        bool allPassed = true;
-                        for (const auto& target : project.targets) {
-                            if (target.type == anvil::AppType::Test) {
-                                fs::path binPath = fs::current_path() / "bin" / target.name;
-#ifdef _WIN32
-                                binPath += ".exe";
-#endif
-                                if (fs::exists(binPath)) {
-                                    std::cout << "[BSP] Running Test: " << target.name << std::endl;
-                                    int testResult = std::system(binPath.string().c_str());
-                                    if (testResult != 0) allPassed = false;
-                                }
-                            }
-                        }
-                        response["result"] = {{"statusCode", allPassed ? 1 : 2}};
-                    }
-                } else if (method == "build/shutdown") {
-                    response["result"] = nullptr;
-                } else if (method == "build/exit") {
-                    return 0;
-                } else {
-                    // Ignore unknown methods for now
-                    continue;
-                }
-
-                std::string responseStr = response.dump();
-                std::cout << "Content-Length: " << responseStr.length() << "\r\n\r\n" << responseStr << std::flush;
-
-            } catch (const std::exception& e) {
-                std::cerr << "[BSP Error] " << e.what() << std::endl;
-            }
-        }
-    }
-    return 0;
-}
-
 int main(int argc, char* argv[]) {
-    bool runAfterBuild = false;
-    bool runTests = false;
-    bool runBsp = false;
-    std::vector<std::string> runArgs;
-
-    // Simple argument parsing
-    for (int i = 1; i < argc; ++i) {
-        std::string arg = argv[i];
-        if (arg == "--run") {
-            runAfterBuild = true;
-        } else if (arg == "--test") {
-            runTests = true;
-        } else if (arg == "--bsp") {
-            runBsp = true;
-        } else if (runAfterBuild) {
-            // Collect arguments for the target application
-            runArgs.push_back(arg);
-        }
-    }
+    std::vector<std::string> args(argv + 1, argv + argc);
 
+    anvil::Tracer::instance().name_process("build script runner");
     anvil::Project project;
-    
-    configure(project);
-
-    // Handle legacy mode where targets might be empty but application is set
-    if (project.targets.empty() && !project.application.name.empty()) {
-        project.targets.push_back(project.application);
+    {
+        anvil::TraceSpan span("configure()");
+        configure(project);
     }
 
-    fs::path rootDir = fs::current_path();
-    std::cerr << "[Anvil] Graph Loaded: " << project.name << std::endl;
-    std::cerr << "[Anvil] Working Directory: " << rootDir << std::endl;
-
-    // --- NEW: Resolve Dependencies ---
-    try {
-        anvil::PackageManager pkgMgr(rootDir / ".anvil" / "libraries");
-        pkgMgr.resolve(project);
-
-        // --- NEW: Generate Embedded Resources (Bootstrap) ---
-        generate_embedded_resources(rootDir / ".anvil" / "libraries");
-        // ----------------------------------------------------
-
-    } catch (const std::exception& e) {
+    if (!anvil::resolve_project(project)) {
         return 1;
     }
-    // ---------------------------------
-
-    if (runBsp) {
-        return run_bsp_loop(project);
-    }
-
-    // Verify sources exist for all targets
-    bool missingSources = false;
-    for (const auto& target : project.targets) {
-        for (const auto& src : target.sources) {
-            fs::path srcPath = rootDir / src;
-            if (!fs::exists(srcPath)) {
-                std::cerr << "[Anvil Error] Source file not found: " << srcPath << std::endl;
 
-                fs::path parent = srcPath.parent_path();
-                if (fs::exists(parent)) {
-                    std::cerr << "Contents of " << parent << ":" << std::endl;
-                    for (const auto& entry : fs::directory_iterator(parent)) {
-                        std::cerr << "  - " << entry.path().filename() << std::endl;
-                    }
-                } else {
-                    std::cerr << "Parent directory " << parent << " does not exist." << std::endl;
-
-                    // Check if src directory exists at all
-                    fs::path srcDir = rootDir / "src";
-                    if (fs::exists(srcDir)) {
-                         std::cerr << "Contents of " << srcDir << ":" << std::endl;
-                         for (const auto& entry : fs::directory_iterator(srcDir)) {
-                            std::cerr << "  - " << entry.path().filename() << std::endl;
-                         }
-                    }
-                }
-                missingSources = true;
-            }
+    // Set by anvil when the script is current, so the next build can skip configure()
+    const char* configKey = std::getenv("ANVIL_CONFIG_KEY");
+    if (configKey && *configKey) {
+        try {
+            anvil::ConfigCache(".anvil/config.cache").save(project, configKey, std::filesystem::current_path());
+        } catch (const std::exception& e) {
+            std::cerr << "[Anvil] Could not cache configuration: " << e.what() << std::endl;
         }
     }
 
-    if (missingSources) {
-        return 1;
-    }
-
-    anvil::DependencyManager deps(rootDir / ".anvil" / "tools");
-
-    try {
-        fs::path ninjaExe = deps.get_ninja();
-
-        {
-            anvil::NinjaWriter writer("build.ninja");
-            writer.generate(project);
-        }
-
-        std::cerr << "[Anvil] Executing Ninja..." << std::endl;
-        std::string cmd = ninjaExe.string();
-        int buildResult = std::system(cmd.c_str());
-
-        if (buildResult != 0) {
-            return buildResult;
-        }
-
-        if (runTests) {
-             bool allTestsPassed = true;
-             bool testsFound = false;
-             for (const auto& target : project.targets) {
-                if (target.type == anvil::AppType::Test) {
-                    testsFound = true;
-                    fs::path binPath = rootDir / "bin" / target.name;
-#ifdef _WIN32
-                    binPath += ".exe";
-#endif
-                    if (fs::exists(binPath)) {
-                        std::cerr << "[Anvil] Running Test: " << target.name << "..." << std::endl;
-                        int result = std::system(binPath.string().c_str());
-                        if (result != 0) {
-                            std::cerr << "[Anvil] Test " << target.name << " failed." << std::endl;
-                            allTestsPassed = false;
-                        } else {
-                            std::cerr << "[Anvil] Test " << target.name << " passed." << std::endl;
-                        }
-                    } else {
-                        std::cerr << "[Anvil Error] Test executable not found: " << binPath << std::endl;
-                        allTestsPassed = false;
-                    }
-                }
-             }
-
-             if (!testsFound) {
-                 std::cerr << "[Anvil] No tests found." << std::endl;
-             }
-
-             if (!allTestsPassed) return 1;
-        }
-
-        if (runAfterBuild) {
-            // Find the first executable target to run
-            const anvil::CppApplication* targetToRun = nullptr;
-            for (const auto& target : project.targets) {
-                if (target.type == anvil::AppType::Executable) {
-                    targetToRun = &target;
-                    break;
-                }
-            }
-
-            if (targetToRun) {
-                fs::path binPath = rootDir / "bin" / targetToRun->name;
-#ifdef _WIN32
-                binPath += ".exe";
-#endif
-                if (fs::exists(binPath)) {
-                    std::cerr << "[Anvil] Running " << targetToRun->name << "..." << std::endl;
-                    std::string runCmd = binPath.string();
-                    for (const auto& arg : runArgs) {
-                        runCmd += " " + arg;
-                    }
-                    return std::system(runCmd.c_str());
-                } else {
-                    std::cerr << "[Anvil Error] Executable not found: " << binPath << std::endl;
-                    return 1;
-                }
-            } else {
-                std::cerr << "[Anvil] No executable target found to run." << std::endl;
-            }
-        }
-
-        return 0;
-
-    } catch (const std::exception& e) {
-        std::cerr << "[Anvil Error] " << e.what() << std::endl;
-        return 1;
-    }
-}
\ No newline at end of file
+    return anvil::run_driver(project, anvil::parse_driver_args(args));
+}
@@ -0,0 +1,861 @@
+#pragma once
+#include "api.hpp"
+#include "ninja.hpp"
+#include "executor.hpp"
+#include "dependency_manager.hpp"
+#include "pkg.hpp"
+#include "bundle.hpp"
+#include "hash.hpp"
+#include "fingerprint.hpp"
+#include "file_util.hpp"
+#include "compile_cache.hpp"
+#include "include_analysis.hpp"
+#include "trace.hpp"
+#include <iostream>
+#include <filesystem>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <map>
+#include <set>
+#include <nlohmann/json.hpp>
+#include <cstdio>
+#include <memory>
+#include <array>
+#include <sstream>
+#include <iomanip>
+
+#include <functional>
+#include <optional>
+#include <algorithm>
+#include <cstdlib>
+
+namespace anvil {
+    namespace fs = std::filesystem;
+    using json = nlohmann::json;
+
+    // Helper to read file content
+    inline std::string read_file_content(const fs::path& path) {
+        std::ifstream f(path, std::ios::in | std::ios::binary);
+        if (!f) return "";
+        return std::string((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    }
+
+    // Helper to render binary data as the body of a C++ string literal
+    inline std::string blob_literal(const std::string& data) {
+        std::string output = "\"";
+        size_t lineLength = 0;
+        for (unsigned char c : data) {
+            if (c >= 0x20 && c < 0x7f && c != '"' && c != '\\' && c != '?') {
+                output += static_cast<char>(c);
+                lineLength += 1;
+            } else {
+                // Always three octal digits, so a following digit can't extend the escape
+                char escape[5] = { '\\', static_cast<char>('0' + (c >> 6)), static_cast<char>('0' + ((c >> 3) & 7)), static_cast<char>('0' + (c & 7)), 0 };
+                output += escape;
+                lineLength += 4;
+            }
+            if (lineLength >= 120) {
+                output += "\"\n\"";
+                lineLength = 0;
+            }
+        }
+        output += "\"";
+        return output;
+    }
+
+    // Helper to convert path to URI
+    inline std::string path_to_uri(const fs::path& p) {
+        fs::path absPath = fs::absolute(p);
+        std::string pathStr = absPath.string();
+        std::string uri;
+
+        // Replace backslashes with forward slashes
+        for (char& c : pathStr) {
+            if (c == '\\') c = '/';
+        }
+
+        // Prepend file://
+        if (pathStr.length() > 0 && (pathStr[0] == '/' || pathStr.find(':') != std::string::npos)) {
+            // If it starts with / (unix absolute) or has a drive letter (windows absolute), ensure we have enough slashes
+            if (pathStr[0] != '/') {
+                 uri = "file:///" + pathStr;
+            } else {
+                 uri = "file://" + pathStr;
+            }
+        } else {
+            uri = "file://" + pathStr;
+        }
+
+        return uri;
+    }
+
+    // The bootstrap headers from full_deploy and Anvil's own sources, keyed by include path
+    inline std::map<std::string, fs::path> collect_embedded_inputs(const fs::path& libDir) {
+        std::map<std::string, fs::path> files_to_embed;
+
+        // Iterate through libDir/full_deploy to find "include" directories
+        fs::path fullDeployDir = libDir / "full_deploy";
+        if (fs::exists(fullDeployDir)) {
+            for (auto it = fs::recursive_directory_iterator(fullDeployDir); it != fs::recursive_directory_iterator(); ++it) {
+                if (it->is_directory() && it->path().filename() == "include") {
+                    fs::path includeDir = it->path();
+                    for (const auto& fileEntry : fs::recursive_directory_iterator(includeDir)) {
+                        if (fileEntry.is_regular_file()) {
+                            fs::path relativePath = fs::relative(fileEntry.path(), includeDir);
+                            std::string key = relativePath.generic_string();
+                            files_to_embed[key] = fileEntry.path();
+                        }
+                    }
+                    it.disable_recursion_pending();
+                }
+            }
+        }
+
+        // Embed source files from src/anvil
+        fs::path srcDir = fs::current_path() / "src" / "anvil";
+        if (fs::exists(srcDir)) {
+            for (const auto& entry : fs::directory_iterator(srcDir)) {
+                if (entry.path().extension() == ".hpp" || entry.path().extension() == ".cpp") {
+                    if (entry.path().filename() != "embedded_resources.hpp") {
+                        files_to_embed["anvil/" + entry.path().filename().string()] = entry.path();
+                    }
+                }
+            }
+        }
+
+        return files_to_embed;
+    }
+
+    // Anvil building itself: the only project whose tree has a generated resource bundle
+    inline bool is_anvil_source_tree(const fs::path& rootDir) {
+        fs::path srcDir = rootDir / "src" / "anvil";
+        return fs::exists(srcDir / "driver.cpp") && fs::exists(srcDir / "bundle.hpp") && fs::exists(rootDir / "src" / "main");
+    }
+
+    // Packs the bootstrap headers and Anvil's own sources into src/anvil/embedded_resources.{hpp,bin,inc}:
+    // a sorted constexpr index in the header and one blob of individually compressed files,
+    // linked with #embed where the compiler has it and as a string literal otherwise.
+    // A fingerprint of the inputs under .anvil skips the work when nothing changed, and
+    // outputs are only rewritten when their bytes differ so ninja sees no churn.
+    inline void generate_embedded_resources(const fs::path& libDir) {
+        fs::path outputDir = fs::current_path() / "src" / "anvil";
+        fs::path outputHeader = outputDir / "embedded_resources.hpp";
+        fs::path outputBlob = outputDir / "embedded_resources.bin";
+        fs::path outputLiteral = outputDir / "embedded_resources.inc";
+
+        std::map<std::string, fs::path> files_to_embed = collect_embedded_inputs(libDir);
+
+        // Names and locations go in the key, contents are checked per input
+        Hasher key;
+        key.field("anvil-bundle-1");
+        std::vector<std::string> inputs;
+        for (const auto& [name, path] : files_to_embed) {
+            key.field(name);
+            key.field(path.string());
+            inputs.push_back(path.string());
+        }
+
+        fs::path manifestPath = fs::current_path() / ".anvil" / "embedded.fingerprint";
+        if (fs::exists(outputHeader) && fs::exists(outputBlob) && fs::exists(outputLiteral) &&
+            fingerprint_matches(manifestPath, key.hex())) {
+            return;
+        }
+
+        std::cerr << "[Anvil] Generating embedded resources to " << outputHeader << "..." << std::endl;
+
+        std::string blob;
+        std::string index;
+        Hasher digest;
+        for (const auto& [name, path] : files_to_embed) {
+            std::string content = read_file_content(path);
+            std::string packed = lz::compress(content);
+
+            index += "        { \"" + name + "\", " + std::to_string(blob.size()) + ", " + std::to_string(packed.size()) + ", " +
+                     std::to_string(content.size()) + ", 0x" + Hasher().update(content).hex() + "ULL },\n";
+            blob += packed;
+
+            digest.field(name);
+            digest.field(content);
+        }
+
+        write_file_if_changed(outputBlob, blob);
+        write_file_if_changed(outputLiteral, blob_literal(blob) + "\n");
+
+        std::ostringstream out;
+        out << "#pragma once\n";
+        out << "// Generated by Anvil from the files it embeds. Do not edit.\n";
+        out << "#include <cstddef>\n";
+        out << "#include <cstdint>\n";
+        out << "#include \"bundle.hpp\"\n\n";
+        out << "#define ANVIL_EMBEDDED_BUNDLE 1\n\n";
+        out << "#if defined(__has_embed)\n";
+        out << "#if __has_embed(\"embedded_resources.bin\")\n";
+        out << "#define ANVIL_EMBEDDED_BLOB_EMBED 1\n";
+        out << "#endif\n";
+        out << "#endif\n\n";
+        out << "namespace anvil {\n";
+        out << "    inline constexpr size_t embedded_file_count = " << files_to_embed.size() << ";\n";
+        out << "    inline constexpr EmbeddedFile embedded_files[] = {\n";
+        out << index;
+        if (files_to_embed.empty()) {
+            out << "        { \"\", 0, 0, 0, 0 },\n";
+        }
+        out << "    };\n\n";
+        out << "#ifdef ANVIL_EMBEDDED_BLOB_EMBED\n";
+        out << "    inline constexpr unsigned char embedded_blob[] = {\n";
+        out << "#embed \"embedded_resources.bin\"\n";
+        out << "    };\n";
+        out << "#else\n";
+        out << "    inline constexpr unsigned char embedded_blob[] =\n";
+        out << "#include \"embedded_resources.inc\"\n";
+        out << "    ;\n";
+        out << "#endif\n\n";
+        out << "    inline constexpr size_t embedded_blob_size = " << blob.size() << ";\n";
+        out << "    inline constexpr uint64_t embedded_digest = 0x" << digest.hex() << "ULL;\n\n";
+        out << "    constexpr EmbeddedBundle embedded_bundle() {\n";
+        out << "        return EmbeddedBundle(embedded_files, embedded_file_count, embedded_blob, embedded_blob_size, embedded_digest);\n";
+        out << "    }\n";
+        out << "}\n";
+        write_file_if_changed(outputHeader, out.str());
+
+        write_fingerprint(manifestPath, key.hex(), inputs);
+    }
+
+    // Helper to get system include paths
+    inline std::vector<std::string> get_system_include_paths() {
+        std::vector<std::string> paths;
+        std::string cmd;
+    #ifdef _WIN32
+        cmd = "g++ -E -x c++ - -v < NUL 2>&1";
+    #else
+        cmd = "c++ -E -x c++ - -v < /dev/null 2>&1";
+    #endif
+
+        std::array<char, 128> buffer;
+        std::string result;
+
+    #ifdef _WIN32
+        std::unique_ptr<FILE, decltype(&_pclose)> pipe(_popen(cmd.c_str(), "r"), _pclose);
+    #else
+        std::unique_ptr<FILE, decltype(&pclose)> pipe(popen(cmd.c_str(), "r"), pclose);
+    #endif
+
+        if (!pipe) {
+            std::cerr << "[Anvil] Failed to run compiler to detect include paths." << std::endl;
+            return paths;
+        }
+
+        while (fgets(buffer.data(), buffer.size(), pipe.get()) != nullptr) {
+            result += buffer.data();
+        }
+
+        std::istringstream stream(result);
+        std::string line;
+        bool capturing = false;
+        while (std::getline(stream, line)) {
+            if (line.find("#include <...> search starts here:") != std::string::npos) {
+                capturing = true;
+                continue;
+            }
+            if (line.find("End of search list.") != std::string::npos) {
+                capturing = false;
+                break;
+            }
+            if (capturing) {
+                size_t first = line.find_first_not_of(" \t");
+                if (first == std::string::npos) continue;
+                size_t last = line.find_last_not_of(" \t");
+                std::string path = line.substr(first, (last - first + 1));
+                if (!path.empty()) {
+                    paths.push_back(path);
+                }
+            }
+        }
+        return paths;
+    }
+
+    // Writes build.ninja for the project, leaving it untouched when nothing changed. When
+    // anvil passes its own path (ANVIL_EXE) the manifest gets a generator rule, so running
+    // ninja directly after editing build.cpp reconfigures first.
+    // configureArgs are extra options the regeneration has to repeat, e.g. --unity=16.
+    // timeTrace has compiles write time traces for --analyze-includes, bypassing the
+    // compile cache, which would skip the compiler. Returns the graph for the native executor.
+    inline BuildGraph write_build_ninja(const Project& project, const std::string& configureArgs = "", bool timeTrace = false) {
+        anvil::NinjaWriter writer("build.ninja");
+        const char* anvilExe = std::getenv("ANVIL_EXE");
+        if (anvilExe && *anvilExe) {
+            std::vector<std::string> inputs = {"build.cpp"};
+            if (fs::exists(".anvil/config.cache")) {
+                inputs.push_back(".anvil/config.cache");
+            }
+            writer.set_generator("\"" + std::string(anvilExe) + "\" build --configure-only --profile=" + profile_name(project.profile) + configureArgs, inputs);
+            writer.set_module_collator("\"" + std::string(anvilExe) + "\" modules collate");
+            if (project.compile_cache && !timeTrace) {
+                writer.set_compile_launcher("\"" + std::string(anvilExe) + "\" cache compile --");
+            }
+        }
+        writer.set_time_trace(timeTrace);
+        writer.generate(project);
+        return writer.build_graph();
+    }
+
+    // Re-runs configure() and dependency resolution; only available when the build script
+    // is loaded in-process and can be rebuilt without restarting.
+    using ProjectLoader = std::function<std::optional<Project>()>;
+
+    // BSP Loop
+    inline int run_bsp_loop(Project project, const ProjectLoader& reload = nullptr) {
+        while (true) {
+            std::string line;
+            if (!std::getline(std::cin, line)) {
+                // Client went away
+                return 0;
+            }
+            if (line.empty()) continue;
+
+            if (line.starts_with("Content-Length: ")) {
+                int length = std::stoi(line.substr(16));
+                std::getline(std::cin, line); // Skip empty line
+
+                std::vector<char> buffer(length);
+                std::cin.read(buffer.data(), length);
+                std::string content(buffer.begin(), buffer.end());
+
+                try {
+                    json request = json::parse(content);
+                    std::string method = request["method"];
+                    json response;
+                    response["jsonrpc"] = "2.0";
+                    response["id"] = request["id"];
+
+                    if (method == "build/initialize") {
+                        response["result"] = {
+                            {"displayName", "Anvil"},
+                            {"version", "0.1.0"},
+                            {"bspVersion", "2.0.0"},
+                            {"capabilities", {
+                                {"compileProvider", {
+                                    {"languageIds", {"cpp"}}
+                                }}
+                            }}
+                        };
+                    } else if (method == "workspace/buildTargets") {
+                        json targets = json::array();
+                        for (const auto& target : project.targets) {
+                            json dependencies = json::array();
+                            for (const auto& lib : target.links) {
+                                dependencies.push_back({{"uri", "target:" + lib}});
+                            }
+                            targets.push_back({
+                                {"id", {{"uri", "target:" + target.name}}},
+                                {"displayName", target.name},
+                                {"baseDirectory", path_to_uri(fs::current_path())},
+                                {"tags", json::array()},
+                                {"languageIds", {"cpp"}},
+                                {"dependencies", dependencies},
+                                {"capabilities", {
+                                    {"canCompile", true},
+                                    {"canTest", target.type == anvil::AppType::Test},
+                                    {"canRun", target.type == anvil::AppType::Executable}
+                                }}
+                            });
+                        }
+                        response["result"] = {{"targets", targets}};
+                    } else if (method == "buildTarget/sources") {
+                        json items = json::array();
+                        for (const auto& target : project.targets) {
+                            json sources = json::array();
+                            std::vector<std::string> allSources = target.sources;
+                            allSources.insert(allSources.end(), target.module_sources.begin(), target.module_sources.end());
+                            for (const auto& src : allSources) {
+                                sources.push_back({
+                                    {"uri", path_to_uri(fs::current_path() / src)},
+                                    {"kind", 1},
+                                    {"generated", false}
+                                });
+                            }
+                            items.push_back({
+                                {"target", {{"uri", "target:" + target.name}}},
+                                {"sources", sources}
+                            });
+                        }
+                        response["result"] = {{"items", items}};
+                    } else if (method == "buildTarget/cppOptions") {
+                        static std::vector<std::string> system_includes = get_system_include_paths();
+
+                        const anvil::TargetIndex index = anvil::index_targets(project.targets);
+                        json items = json::array();
+                        for (const auto& target : project.targets) {
+                            // The same include dirs and defines the build compiles the target with
+                            const anvil::UsageRequirements usage = anvil::usage_requirements(target, anvil::usage_closure(index, target));
+                            std::vector<std::string> copts;
+
+                            for (const auto& path : system_includes) {
+                                copts.push_back("-isystem" + path);
+                            }
+
+                            switch (target.standard) {
+                                case anvil::CppStandard::CPP_11: copts.push_back("-std=c++11"); break;
+                                case anvil::CppStandard::CPP_14: copts.push_back("-std=c++14"); break;
+                                case anvil::CppStandard::CPP_17: copts.push_back("-std=c++17"); break;
+                                case anvil::CppStandard::CPP_20: copts.push_back("-std=c++20"); break;
+                                case anvil::CppStandard::CPP_23: copts.push_back("-std=c++23"); break;
+                            }
+
+                            for (const auto& inc : usage.include_dirs) {
+                                copts.push_back("-I" + (fs::current_path() / inc).string());
+                            }
+
+                            for (const auto& def : usage.defines) {
+                                copts.push_back("-D" + def);
+                            }
+
+                            items.push_back({
+                                {"target", {{"uri", "target:" + target.name}}},
+                                {"copts", copts},
+                                {"defines", usage.defines},
+                                {"linkopts", target.link_flags}
+                            });
+                        }
+                        response["result"] = {{"items", items}};
+                    } else if (method == "buildTarget/compile") {
+                        anvil::DependencyManager deps(fs::current_path() / ".anvil" / "tools");
+                        fs::path ninjaExe = deps.get_ninja();
+
+                        // Only rewritten if the project changed since the last request
+                        write_build_ninja(project);
+
+                        std::string cmd = ninjaExe.string();
+                        int result = std::system(cmd.c_str());
+
+                        response["result"] = {{"statusCode", result == 0 ? 1 : 2}};
+                    } else if (method == "buildTarget/cleanCache") {
+                        anvil::DependencyManager deps(fs::current_path() / ".anvil" / "tools");
+                        fs::path ninjaExe = deps.get_ninja();
+
+                        std::string cmd = ninjaExe.string() + " -t clean";
+                        std::system(cmd.c_str());
+
+                        response["result"] = {{"cleaned", true}};
+                    } else if (method == "buildTarget/run") {
+                        // 1. Build first
+                        anvil::DependencyManager deps(fs::current_path() / ".anvil" / "tools");
+                        fs::path ninjaExe = deps.get_ninja();
+
+                        write_build_ninja(project);
+
+                        std::string buildCmd = ninjaExe.string();
+                        int buildResult = std::system(buildCmd.c_str());
+
+                        if (buildResult != 0) {
+                            response["result"] = {{"statusCode", 2}}; // Error
+                        } else {
+                            // 2. Parse target and run
+                            std::string targetUri = request["params"]["target"]["uri"];
+                            std::string targetName = targetUri.substr(7); // Remove "target:"
+
+                            fs::path binPath = fs::current_path() / "bin" / targetName;
+    #ifdef _WIN32
+                            binPath += ".exe";
+    #endif
+                            if (fs::exists(binPath)) {
+                                int runResult = std::system(binPath.string().c_str());
+                                response["result"] = {{"statusCode", runResult == 0 ? 1 : 2}};
+                            } else {
+                                std::cerr << "[BSP] Executable not found: " << binPath << std::endl;
+                                response["result"] = {{"statusCode", 2}};
+                            }
+                        }
+                    } else if (method == "buildTarget/test") {
+                        // 1. Build first
+                        anvil::DependencyManager deps(fs::current_path() / ".anvil" / "tools");
+                        fs::path ninjaExe = deps.get_ninja();
+
+                        write_build_ninja(project);
+
+                        std::string buildCmd = ninjaExe.string();
+                        int buildResult = std::system(buildCmd.c_str());
+
+                        if (buildResult != 0) {
+                            response["result"] = {{"statusCode", 2}};
+                        } else {
+                            // 2. Run all test targets
+                            bool allPassed = true;
+                            for (const auto& target : project.targets) {
+                                if (target.type == anvil::AppType::Test) {
+                                    fs::path binPath = fs::current_path() / "bin" / target.name;
+    #ifdef _WIN32
+                                    binPath += ".exe";
+    #endif
+                                    if (fs::exists(binPath)) {
+                                        std::cout << "[BSP] Running Test: " << target.name << std::endl;
+                                        int testResult = std::system(binPath.string().c_str());
+                                        if (testResult != 0) allPassed = false;
+                                    }
+                                }
+                            }
+                            response["result"] = {{"statusCode", allPassed ? 1 : 2}};
+                        }
+                    } else if (method == "workspace/reload") {
+                        if (!reload) {
+                            response["error"] = {{"code", -32601}, {"message", "Reload requires the build script to be loaded in-process"}};
+                        } else if (auto reloaded = reload()) {
+                            project = std::move(*reloaded);
+                            response["result"] = nullptr;
+                        } else {
+                            response["error"] = {{"code", -32603}, {"message", "Failed to reload build script"}};
+                        }
+                    } else if (method == "build/shutdown") {
+                        response["result"] = nullptr;
+                    } else if (method == "build/exit") {
+                        return 0;
+                    } else {
+                        // Ignore unknown methods for now
+                        continue;
+                    }
+
+                    std::string responseStr = response.dump();
+                    std::cout << "Content-Length: " << responseStr.length() << "\r\n\r\n" << responseStr << std::flush;
+
+                } catch (const std::exception& e) {
+                    std::cerr << "[BSP Error] " << e.what() << std::endl;
+                }
+            }
+        }
+        return 0;
+    }
+
+    struct DriverOptions {
+        bool runAfterBuild = false;
+        bool runTests = false;
+        bool runBsp = false;
+        bool configureOnly = false;
+        std::string profile;
+        int unityBatchSize = 0;              // --unity[=N] for targets without their own setting
+        bool analyzeIncludes = false;        // --analyze-includes: time-trace compiles and rank headers
+        std::vector<std::string> ninjaArgs;  // -j / -l passed through to ninja
+        std::string executor = "ninja";      // --executor=native runs the graph in-process
+        int jobs = 0;                        // -j for the native executor
+        std::vector<std::string> runArgs;
+    };
+
+    inline DriverOptions parse_driver_args(const std::vector<std::string>& args) {
+        DriverOptions options;
+
+        // Simple argument parsing
+        for (size_t i = 0; i < args.size(); ++i) {
+            const std::string& arg = args[i];
+            // Parallelism flags for ninja; once --run is seen everything else belongs to the application
+            const bool forNinja = !options.runAfterBuild;
+
+            if (arg == "--run") {
+                options.runAfterBuild = true;
+            } else if (arg == "--test") {
+                options.runTests = true;
+            } else if (arg == "--bsp") {
+                options.runBsp = true;
+            } else if (arg == "--configure-only") {
+                options.configureOnly = true;
+            } else if (arg.rfind("--profile=", 0) == 0) {
+                options.profile = arg.substr(10);
+            } else if (arg == "--unity") {
+                options.unityBatchSize = 16;
+            } else if (arg.rfind("--unity=", 0) == 0) {
+                options.unityBatchSize = std::max(1, std::atoi(arg.c_str() + 8));
+            } else if (arg == "--analyze-includes") {
+                options.analyzeIncludes = true;
+            } else if (arg.rfind("--executor=", 0) == 0) {
+                options.executor = arg.substr(11);
+            } else if (forNinja && (arg == "-j" || arg == "-l") && i + 1 < args.size()) {
+                if (arg == "-j") options.jobs = std::atoi(args[i + 1].c_str());
+                options.ninjaArgs.push_back(arg);
+                options.ninjaArgs.push_back(args[++i]);
+            } else if (forNinja && (arg.rfind("-j", 0) == 0 || arg.rfind("-l", 0) == 0) && arg.size() > 2) {
+                if (arg[1] == 'j') options.jobs = std::atoi(arg.c_str() + 2);
+                options.ninjaArgs.push_back(arg);
+            } else if (forNinja && arg.rfind("--jobs=", 0) == 0) {
+                options.jobs = std::atoi(arg.c_str() + 7);
+                options.ninjaArgs.push_back("-j" + arg.substr(7));
+            } else if (forNinja && arg.rfind("--load-average=", 0) == 0) {
+                options.ninjaArgs.push_back("-l" + arg.substr(15));
+            } else if (options.runAfterBuild) {
+                // Collect arguments for the target application
+                options.runArgs.push_back(arg);
+            }
+        }
+        return options;
+    }
+
+    // Everything between configure() and generating the build graph
+    inline bool resolve_project(Project& project) {
+        // Handle legacy mode where targets might be empty but application is set
+        if (project.targets.empty() && !project.application.name.empty()) {
+            project.targets.push_back(project.application);
+        }
+
+        fs::path rootDir = fs::current_path();
+        std::cerr << "[Anvil] Graph Loaded: " << project.name << std::endl;
+        std::cerr << "[Anvil] Working Directory: " << rootDir << std::endl;
+
+        // --- NEW: Resolve Dependencies ---
+        try {
+            {
+                TraceSpan span("Resolve packages");
+                anvil::PackageManager pkgMgr(rootDir / ".anvil" / "libraries");
+                pkgMgr.resolve(project);
+            }
+
+            {
+                TraceSpan span("Select linkers");
+                select_fast_linkers(project);
+            }
+
+            // Only Anvil's own tree embeds resources; other projects skip the scan entirely
+            if (is_anvil_source_tree(rootDir)) {
+                TraceSpan span("Generate embedded resources");
+                generate_embedded_resources(rootDir / ".anvil" / "libraries");
+            }
+
+        } catch (const std::exception& e) {
+            return false;
+        }
+        // ---------------------------------
+
+        return true;
+    }
+
+    // Prints the compile cache's hits and misses for the build that just ran and, if it
+    // stored anything, trims the cache back to its size limit
+    inline void report_compile_cache() {
+        const auto [hits, misses] = read_compile_cache_results(compile_cache_log());
+        if (hits + misses == 0) {
+            return;
+        }
+        std::cerr << "[Anvil] Compile cache: " << hits << " hits, " << misses << " misses" << std::endl;
+        if (misses > 0) {
+            CompileCache::open().trim();
+        }
+    }
+
+    // Prints the headers and templates that cost the most compile time in the build, from
+    // the compiles' time traces, and writes the full ranking to include_analysis.json
+    inline void report_include_analysis(const fs::path& buildDir) {
+        const std::vector<fs::path> traces = find_time_traces(buildDir);
+        if (traces.empty()) {
+            std::cerr << "[Anvil] Include analysis: no time traces found (needs Clang)" << std::endl;
+            return;
+        }
+
+        const nlohmann::json analysis = aggregate_time_traces(traces, 1000);
+        write_file_atomic(buildDir / "include_analysis.json", analysis.dump(2) + "\n");
+        constexpr size_t shown = 15;
+        auto seconds = [](const nlohmann::json& ms) {
+            std::ostringstream out;
+            out << std::fixed << std::setprecision(2) << ms.get<double>() / 1000.0 << "s";
+            return out.str();
+        };
+
+        std::cerr << "[Anvil] Include analysis of " << analysis["translationUnits"].get<size_t>() << " translation units ("
+                  << seconds(analysis["frontendMs"]) << " in the frontend):" << std::endl;
+        std::cerr << "  Headers by total parse time (total, includers, average):" << std::endl;
+        for (size_t i = 0; i < std::min(shown, analysis["headers"].size()); ++i) {
+            const auto& header = analysis["headers"][i];
+            std::cerr << "    " << std::setw(8) << seconds(header["totalMs"]) << std::setw(6) << header["includers"].get<int64_t>()
+                      << std::setw(9) << seconds(header["averageMs"]) << "  " << header["name"].get<std::string>() << std::endl;
+        }
+        std::cerr << "  Templates by total instantiation time (total, instantiations):" << std::endl;
+        for (size_t i = 0; i < std::min(shown, analysis["templates"].size()); ++i) {
+            const auto& entry = analysis["templates"][i];
+            std::cerr << "    " << std::setw(8) << seconds(entry["totalMs"]) << std::setw(7) << entry["instantiations"].get<int64_t>()
+                      << "  " << entry["name"].get<std::string>() << std::endl;
+        }
+        std::cerr << "[Anvil] Full ranking: " << (buildDir / "include_analysis.json").generic_string() << std::endl;
+    }
+
+    // Drives a resolved project: writes build.ninja, runs ninja and then the tests or the
+    // application, or serves BSP. Shared by the runner executable and by anvil itself when
+    // the build script is loaded in-process.
+    inline int run_driver(const Project& configured, const DriverOptions& options, const ProjectLoader& reload = nullptr) {
+        fs::path rootDir = fs::current_path();
+
+        Project project = configured;
+        if (!options.profile.empty() && !parse_profile(options.profile, project.profile)) {
+            std::cerr << "[Anvil Error] Unknown profile '" << options.profile << "'. Expected debug, release, relwithdebinfo or minsize." << std::endl;
+            return 1;
+        }
+        if (options.unityBatchSize > 0) {
+            for (auto& target : project.targets) {
+                if (target.unity_batch_size == 0) target.unity_batch_size = options.unityBatchSize;
+            }
+        }
+
+        if (options.runBsp) {
+            return run_bsp_loop(project, reload);
+        }
+        if (options.executor != "ninja" && options.executor != "native") {
+            std::cerr << "[Anvil Error] Unknown executor '" << options.executor << "'. Expected ninja or native." << std::endl;
+            return 1;
+        }
+
+        // Verify sources exist for all targets
+        bool missingSources = false;
+        for (const auto& target : project.targets) {
+            std::vector<std::string> allSources = target.sources;
+            allSources.insert(allSources.end(), target.module_sources.begin(), target.module_sources.end());
+            for (const auto& src : allSources) {
+                fs::path srcPath = rootDir / src;
+                if (!fs::exists(srcPath)) {
+                    std::cerr << "[Anvil Error] Source file not found: " << srcPath << std::endl;
+
+                    fs::path parent = srcPath.parent_path();
+                    if (fs::exists(parent)) {
+                        std::cerr << "Contents of " << parent << ":" << std::endl;
+                        for (const auto& entry : fs::directory_iterator(parent)) {
+                            std::cerr << "  - " << entry.path().filename() << std::endl;
+                        }
+                    } else {
+                        std::cerr << "Parent directory " << parent << " does not exist." << std::endl;
+
+                        // Check if src directory exists at all
+                        fs::path srcDir = rootDir / "src";
+                        if (fs::exists(srcDir)) {
+                             std::cerr << "Contents of " << srcDir << ":" << std::endl;
+                             for (const auto& entry : fs::directory_iterator(srcDir)) {
+                                std::cerr << "  - " << entry.path().filename() << std::endl;
+                             }
+                        }
+                    }
+                    missingSources = true;
+                }
+            }
+        }
+
+        if (missingSources) {
+            return 1;
+        }
+
+        anvil::DependencyManager deps(rootDir / ".anvil" / "tools");
+
+        try {
+            BuildGraph graph;
+            {
+                TraceSpan span("Write build.ninja");
+                std::string configureArgs = options.unityBatchSize > 0 ? " --unity=" + std::to_string(options.unityBatchSize) : "";
+                if (options.analyzeIncludes) configureArgs += " --analyze-includes";
+                graph = write_build_ninja(project, configureArgs, options.analyzeIncludes);
+            }
+            if (options.configureOnly) {
+                return 0;
+            }
+
+            std::error_code ec;
+            fs::remove(compile_cache_log(), ec);
+            int buildResult = 0;
+            if (options.executor == "native") {
+                // Keeps its own log next to ninja's, so switching executors rebuilds once
+                std::cerr << "[Anvil] Building (" << profile_name(project.profile) << ")..." << std::endl;
+                NativeExecutor executor(graph, fs::path(".anvil_build") / profile_name(project.profile) / ".anvil_log");
+                TraceSpan span("Build (native)");
+                buildResult = executor.run(options.jobs);
+            } else {
+                fs::path ninjaExe = deps.get_ninja();
+
+                std::cerr << "[Anvil] Executing Ninja (" << profile_name(project.profile) << ")..." << std::endl;
+                std::string cmd = ninjaExe.string();
+                for (const auto& arg : options.ninjaArgs) {
+                    cmd += " " + arg;
+                }
+
+                // The actions ninja runs are read back from its log afterwards
+                const fs::path ninjaLog = fs::path(".anvil_build") / profile_name(project.profile) / ".ninja_log";
+                const bool tracing = Tracer::instance().enabled();
+                const std::set<std::string> logged = tracing ? read_ninja_log_lines(ninjaLog) : std::set<std::string>();
+                {
+                    TraceSpan span("Build (ninja)");
+                    const int64_t ninjaStart = Tracer::now();
+                    buildResult = std::system(cmd.c_str());
+                    if (tracing) trace_ninja_log(ninjaLog, logged, ninjaStart);
+                }
+            }
+            report_compile_cache();
+
+            if (buildResult != 0) {
+                return buildResult;
+            }
+            if (options.analyzeIncludes) {
+                report_include_analysis(fs::path(".anvil_build") / profile_name(project.profile));
+            }
+
+            if (options.runTests) {
+                 bool allTestsPassed = true;
+                 bool testsFound = false;
+                 for (const auto& target : project.targets) {
+                    if (target.type == anvil::AppType::Test) {
+                        testsFound = true;
+                        fs::path binPath = rootDir / "bin" / target.name;
+    #ifdef _WIN32
+                        binPath += ".exe";
+    #endif
+                        if (fs::exists(binPath)) {
+                            std::cerr << "[Anvil] Running Test: " << target.name << "..." << std::endl;
+                            int result = std::system(binPath.string().c_str());
+                            if (result != 0) {
+                                std::cerr << "[Anvil] Test " << target.name << " failed." << std::endl;
+                                allTestsPassed = false;
+                            } else {
+                                std::cerr << "[Anvil] Test " << target.name << " passed." << std::endl;
+                            }
+                        } else {
+                            std::cerr << "[Anvil Error] Test executable not found: " << binPath << std::endl;
+                            allTestsPassed = false;
+                        }
+                    }
+                 }
+
+                 if (!testsFound) {
+                     std::cerr << "[Anvil] No tests found." << std::endl;
+                 }
+
+                 if (!allTestsPassed) return 1;
+            }
+
+            if (options.runAfterBuild) {
+                // Find the first executable target to run
+                const anvil::CppApplication* targetToRun = nullptr;
+                for (const auto& target : project.targets) {
+                    if (target.type == anvil::AppType::Executable) {
+                        targetToRun = &target;
+                        break;
+                    }
+                }
+
+                if (targetToRun) {
+                    fs::path binPath = rootDir / "bin" / targetToRun->name;
+    #ifdef _WIN32
+                    binPath += ".exe";
+    #endif
+                    if (fs::exists(binPath)) {
+                        std::cerr << "[Anvil] Running " << targetToRun->name << "..." << std::endl;
+                        std::string runCmd = binPath.string();
+                        for (const auto& arg : options.runArgs) {
+                            runCmd += " " + arg;
+                        }
+                        return std::system(runCmd.c_str());
+                    } else {
+                        std::cerr << "[Anvil Error] Executable not found: " << binPath << std::endl;
+                        return 1;
+                    }
+                } else {
+                    std::cerr << "[Anvil] No executable target found to run." << std::endl;
+                }
+            }
+
+            return 0;
+
+        } catch (const std::exception& e) {
+            std::cerr << "[Anvil Error] " << e.what() << std::endl;
+            return 1;
+        }
+    }
+}
@@ -0,0 +1,478 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <filesystem>
+#include "build_graph.hpp"
+#include "build_log.hpp"
+#include "depfile.hpp"
+#include "file_util.hpp"
+#include "hash.hpp"
+#include "trace.hpp"
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#endif
+
+namespace anvil {
+    namespace fs = std::filesystem;
+
+    // Runs a BuildGraph without ninja (anvil build --executor=native).
+    //
+    // Every command runs on a pool of worker threads. Ready commands are started longest
+    // critical path first, using the durations the build log kept from the last build, so
+    // the slowest chains of compiles and links start early instead of in manifest order.
+    // An action is checked when its inputs are done: it runs if its output is missing, its
+    // command changed or an input or dependency was modified after it last ran. Outputs a
+    // command leaves untouched therefore don't rebuild what depends on them, as if every
+    // rule had restat. A command's output is printed in one piece when it finishes.
+    //
+    // Dyndep files (C++ modules) are loaded as soon as the action writing them is done.
+    // Generator edges are skipped: the graph came from the configuration anvil just ran.
+    class NativeExecutor {
+        struct Action {
+            std::vector<std::string> outputs;  // explicit, then implicit
+            std::vector<std::string> inputs;   // explicit and implicit, and those from a dyndep file
+            std::string command;
+            std::string description;
+            std::string depfile;
+            std::string pool;
+            bool gccDeps = false;
+            uint64_t commandHash = 0;
+
+            std::vector<size_t> dependents;
+            size_t waiting = 0;    // producers of inputs and order-only inputs that haven't finished
+            double priority = 0;   // expected milliseconds from its start to the end of the build
+            bool finished = false;
+        };
+
+        std::vector<Action> actions;
+        std::map<std::string, size_t> producers;
+        std::map<std::string, std::vector<size_t>> dyndepUsers;  // dyndep file -> actions it describes
+        std::vector<std::pair<size_t, std::string>> orderOnly;    // only ordered, never make an action dirty
+        std::map<std::string, int> poolDepth;
+        std::map<std::string, int> poolUse;
+        std::map<std::string, std::optional<int64_t>> sourceTimes;
+        BuildLog log;
+
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::set<std::pair<double, size_t>, std::greater<>> ready;
+        size_t unfinished = 0;
+        size_t running = 0;
+        size_t total = 0;
+        size_t done = 0;
+        bool failed = false;
+
+    public:
+        NativeExecutor(const BuildGraph& graph, const fs::path& logPath) : log(logPath) {
+            std::map<std::string, std::string> globals;
+            for (const auto& [name, value] : graph.globals) {
+                globals[name] = expand_ninja(value, [&](const std::string& var) { return globals[var]; });
+            }
+            std::vector<std::map<std::string, std::string>> scopes;
+            for (const auto& bindings : graph.scopes) {
+                std::map<std::string, std::string>& scope = scopes.emplace_back();
+                for (const auto& [name, value] : bindings) {
+                    scope[name] = expand_ninja(value, [&](const std::string& var) {
+                        auto it = scope.find(var);
+                        return it != scope.end() ? it->second : globals[var];
+                    });
+                }
+            }
+            poolDepth = graph.pools;
+            poolDepth["console"] = 1;
+
+            for (const auto& edge : graph.edges) {
+                auto ruleIt = graph.rules.find(edge.rule);
+                if (ruleIt == graph.rules.end()) {
+                    throw std::runtime_error("Build edge uses unknown rule '" + edge.rule + "'");
+                }
+                const Bindings& rule = ruleIt->second.bindings;
+
+                std::function<std::string(const std::string&)> inScope = [&](const std::string& var) {
+                    if (edge.scope >= 0) {
+                        auto it = scopes[edge.scope].find(var);
+                        if (it != scopes[edge.scope].end()) return it->second;
+                    }
+                    auto it = globals.find(var);
+                    return it != globals.end() ? it->second : std::string();
+                };
+                auto paths = [&](const std::vector<std::string>& list) {
+                    std::vector<std::string> result;
+                    for (const auto& p : list) result.push_back(expand_ninja(p, inScope));
+                    return result;
+                };
+
+                std::map<std::string, std::string> edgeVars;
+                for (const auto& [name, value] : edge.bindings) edgeVars[name] = expand_ninja(value, inScope);
+
+                const std::vector<std::string> outputs = paths(edge.outputs);
+                const std::vector<std::string> inputs = paths(edge.inputs);
+                std::function<std::string(const std::string&)> inEdge = [&](const std::string& var) -> std::string {
+                    if (var == "in" || var == "out") {
+                        std::string joined;
+                        for (const auto& p : var == "in" ? inputs : outputs) joined += (joined.empty() ? "" : " ") + p;
+                        return joined;
+                    }
+                    if (auto it = edgeVars.find(var); it != edgeVars.end()) return it->second;
+                    for (const auto& [name, value] : rule) {
+                        if (name == var) return expand_ninja(value, inEdge);
+                    }
+                    return inScope(var);
+                };
+
+                if (!inEdge("generator").empty()) continue;
+
+                Action action;
+                action.outputs = outputs;
+                for (auto& p : paths(edge.implicitOutputs)) action.outputs.push_back(std::move(p));
+                action.inputs = inputs;
+                for (auto& p : paths(edge.implicitInputs)) action.inputs.push_back(std::move(p));
+                action.command = inEdge("command");
+                action.description = inEdge("description");
+                action.depfile = inEdge("depfile");
+                action.pool = inEdge("pool");
+                action.gccDeps = inEdge("deps") == "gcc";
+                action.commandHash = Hasher().update(action.command).digest();
+
+                const size_t index = actions.size();
+                for (const auto& output : action.outputs) producers[output] = index;
+                if (const std::string dyndep = inEdge("dyndep"); !dyndep.empty()) {
+                    dyndepUsers[dyndep].push_back(index);
+                }
+                for (auto& p : paths(edge.orderOnly)) orderOnly.emplace_back(index, std::move(p));
+                actions.push_back(std::move(action));
+            }
+        }
+
+        // Builds everything. jobs is the number of concurrent commands (0: cores + 2, as ninja).
+        // Returns 0 on success.
+        int run(int jobs) {
+            log.load();
+            link();
+
+            if (jobs <= 0) jobs = static_cast<int>(std::thread::hardware_concurrency()) + 2;
+            unfinished = actions.size();
+            total = actions.size();
+
+            std::vector<size_t> start;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (size_t i = 0; i < actions.size(); ++i) {
+                    if (actions[i].waiting == 0) start.push_back(i);
+                }
+                settle(start);
+            }
+
+            std::vector<std::thread> workers;
+            for (int i = 0; i < jobs; ++i) {
+                workers.emplace_back([this, i] { work(i); });
+            }
+            for (auto& worker : workers) worker.join();
+
+            if (failed) {
+                std::cerr << "[Anvil Error] Build stopped: a command failed." << std::endl;
+                return 1;
+            }
+            if (unfinished > 0) {
+                std::cerr << "[Anvil Error] Build stopped: dependency cycle among " << unfinished << " actions." << std::endl;
+                return 1;
+            }
+            if (done == 0) {
+                std::cerr << "[Anvil] Nothing to do." << std::endl;
+            }
+            return 0;
+        }
+
+    private:
+        void depend(size_t action, const std::string& input) {
+            auto it = producers.find(input);
+            if (it == producers.end() || it->second == action || actions[it->second].finished) return;
+            actions[it->second].dependents.push_back(action);
+            ++actions[action].waiting;
+        }
+
+        // Connects every action to the producers of its inputs and weighs it by its critical path
+        void link() {
+            for (size_t i = 0; i < actions.size(); ++i) {
+                for (const auto& input : actions[i].inputs) depend(i, input);
+            }
+            for (const auto& [action, input] : orderOnly) depend(action, input);
+
+            // Unknown durations count as the average known one
+            std::vector<double> duration(actions.size(), 0);
+            double known = 0;
+            size_t knownCount = 0;
+            for (size_t i = 0; i < actions.size(); ++i) {
+                if (const BuildLog::Entry* entry = log.find(actions[i].outputs[0])) {
+                    duration[i] = entry->durationMs + 1.0;
+                    known += duration[i];
+                    ++knownCount;
+                }
+            }
+            const double fallback = knownCount ? known / static_cast<double>(knownCount) : 1.0;
+
+            // Reverse topological order: dependents are weighed before what they depend on
+            std::vector<size_t> order;
+            std::vector<size_t> waiting(actions.size());
+            for (size_t i = 0; i < actions.size(); ++i) {
+                waiting[i] = actions[i].waiting;
+                if (waiting[i] == 0) order.push_back(i);
+            }
+            for (size_t next = 0; next < order.size(); ++next) {
+                for (size_t dependent : actions[order[next]].dependents) {
+                    if (--waiting[dependent] == 0) order.push_back(dependent);
+                }
+            }
+            for (auto it = order.rbegin(); it != order.rend(); ++it) {
+                Action& action = actions[*it];
+                double longest = 0;
+                for (size_t dependent : action.dependents) longest = std::max(longest, actions[dependent].priority);
+                action.priority = (duration[*it] > 0 ? duration[*it] : fallback) + longest;
+            }
+        }
+
+        std::optional<int64_t> mtime(const std::string& path) {
+            // Sources and headers don't change during the build; outputs do
+            const bool produced = producers.count(path) > 0;
+            if (!produced) {
+                auto cached = sourceTimes.find(path);
+                if (cached != sourceTimes.end()) return cached->second;
+            }
+            std::error_code ec;
+            const auto time = fs::last_write_time(path, ec);
+            std::optional<int64_t> result;
+            if (!ec) result = static_cast<int64_t>(time.time_since_epoch().count());
+            if (!produced) sourceTimes.emplace(path, result);
+            return result;
+        }
+
+        bool needs_run(const Action& action) {
+            const BuildLog::Entry* entry = log.find(action.outputs[0]);
+            if (!entry || entry->command != action.commandHash) return true;
+            for (const auto& output : action.outputs) {
+                if (!mtime(output)) return true;
+            }
+            for (const auto& input : action.inputs) {
+                const auto time = mtime(input);
+                if (!time || *time > entry->started) return true;
+            }
+            for (uint32_t dep : entry->deps) {
+                const auto time = mtime(log.path(dep));
+                if (!time || *time > entry->started) return true;
+            }
+            return false;
+        }
+
+        // Reads "build <out> | <implicit outs>: dyndep | <implicit ins>" lines
+        void load_dyndep(const std::string& file) {
+            auto users = dyndepUsers.find(file);
+            if (users == dyndepUsers.end()) return;
+            std::string content;
+            if (!read_file(file, content)) return;
+
+            struct Line { std::vector<std::string> outputs, implicitOutputs, implicitInputs; };
+            std::vector<Line> lines;
+            size_t pos = 0;
+            while (pos < content.size()) {
+                size_t end = content.find('\n', pos);
+                if (end == std::string::npos) end = content.size();
+                const std::string_view text(content.data() + pos, end - pos);
+                pos = end + 1;
+                if (text.rfind("build ", 0) != 0) continue;
+
+                Line line;
+                std::vector<std::string>* list = &line.outputs;
+                std::string word;
+                auto flush = [&] {
+                    if (!word.empty()) list->push_back(word);
+                    word.clear();
+                };
+                bool afterColon = false;
+                for (size_t i = 6; i < text.size(); ++i) {
+                    const char c = text[i];
+                    if (c == '$' && i + 1 < text.size()) {
+                        word += text[++i];
+                    } else if (c == ' ') {
+                        flush();
+                    } else if (c == ':' && !afterColon) {
+                        flush();
+                        afterColon = true;
+                        list = nullptr;
+                    } else if (c == '|') {
+                        flush();
+                        list = afterColon ? &line.implicitInputs : &line.implicitOutputs;
+                    } else if (list) {
+                        word += c;
+                    }
+                }
+                if (list) flush();
+                lines.push_back(std::move(line));
+            }
+
+            // BMIs first, so importers in the same file find their producers
+            for (const auto& line : lines) {
+                if (line.outputs.empty() || !producers.count(line.outputs[0])) continue;
+                const size_t index = producers[line.outputs[0]];
+                for (const auto& output : line.implicitOutputs) {
+                    actions[index].outputs.push_back(output);
+                    producers[output] = index;
+                }
+            }
+            for (const auto& line : lines) {
+                if (line.outputs.empty() || !producers.count(line.outputs[0])) continue;
+                const size_t index = producers[line.outputs[0]];
+                for (const auto& input : line.implicitInputs) {
+                    actions[index].inputs.push_back(input);
+                    depend(index, input);
+                }
+            }
+        }
+
+        // Marks an action finished and checks the dependents that have nothing left to wait for.
+        // Clean ones finish right away. Called with the mutex held.
+        void finish(size_t index, std::vector<size_t>& next) {
+            Action& action = actions[index];
+            action.finished = true;
+            --unfinished;
+            for (const auto& output : action.outputs) load_dyndep(output);
+            for (size_t dependent : action.dependents) {
+                if (--actions[dependent].waiting == 0) next.push_back(dependent);
+            }
+        }
+
+        void settle(std::vector<size_t>& pending) {
+            while (!pending.empty()) {
+                const size_t index = pending.back();
+                pending.pop_back();
+                if (needs_run(actions[index])) {
+                    ready.emplace(actions[index].priority, index);
+                } else {
+                    --total;
+                    finish(index, pending);
+                }
+            }
+        }
+
+        void work(int worker) {
+            Tracer& tracer = Tracer::instance();
+            const int lane = tracer.lane();
+            tracer.name_lane(lane, "worker " + std::to_string(worker + 1));
+
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true) {
+                auto dispatchable = ready.end();
+                wake.wait(lock, [&] {
+                    if (failed || unfinished == 0 || (ready.empty() && running == 0)) return true;
+                    dispatchable = std::find_if(ready.begin(), ready.end(), [&](const auto& item) {
+                        const std::string& pool = actions[item.second].pool;
+                        auto depth = poolDepth.find(pool);
+                        return pool.empty() || depth == poolDepth.end() || poolUse[pool] < depth->second;
+                    });
+                    return dispatchable != ready.end();
+                });
+                if (dispatchable == ready.end()) break;
+
+                const size_t index = dispatchable->second;
+                ready.erase(dispatchable);
+                Action& action = actions[index];
+                ++running;
+                ++poolUse[action.pool];
+                lock.unlock();
+
+                const auto started = fs::file_time_type::clock::now();
+                const auto clockStart = std::chrono::steady_clock::now();
+                const int64_t traceStart = Tracer::now();
+                std::string output;
+                const bool ok = execute(action, output);
+                const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - clockStart);
+                tracer.complete(fs::path(action.outputs[0]).filename().string(), "build", traceStart, Tracer::now() - traceStart, lane,
+                                { { "output", action.outputs[0] }, { "description", action.description } });
+
+                std::vector<std::string> deps;
+                if (ok && action.gccDeps && !action.depfile.empty()) {
+                    deps = read_depfile(action.depfile);
+                    std::error_code ec;
+                    fs::remove(action.depfile, ec);
+                }
+
+                lock.lock();
+                --running;
+                --poolUse[action.pool];
+                ++done;
+                std::cerr << "[" << done << "/" << total << "] " << action.description << "\n";
+                if (!ok) {
+                    std::cerr << "FAILED: " << action.outputs[0] << "\n" << action.command << "\n";
+                }
+                std::cerr << output << std::flush;
+
+                if (ok) {
+                    BuildLog::Entry entry;
+                    entry.command = action.commandHash;
+                    entry.started = static_cast<int64_t>(started.time_since_epoch().count());
+                    entry.durationMs = static_cast<uint32_t>(elapsed.count());
+                    log.record(action.outputs[0], entry, deps);
+
+                    std::vector<size_t> next;
+                    finish(index, next);
+                    settle(next);
+                } else {
+                    failed = true;
+                }
+                wake.notify_all();
+            }
+            wake.notify_all();
+        }
+
+        // Runs the command through the shell, capturing what it prints. Console pool
+        // commands get the terminal instead.
+        static bool execute(const Action& action, std::string& output) {
+            // Like ninja, output directories are created before the command runs
+            for (const auto& file : action.outputs) {
+                std::error_code ec;
+                if (fs::path(file).has_parent_path()) fs::create_directories(fs::path(file).parent_path(), ec);
+            }
+
+            if (action.pool == "console") {
+                return std::system(action.command.c_str()) == 0;
+            }
+
+            const std::string command = "(" + action.command + ") 2>&1";
+#ifdef _WIN32
+            std::unique_ptr<FILE, decltype(&_pclose)> pipe(_popen(command.c_str(), "r"), _pclose);
+#else
+            std::unique_ptr<FILE, decltype(&pclose)> pipe(popen(command.c_str(), "r"), pclose);
+#endif
+            if (!pipe) {
+                output = "Could not start: " + action.command + "\n";
+                return false;
+            }
+            char buffer[4096];
+            size_t read = 0;
+            while ((read = fread(buffer, 1, sizeof(buffer), pipe.get())) > 0) {
+                output.append(buffer, read);
+            }
+#ifdef _WIN32
+            return _pclose(pipe.release()) == 0;
+#else
+            const int status = pclose(pipe.release());
+            return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+#endif
+        }
+    };
+}
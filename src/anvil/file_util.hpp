@@ -0,0 +1,54 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+namespace anvil {
+    namespace fs = std::filesystem;
+
+    inline bool read_file(const fs::path& path, std::string& content) {
+        std::ifstream in(path, std::ios::in | std::ios::binary);
+        if (!in) return false;
+        content.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        return true;
+    }
+
+    // Writes to a sibling temporary file and renames it into place, so readers never
+    // observe a half-written file and an interrupted write leaves the old one intact
+    inline void write_file_atomic(const fs::path& path, std::string_view content) {
+        if (path.has_parent_path()) {
+            fs::create_directories(path.parent_path());
+        }
+
+        fs::path tmpPath = path;
+        tmpPath += ".tmp";
+        {
+            std::ofstream out(tmpPath, std::ios::out | std::ios::binary | std::ios::trunc);
+            if (!out) {
+                throw std::runtime_error("Could not write " + tmpPath.string());
+            }
+            out.write(content.data(), static_cast<std::streamsize>(content.size()));
+            if (!out) {
+                throw std::runtime_error("Could not write " + tmpPath.string());
+            }
+        }
+        fs::rename(tmpPath, path);
+    }
+
+    // Leaves the file (and its mtime) untouched when it already holds these bytes.
+    // Returns true if the file was written.
+    inline bool write_file_if_changed(const fs::path& path, std::string_view content) {
+        std::error_code ec;
+        if (fs::file_size(path, ec) == content.size() && !ec) {
+            std::string existing;
+            if (read_file(path, existing) && existing == content) {
+                return false;
+            }
+        }
+        write_file_atomic(path, content);
+        return true;
+    }
+}
@@ -0,0 +1,105 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <fstream>
+#include "hash.hpp"
+#include "file_util.hpp"
+
+namespace anvil {
+    namespace fs = std::filesystem;
+
+    // Fingerprint manifest format:
+    //   key <hash of everything that isn't a file, e.g. toolchain and flags>
+    //   dep <size> <mtime> <content hash> <path>
+    // Size and mtime only short-circuit hashing; a mismatch falls back to the content hash.
+    struct FingerprintEntry {
+        uintmax_t size = 0;
+        long long mtime = 0;
+        std::string hash;
+        std::string path;
+    };
+
+    inline bool stat_file(const fs::path& path, uintmax_t& size, long long& mtime) {
+        std::error_code ec;
+        size = fs::file_size(path, ec);
+        if (ec) return false;
+        auto time = fs::last_write_time(path, ec);
+        if (ec) return false;
+        mtime = static_cast<long long>(time.time_since_epoch().count());
+        return true;
+    }
+
+    inline void save_fingerprint(const fs::path& manifestPath, const std::string& key, const std::vector<FingerprintEntry>& entries) {
+        std::string content = "key " + key + "\n";
+        for (const auto& entry : entries) {
+            content += "dep " + std::to_string(entry.size) + " " + std::to_string(entry.mtime) + " " + entry.hash + " " + entry.path + "\n";
+        }
+        write_file_atomic(manifestPath, content);
+    }
+
+    // The key a manifest was written with, or an empty string if there is none
+    inline std::string read_fingerprint_key(const fs::path& manifestPath) {
+        std::ifstream in(manifestPath);
+        std::string tag;
+        std::string key;
+        if (!(in >> tag >> key) || tag != "key") return "";
+        return key;
+    }
+
+    inline bool fingerprint_matches(const fs::path& manifestPath, const std::string& key) {
+        std::ifstream in(manifestPath);
+        if (!in) return false;
+
+        std::string tag;
+        std::string storedKey;
+        if (!(in >> tag >> storedKey) || tag != "key" || storedKey != key) {
+            return false;
+        }
+
+        std::vector<FingerprintEntry> entries;
+        bool refreshed = false;
+        FingerprintEntry entry;
+        while (in >> tag >> entry.size >> entry.mtime >> entry.hash) {
+            if (tag != "dep") return false;
+            in.get();
+            std::getline(in, entry.path);
+
+            uintmax_t size = 0;
+            long long mtime = 0;
+            if (!stat_file(entry.path, size, mtime)) {
+                return false;
+            }
+            if (size != entry.size || mtime != entry.mtime) {
+                if (hash_file(entry.path) != entry.hash) {
+                    return false;
+                }
+                entry.size = size;
+                entry.mtime = mtime;
+                refreshed = true;
+            }
+            entries.push_back(entry);
+        }
+
+        if (entries.empty()) return false;
+
+        // Contents matched but timestamps moved: remember the new stats so the next check is cheap
+        if (refreshed) {
+            in.close();
+            save_fingerprint(manifestPath, key, entries);
+        }
+        return true;
+    }
+
+    inline void write_fingerprint(const fs::path& manifestPath, const std::string& key, const std::vector<std::string>& inputs) {
+        std::vector<FingerprintEntry> entries;
+        for (const auto& input : inputs) {
+            FingerprintEntry entry;
+            entry.path = fs::absolute(input).string();
+            if (!stat_file(entry.path, entry.size, entry.mtime)) continue;
+            entry.hash = hash_file(entry.path);
+            entries.push_back(entry);
+        }
+        save_fingerprint(manifestPath, key, entries);
+    }
+}
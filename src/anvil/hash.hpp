@@ -0,0 +1,184 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <filesystem>
+#include <fstream>
+
+namespace anvil {
+    namespace fs = std::filesystem;
+
+    // 64-bit FNV-1a. Not cryptographic, only used to key caches and fingerprints that belong
+    // to one project; collisions are easy to construct, so stores shared between projects
+    // key by Sha256.
+    class Hasher {
+        uint64_t state = 0xcbf29ce484222325ULL;
+
+    public:
+        Hasher& update(std::string_view data) {
+            for (unsigned char c : data) {
+                state ^= c;
+                state *= 0x100000001b3ULL;
+            }
+            return *this;
+        }
+
+        // Hashes a value followed by a separator so that ("ab", "c") and ("a", "bc") differ
+        Hasher& field(std::string_view data) {
+            update(data);
+            return update(std::string_view("\0", 1));
+        }
+
+        bool update_file(const fs::path& path) {
+            std::ifstream in(path, std::ios::binary);
+            if (!in) return false;
+            char buffer[64 * 1024];
+            while (in.read(buffer, sizeof(buffer)) || in.gcount() > 0) {
+                update(std::string_view(buffer, static_cast<size_t>(in.gcount())));
+            }
+            return true;
+        }
+
+        [[nodiscard]] uint64_t digest() const {
+            return state;
+        }
+
+        [[nodiscard]] std::string hex() const {
+            return to_hex(state);
+        }
+
+        static std::string to_hex(uint64_t value) {
+            static const char digits[] = "0123456789abcdef";
+            std::string out(16, '0');
+            for (int i = 15; i >= 0; --i) {
+                out[i] = digits[value & 0xf];
+                value >>= 4;
+            }
+            return out;
+        }
+    };
+
+    // SHA-256 (FIPS 180-4), for content-addressed data where a collision would silently hand
+    // back the wrong thing, such as the compile cache every project on the machine shares.
+    class Sha256 {
+        std::array<uint32_t, 8> state = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+        unsigned char block[64] = {};
+        size_t blockSize = 0;
+        uint64_t length = 0;
+
+        static uint32_t rotr(uint32_t x, int n) {
+            return (x >> n) | (x << (32 - n));
+        }
+
+        void compress(const unsigned char* data) {
+            static constexpr uint32_t k[64] = {
+                0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+                0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+                0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+                0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+                0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+                0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+                0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+                0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+            };
+            uint32_t w[64];
+            for (int i = 0; i < 16; ++i) {
+                w[i] = (uint32_t(data[4 * i]) << 24) | (uint32_t(data[4 * i + 1]) << 16) | (uint32_t(data[4 * i + 2]) << 8) | uint32_t(data[4 * i + 3]);
+            }
+            for (int i = 16; i < 64; ++i) {
+                const uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+                const uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+                w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+            }
+
+            uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+            for (int i = 0; i < 64; ++i) {
+                const uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+                const uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+                h = g;
+                g = f;
+                f = e;
+                e = d + t1;
+                d = c;
+                c = b;
+                b = a;
+                a = t1 + t2;
+            }
+            state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+            state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+        }
+
+    public:
+        // Length of hex()
+        static constexpr size_t hex_size = 64;
+
+        Sha256& update(std::string_view data) {
+            length += data.size();
+            const auto* bytes = reinterpret_cast<const unsigned char*>(data.data());
+            size_t size = data.size();
+            if (blockSize > 0) {
+                const size_t take = std::min(size, sizeof(block) - blockSize);
+                std::memcpy(block + blockSize, bytes, take);
+                blockSize += take;
+                bytes += take;
+                size -= take;
+                if (blockSize < sizeof(block)) return *this;
+                compress(block);
+                blockSize = 0;
+            }
+            for (; size >= sizeof(block); bytes += sizeof(block), size -= sizeof(block)) {
+                compress(bytes);
+            }
+            std::memcpy(block, bytes, size);
+            blockSize = size;
+            return *this;
+        }
+
+        // Hashes a value followed by a separator so that ("ab", "c") and ("a", "bc") differ
+        Sha256& field(std::string_view data) {
+            update(data);
+            return update(std::string_view("\0", 1));
+        }
+
+        bool update_file(const fs::path& path) {
+            std::ifstream in(path, std::ios::binary);
+            if (!in) return false;
+            char buffer[64 * 1024];
+            while (in.read(buffer, sizeof(buffer)) || in.gcount() > 0) {
+                update(std::string_view(buffer, static_cast<size_t>(in.gcount())));
+            }
+            return true;
+        }
+
+        [[nodiscard]] std::string hex() const {
+            Sha256 final = *this;
+            const uint64_t bits = length * 8;
+            final.update(std::string_view("\x80", 1));
+            static const char zeros[64] = {};
+            final.update(std::string_view(zeros, (final.blockSize <= 56 ? 56 : 120) - final.blockSize));
+            char encoded[8];
+            for (int i = 0; i < 8; ++i) encoded[i] = static_cast<char>(bits >> (56 - 8 * i));
+            final.update(std::string_view(encoded, 8));
+
+            std::string out;
+            for (uint32_t word : final.state) {
+                out += Hasher::to_hex(word).substr(8);
+            }
+            return out;
+        }
+    };
+
+    inline std::string hash_string(std::string_view data) {
+        return Hasher().update(data).hex();
+    }
+
+    // Returns an empty string if the file cannot be read
+    inline std::string hash_file(const fs::path& path) {
+        Hasher hasher;
+        if (!hasher.update_file(path)) return "";
+        return hasher.hex();
+    }
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <filesystem>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+#include "file_util.hpp"
+
+namespace anvil {
+    namespace fs = std::filesystem;
+
+    // The compile time traces under a build directory: "<name>.json" next to "<name>.o",
+    // which keeps out the other JSON files anvil writes there
+    inline std::vector<fs::path> find_time_traces(const fs::path& buildDir) {
+        std::vector<fs::path> traces;
+        std::error_code ec;
+        for (auto it = fs::recursive_directory_iterator(buildDir, ec); !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+            const fs::path& path = it->path();
+            if (path.extension() != ".json") continue;
+            fs::path object = path;
+            object.replace_extension(".o");
+            if (fs::exists(object)) traces.push_back(path);
+        }
+        std::sort(traces.begin(), traces.end());
+        return traces;
+    }
+
+    // Adds up clang's -ftime-trace output over all translation units: the time spent
+    // parsing each header ("Source" events, including the headers it includes in turn) and
+    // instantiating each template ("InstantiateClass"/"InstantiateFunction", grouped by the
+    // name before its template arguments). A header's total is its average cost times the
+    // number of translation units including it, which is what a PCH, a forward declaration
+    // or a module would save.
+    inline nlohmann::json aggregate_time_traces(const std::vector<fs::path>& traces, size_t top) {
+        struct Cost {
+            int64_t total = 0;  // microseconds
+            int64_t count = 0;  // includers, or instantiations
+        };
+        std::map<std::string, Cost> headers;
+        std::map<std::string, Cost> templates;
+        int64_t frontend = 0;
+        size_t units = 0;
+
+        for (const auto& path : traces) {
+            std::string content;
+            if (!read_file(path, content)) continue;
+            const nlohmann::json trace = nlohmann::json::parse(content, nullptr, false);
+            if (trace.is_discarded() || !trace.contains("traceEvents")) continue;
+            ++units;
+
+            std::map<std::string, int64_t> included;  // this unit's headers
+            for (const auto& event : trace["traceEvents"]) {
+                if (event.value("ph", "") != "X") continue;
+                const std::string name = event.value("name", "");
+                const int64_t duration = event.value("dur", int64_t(0));
+                if (name == "Total Frontend") {
+                    frontend += duration;
+                    continue;
+                }
+                if (!event.contains("args") || !event["args"].contains("detail")) continue;
+                const std::string detail = event["args"]["detail"].get<std::string>();
+                if (name == "Source") {
+                    included[fs::path(detail).lexically_normal().generic_string()] += duration;
+                } else if (name == "InstantiateClass" || name == "InstantiateFunction") {
+                    Cost& cost = templates[detail.substr(0, detail.find('<'))];
+                    cost.total += duration;
+                    ++cost.count;
+                }
+            }
+            for (const auto& [header, duration] : included) {
+                Cost& cost = headers[header];
+                cost.total += duration;
+                ++cost.count;
+            }
+        }
+
+        auto ranked = [top](const std::map<std::string, Cost>& costs, const char* countName) {
+            std::vector<std::pair<std::string, Cost>> sorted(costs.begin(), costs.end());
+            std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) { return a.second.total > b.second.total; });
+            if (sorted.size() > top) sorted.resize(top);
+            nlohmann::json list = nlohmann::json::array();
+            for (const auto& [name, cost] : sorted) {
+                list.push_back({ { "name", name }, { "totalMs", cost.total / 1000 }, { countName, cost.count },
+                                 { "averageMs", cost.total / cost.count / 1000.0 } });
+            }
+            return list;
+        };
+
+        return {
+            { "translationUnits", units },
+            { "frontendMs", frontend / 1000 },
+            { "headers", ranked(headers, "includers") },
+            { "templates", ranked(templates, "instantiations") },
+        };
+    }
+}
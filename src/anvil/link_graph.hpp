@@ -0,0 +1,122 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <stdexcept>
+#include <functional>
+#include "api.hpp"
+
+namespace anvil {
+    // How targets reach each other through link(). NinjaWriter builds from it, and the BSP
+    // server answers with it, so an IDE sees the include dirs and defines the build uses.
+    using TargetIndex = std::map<std::string, const CppApplication*>;
+
+    inline TargetIndex index_targets(const std::vector<CppApplication>& targets) {
+        TargetIndex index;
+        for (const auto& app : targets) {
+            index[app.name] = &app;
+        }
+        return index;
+    }
+
+    inline const CppApplication& linked_library(const TargetIndex& index, const CppApplication& from, const std::string& name) {
+        auto it = index.find(name);
+        if (it == index.end() || !is_library(it->second->type)) {
+            throw std::runtime_error("Target '" + from.name + "' links '" + name + "', which is not a library of this project");
+        }
+        return *it->second;
+    }
+
+    // Every library reachable through app.links, in discovery order. Their public include
+    // dirs and defines apply to app's sources.
+    inline std::vector<const CppApplication*> usage_closure(const TargetIndex& index, const CppApplication& app) {
+        std::vector<const CppApplication*> found;
+        std::set<std::string> visited;
+        std::vector<std::string> path = { app.name };
+        std::function<void(const CppApplication&)> visit = [&](const CppApplication& from) {
+            for (const auto& name : from.links) {
+                if (std::find(path.begin(), path.end(), name) != path.end()) {
+                    throw std::runtime_error("Circular link dependency: " + from.name + " links " + name);
+                }
+                const CppApplication& lib = linked_library(index, from, name);
+                if (!visited.insert(name).second) continue;
+                found.push_back(&lib);
+                path.push_back(name);
+                visit(lib);
+                path.pop_back();
+            }
+        };
+        visit(app);
+        return found;
+    }
+
+    // The libraries app's link step needs, each before the libraries it depends on so the
+    // linker resolves static archives in one pass. A shared library already contains the
+    // static libraries it links; only the shared libraries below it are linked again.
+    inline std::vector<const CppApplication*> link_closure(const TargetIndex& index, const CppApplication& app) {
+        std::vector<const CppApplication*> postorder;
+        std::set<std::string> visited;
+        std::function<void(const CppApplication&, bool)> visit = [&](const CppApplication& from, bool insideShared) {
+            // Walked backwards so that unrelated libraries keep the order they were linked in
+            for (auto it = from.links.rbegin(); it != from.links.rend(); ++it) {
+                const std::string& name = *it;
+                const CppApplication& lib = linked_library(index, from, name);
+                if (insideShared && lib.type == AppType::StaticLibrary) {
+                    visit(lib, true);
+                    continue;
+                }
+                if (!visited.insert(name).second) continue;
+                visit(lib, insideShared || lib.type == AppType::SharedLibrary);
+                postorder.push_back(&lib);
+            }
+        };
+        visit(app, false);
+        return { postorder.rbegin(), postorder.rend() };
+    }
+
+    // Shared libraries and the static libraries linked into them, which end up in
+    // position-independent code
+    inline std::set<std::string> position_independent_targets(const TargetIndex& index, const std::vector<CppApplication>& targets) {
+        std::set<std::string> pic;
+        for (const auto& app : targets) {
+            if (app.type != AppType::SharedLibrary) continue;
+            pic.insert(app.name);
+            for (const CppApplication* lib : usage_closure(index, app)) {
+                if (lib->type == AppType::StaticLibrary) pic.insert(lib->name);
+            }
+        }
+        return pic;
+    }
+
+    // What app's sources are compiled with: its own include dirs and defines, its public
+    // ones, and the public ones of every library in its usage closure. Include dirs keep
+    // their first position; dependency resolution may add the same directory more than once.
+    struct UsageRequirements {
+        std::vector<std::string> include_dirs;
+        std::vector<std::string> defines;
+    };
+
+    inline UsageRequirements usage_requirements(const CppApplication& app, const std::vector<const CppApplication*>& used) {
+        UsageRequirements result;
+        std::set<std::string> seen;
+        auto add = [&](const CppApplication& from, bool own) {
+            if (own) {
+                for (const auto& inc : from.include_dirs) {
+                    if (seen.insert(inc).second) result.include_dirs.push_back(inc);
+                }
+                result.defines.insert(result.defines.end(), from.defines.begin(), from.defines.end());
+            }
+            for (const auto& inc : from.public_include_dirs) {
+                if (seen.insert(inc).second) result.include_dirs.push_back(inc);
+            }
+            result.defines.insert(result.defines.end(), from.public_defines.begin(), from.public_defines.end());
+        };
+        add(app, true);
+        for (const CppApplication* lib : used) {
+            add(*lib, false);
+        }
+        return result;
+    }
+}
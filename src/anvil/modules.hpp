@@ -0,0 +1,140 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <stdexcept>
+#include <filesystem>
+#include <nlohmann/json.hpp>
+#include "file_util.hpp"
+
+namespace anvil {
+    namespace fs = std::filesystem;
+
+    // What the scan of one translation unit (P1689 format) says about it
+    struct ModuleScan {
+        std::string object;
+        std::string provides;
+        std::vector<std::string> imports;
+    };
+
+    inline ModuleScan read_module_scan(const fs::path& path) {
+        std::string content;
+        if (!read_file(path, content)) {
+            throw std::runtime_error("Could not read module scan " + path.string());
+        }
+
+        ModuleScan scan;
+        try {
+            const nlohmann::json ddi = nlohmann::json::parse(content);
+            const nlohmann::json& rule = ddi.at("rules").at(0);
+            scan.object = rule.at("primary-output").get<std::string>();
+            for (const auto& provided : rule.value("provides", nlohmann::json::array())) {
+                scan.provides = provided.at("logical-name").get<std::string>();
+            }
+            for (const auto& required : rule.value("requires", nlohmann::json::array())) {
+                scan.imports.push_back(required.at("logical-name").get<std::string>());
+            }
+        } catch (const nlohmann::json::exception& e) {
+            throw std::runtime_error("Malformed module scan " + path.string() + ": " + e.what());
+        }
+        return scan;
+    }
+
+    inline std::string ninja_escape(const std::string& path) {
+        std::string escaped;
+        for (char c : path) {
+            if (c == '$' || c == ' ' || c == ':') escaped += '$';
+            escaped += c;
+        }
+        return escaped;
+    }
+
+    struct ModuleCollation {
+        std::string format;          // "gcc" or "clang": how the module map is written
+        std::string bmiExtension;
+        fs::path dyndep;
+        fs::path modmap;
+        fs::path exports;
+        std::vector<fs::path> scans;
+        std::vector<fs::path> deps;  // exports of the libraries the target links
+    };
+
+    // Turns a target's module scans into what ninja and the compiler need once the imports
+    // are known: a dyndep file that orders each object after the BMIs it imports and
+    // declares the BMI it produces, the compiler's module map, and the target's exported
+    // modules for the targets linking it. Each file is only rewritten when it changes, so
+    // a source edit that doesn't touch imports rebuilds nothing else.
+    inline void collate_modules(const ModuleCollation& collation) {
+        // Module name -> BMI, from the linked libraries and then this target
+        std::map<std::string, std::string> modules;
+        for (const auto& dep : collation.deps) {
+            std::string content;
+            if (!read_file(dep, content)) {
+                throw std::runtime_error("Could not read module exports " + dep.string());
+            }
+            const nlohmann::json exported = nlohmann::json::parse(content);
+            for (const auto& [name, bmi] : exported.items()) {
+                modules[name] = bmi.get<std::string>();
+            }
+        }
+
+        std::vector<ModuleScan> scans;
+        std::map<std::string, std::string> provided;
+        for (const auto& path : collation.scans) {
+            ModuleScan scan = read_module_scan(path);
+            if (!scan.provides.empty()) {
+                // "name.o" -> "name.gcm", next to the object
+                std::string bmi = scan.object;
+                if (bmi.size() > 2 && bmi.compare(bmi.size() - 2, 2, ".o") == 0) bmi.resize(bmi.size() - 2);
+                bmi += collation.bmiExtension;
+
+                auto [existing, inserted] = provided.emplace(scan.provides, bmi);
+                if (!inserted) {
+                    throw std::runtime_error("Module '" + scan.provides + "' is provided by both " + existing->second + " and " + bmi);
+                }
+                modules[scan.provides] = bmi;
+            }
+            scans.push_back(std::move(scan));
+        }
+
+        std::string dyndep = "ninja_dyndep_version = 1\n\n";
+        for (const auto& scan : scans) {
+            dyndep += "build " + ninja_escape(scan.object);
+            if (!scan.provides.empty()) dyndep += " | " + ninja_escape(modules[scan.provides]);
+            dyndep += ": dyndep";
+            bool first = true;
+            for (const auto& name : scan.imports) {
+                auto it = modules.find(name);
+                if (it == modules.end()) {
+                    throw std::runtime_error("Module '" + name + "' imported by " + scan.object +
+                                             " is not provided by its target or any library it links");
+                }
+                if (name == scan.provides) {
+                    throw std::runtime_error("Module '" + name + "' imports itself in " + scan.object);
+                }
+                dyndep += (first ? " | " : " ") + ninja_escape(it->second);
+                first = false;
+            }
+            dyndep += "\n\n";
+        }
+
+        std::string modmap;
+        if (collation.format == "gcc") modmap += "$root .\n";
+        for (const auto& [name, bmi] : modules) {
+            if (collation.format == "clang") {
+                modmap += "-fmodule-file=" + name + "=" + bmi + "\n";
+            } else {
+                modmap += name + " " + bmi + "\n";
+            }
+        }
+
+        nlohmann::json exports = nlohmann::json::object();
+        for (const auto& [name, bmi] : provided) {
+            exports[name] = bmi;
+        }
+
+        write_file_if_changed(collation.modmap, modmap);
+        write_file_if_changed(collation.exports, exports.dump(2) + "\n");
+        write_file_if_changed(collation.dyndep, dyndep);
+    }
+}
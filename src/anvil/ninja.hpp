@@ -1,93 +1,672 @@
 #pragma once
-#include <fstream>
+#include <sstream>
+#include <set>
+#include <map>
 #include <vector>
 #include <string>
 #include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+#include <functional>
+#include <filesystem>
 #include "api.hpp"
+#include "toolchain.hpp"
+#include "file_util.hpp"
+#include "hash.hpp"
+#include "unity.hpp"
+#include "modules.hpp"
+#include "build_graph.hpp"
+#include "link_graph.hpp"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 
 namespace anvil {
 
+    // Total physical memory in bytes, or 0 if it can't be determined
+    inline unsigned long long physical_memory() {
+#if defined(_SC_PHYS_PAGES) && defined(_SC_PAGE_SIZE)
+        const long pages = sysconf(_SC_PHYS_PAGES);
+        const long pageSize = sysconf(_SC_PAGE_SIZE);
+        if (pages > 0 && pageSize > 0) {
+            return static_cast<unsigned long long>(pages) * static_cast<unsigned long long>(pageSize);
+        }
+#endif
+        return 0;
+    }
+
+    // Concurrent links allowed by default: one per 2 GiB of physical memory, and never
+    // more than there are cores. Large static links are what run a machine out of memory.
+    inline int default_link_pool_depth() {
+        const unsigned long long cores = std::max(1u, std::thread::hardware_concurrency());
+        const unsigned long long memory = physical_memory();
+        if (memory == 0) {
+            return static_cast<int>(std::max(1ULL, cores / 2));
+        }
+        const unsigned long long byMemory = memory / (2ULL << 30);
+        return static_cast<int>(std::clamp(byMemory, 1ULL, cores));
+    }
+
+    // Renders build.ninja in memory and only replaces the file when its bytes change, so
+    // ninja doesn't re-parse (or restat) an identical manifest.
+    //
+    // build.ninja holds the rules and pulls in one file per target with `subninja`. A
+    // target's flags, includes and link flags are set once at the top of its file and the
+    // edges inherit them from that scope, so the manifest grows with the number of sources
+    // rather than sources times flag length. Runs of flags, include dirs or link flags that
+    // several targets share (e.g. the dependency include dirs every target gets) are
+    // interned as a single variable in build.ninja, which each target's value refers to.
+    //
+    // A source that several targets compile with the same toolchain, profile, flags and
+    // includes is compiled once, by the first of them; the others link its object.
+    //
+    // Targets using C++20 modules get their sources scanned (P1689) and the scans collated
+    // by `anvil modules collate` into a dyndep file, which tells ninja which BMIs each object
+    // produces and imports, across targets too.
+    //
+    // Everything written is also kept as a BuildGraph for the native executor.
     class NinjaWriter {
-        std::ofstream out;
+        std::string path;
+        std::ostringstream out;
+        BuildGraph graph;
+        std::string generatorCommand;
+        std::vector<std::string> generatorInputs;
+        std::string compileLauncher;
+        bool timeTrace = false;
+        std::string moduleCollator;
+
+        // A target's rendered file and the scope variables it refers to
+        struct TargetScope {
+            std::string file;
+            std::string binary;
+            std::string rule;
+            std::string compilePool;
+            std::string linkPool;
+            std::string pchSource;
+            std::string pchWrapper;
+            std::string pch;
+            bool archive = false;
+            bool modules = false;
+            std::vector<std::string> libraries;
+            std::vector<std::string> moduleDeps;
+            std::vector<std::pair<std::string, std::string>> variables;
+            // The items FLAGS, INCLUDES and LINK_FLAGS are made of, each with its leading space
+            std::map<std::string, std::vector<std::string>> lists;
+            std::vector<std::string> objects;  // linked
+
+            struct Compile {
+                std::string object;
+                std::string source;
+                std::string moduleFlags;  // module interface units only
+            };
+            std::vector<Compile> compiles;
+        };
+
+        static constexpr const char* profile_stamp = ".anvil_build/profile";
     public:
-        explicit NinjaWriter(const std::string& path) : out(path) {
-            out << "ninja_required_version = 1.3\n";
-            out << "builddir = .anvil_build\n\n";
+        explicit NinjaWriter(std::string outputPath) : path(std::move(outputPath)) {}
+
+        // Lets a plain `ninja` rebuild the manifest itself when one of the inputs changes
+        void set_generator(const std::string& command, const std::vector<std::string>& inputs) {
+            generatorCommand = command;
+            generatorInputs = inputs;
+        }
+
+        // Command prepended to every compile (not PCH or link), e.g. the compile cache
+        void set_compile_launcher(const std::string& launcher) {
+            compileLauncher = launcher;
         }
 
-        void generate(const Project& project) {
+        // Compiles write a time trace next to each object, for --analyze-includes
+        void set_time_trace(bool enabled) {
+            timeTrace = enabled;
+        }
+
+        // Command that collates module scans, i.e. "<anvil> modules collate"
+        void set_module_collator(const std::string& command) {
+            moduleCollator = command;
+        }
+
+        // The graph of the last generate()
+        [[nodiscard]] const BuildGraph& build_graph() const {
+            return graph;
+        }
+
+        // Returns true if build.ninja was rewritten
+        bool generate(const Project& project) {
+            // One build directory per profile, so switching profiles keeps the other's objects
+            const std::string builddir = ".anvil_build/" + profile_name(project.profile);
+            graph = {};
+            out << "builddir = " << builddir << "\n\n";
+            graph.globals.emplace_back("builddir", builddir);
+            generatePools(project);
+
             // Handle legacy single-application projects
+            std::vector<CppApplication> legacyTargets;
+            const std::vector<CppApplication>* targets = &project.targets;
             if (project.targets.empty() && !project.application.name.empty()) {
                 // If targets is empty but application is set (legacy mode), wrap it
-                std::vector<CppApplication> legacyTargets = { project.application };
-                generateTargets(legacyTargets);
-            } else {
-                generateTargets(project.targets);
+                legacyTargets.push_back(project.application);
+                targets = &legacyTargets;
+            }
+
+            std::ostringstream rules;
+            std::vector<TargetScope> scopes = buildScopes(project, *targets, builddir, rules);
+
+            if (!generatorCommand.empty()) {
+                generateRegenerateRule(scopes);
             }
+            out << rules.str();
+            generateScopes(scopes);
+
+            // bin/ is shared by all profiles, so binaries depend on which profile was built last
+            write_file_if_changed(profile_stamp, profile_name(project.profile) + "\n");
+
+            return write_file_if_changed(path, "ninja_required_version = " + required_ninja_version(scopes) + "\n" + out.str());
         }
 
     private:
-        void generateTargets(const std::vector<CppApplication>& targets) {
-            if (targets.empty()) return;
+        // What the manifest uses decides the version, so an older ninja stops with a version
+        // message instead of a parse error: dyndep needs 1.10 and the console pool 1.5
+        static std::string required_ninja_version(const std::vector<TargetScope>& scopes) {
+            bool console = false;
+            for (const auto& scope : scopes) {
+                if (scope.modules) return "1.10";
+                console = console || scope.compilePool == "console" || scope.linkPool == "console";
+            }
+            return console ? "1.5" : "1.3";
+        }
+
+        void generateRegenerateRule(const std::vector<TargetScope>& scopes) {
+            // restat: an unchanged manifest isn't rewritten, which must not look out of date
+            addRule(out, "regenerate", {
+                { "command", generatorCommand },
+                { "description", "Regenerating " + path },
+                { "generator", "1" },
+                { "restat", "1" },
+            });
+
+            out << "build " << path;
+            if (!scopes.empty()) {
+                out << " |";
+                for (const auto& scope : scopes) out << " " << scope.file;
+            }
+            out << ": regenerate";
+            for (const auto& input : generatorInputs) out << " " << input;
+            out << "\n\n";
+        }
+
+        void generatePools(const Project& project) {
+            std::map<std::string, int> pools = project.pools;
+            pools.emplace("link", default_link_pool_depth());
+            for (const auto& [poolName, depth] : pools) {
+                out << "pool " << poolName << "\n";
+                out << "  depth = " << std::max(1, depth) << "\n\n";
+                graph.pools[poolName] = std::max(1, depth);
+            }
+        }
+
+        void addRule(std::ostream& rules, const std::string& name, Bindings bindings) {
+            rules << "rule " << name << "\n";
+            for (const auto& [key, value] : bindings) {
+                rules << "  " << key << " = " << value << "\n";
+            }
+            rules << "\n";
+            graph.rules[name].bindings = std::move(bindings);
+        }
 
-            // Use the first target to determine the compiler for the rules
-            const auto& firstApp = targets[0];
-            std::string compiler = "clang++";
-            if (firstApp.compilerId == CompilerId::GCC) {
-                compiler = "g++";
+        // Writes an edge to a target's file and adds it to the graph
+        void addEdge(std::ostream& target, BuildEdge edge, int scope) {
+            auto paths = [&](const std::vector<std::string>& list, const char* separator) {
+                if (list.empty()) return;
+                if (separator) target << " " << separator;
+                for (const auto& p : list) target << " " << p;
+            };
+            target << "build";
+            paths(edge.outputs, nullptr);
+            paths(edge.implicitOutputs, "|");
+            target << ": " << edge.rule;
+            paths(edge.inputs, nullptr);
+            paths(edge.implicitInputs, "|");
+            paths(edge.orderOnly, "||");
+            target << "\n";
+            for (const auto& [key, value] : edge.bindings) {
+                target << "  " << key << " = " << value << "\n";
             }
+            edge.scope = scope;
+            graph.edges.push_back(std::move(edge));
+        }
 
-            std::cout << "[Anvil] Configured Toolchain: " << compiler << std::endl;
+        static void check_pool(const Project& project, const CppApplication& app, const std::string& poolName) {
+            if (poolName.empty() || poolName == "link" || poolName == "console" || project.pools.count(poolName)) {
+                return;
+            }
+            throw std::runtime_error("Target '" + app.name + "' uses pool '" + poolName + "', which is not declared with add_pool()");
+        }
 
-            out << "rule cxx\n";
-            out << "  command = " << compiler << " $FLAGS $INCLUDES -c $in -o $out\n";
-            out << "  description = CXX $out\n\n";
+        static std::string standard_flag(CppStandard standard) {
+            switch (standard) {
+                case CppStandard::CPP_11: return "-std=c++11";
+                case CppStandard::CPP_14: return "-std=c++14";
+                case CppStandard::CPP_17: return "-std=c++17";
+                case CppStandard::CPP_23: return "-std=c++23";
+                case CppStandard::CPP_20: break;
+            }
+            return "-std=c++20";
+        }
 
-            out << "rule link\n";
-            out << "  command = " << compiler << " $FLAGS $in -o $out $LINK_FLAGS\n";
-            out << "  description = LINK $out\n\n";
+        // One set of compile, PCH and link rules per toolchain and profile, e.g. cxx_gcc_release.
+        // The profile's flags live in the rule, so edges only carry what differs per target.
+        // linkerFlag selects a fast linker, if one was found.
+        void generateRules(std::ostream& rules, const Toolchain& toolchain, Optimization level, const std::string& suffix,
+                           const std::string& linkerFlag) {
+            const bool splitDebug = !linkerFlag.empty() && level == Optimization::Debug;
+            std::vector<std::string> compileFlags = { "-MD", "-MF", "$out.d" };
+            for (const auto& flag : toolchain.getOptimizationFlags(level)) compileFlags.push_back(flag);
+            compileFlags.push_back("$FLAGS");
+            compileFlags.push_back("$INCLUDES");
 
-            std::vector<std::string> all_binaries;
+            // Same flags as the objects it is used by, otherwise the compiler rejects the PCH
+            addRule(rules, "pch_" + suffix, {
+                { "command", toolchain.getPchCommand("$in", "$out", compileFlags) },
+                { "description", "PCH $out" },
+                { "depfile", "$out.d" },
+                { "deps", "gcc" },
+            });
+
+            // Not in the PCH rule: a header compiled with split DWARF would leave a .dwo behind
+            if (splitDebug) {
+                for (const auto& flag : toolchain.getSplitDebugFlags()) compileFlags.push_back(flag);
+            }
+            if (timeTrace) {
+                for (const auto& flag : toolchain.getTimeTraceFlags()) compileFlags.push_back(flag);
+            }
+            compileFlags.push_back("$PCH_FLAGS");
+            compileFlags.push_back("$MODULE_MAP");
+            compileFlags.push_back("$MODULE_FLAGS");
+
+            addRule(rules, "cxx_" + suffix, {
+                { "command", (compileLauncher.empty() ? "" : compileLauncher + " ") + toolchain.getObjectCommand("$in", "$out", compileFlags) },
+                { "description", "CXX $out" },
+                { "depfile", "$out.d" },
+                { "deps", "gcc" },
+            });
+
+            std::vector<std::string> linkFlags = toolchain.getOptimizationLinkFlags(level);
+            if (!linkerFlag.empty()) linkFlags.push_back(linkerFlag);
+            if (splitDebug) {
+                for (const auto& flag : toolchain.getGdbIndexLinkFlags()) linkFlags.push_back(flag);
+            }
+            linkFlags.push_back("$LINK_FLAGS");
+
+            addRule(rules, "link_" + suffix, {
+                { "command", toolchain.getLinkCommand({ "$in" }, "$out", linkFlags) },
+                { "description", "LINK $out" },
+                { "pool", "link" },
+            });
+
+            addRule(rules, "ar_" + suffix, {
+                { "command", toolchain.getArchiveCommand({ "$in" }, "$out") },
+                { "description", "AR $out" },
+            });
+        }
+
+        // Scan and collate rules, only written once a target of this toolchain and profile uses modules
+        void generateModuleRules(std::ostream& rules, const Toolchain& toolchain, Optimization level, const std::string& suffix) {
+            std::vector<std::string> scanFlags = toolchain.getOptimizationFlags(level);
+            scanFlags.push_back("$FLAGS");
+            scanFlags.push_back("$INCLUDES");
+
+            addRule(rules, "scan_" + suffix, {
+                { "command", toolchain.getModuleScanCommand(scanFlags) },
+                { "description", "SCAN $in" },
+                { "depfile", "$out.d" },
+                { "deps", "gcc" },
+            });
+
+            // restat: outputs are only rewritten when they change, so unchanged imports rebuild nothing
+            addRule(rules, "collate_" + suffix, {
+                { "command", moduleCollator + " --format=" + toolchain.getName() + " --bmi-ext=" + toolchain.getBmiExtension() +
+                             " --dyndep=$out --modmap=$objdir/modules.modmap --exports=$objdir/modules.json $MODULE_DEPS $in" },
+                { "description", "COLLATE $out" },
+                { "restat", "1" },
+            });
+        }
+
+        static bool uses_modules(const CppApplication& app, const std::vector<const CppApplication*>& used) {
+            if (!app.module_sources.empty() || app.import_std) return true;
+            return std::any_of(used.begin(), used.end(), [](const CppApplication* lib) { return !lib->module_sources.empty(); });
+        }
+
+        static std::string library_file_name(const CppApplication& lib) {
+            if (lib.type == AppType::StaticLibrary) return "lib" + lib.name + ".a";
+#ifdef __APPLE__
+            return "lib" + lib.name + ".dylib";
+#elif defined(_WIN32)
+            return lib.name + ".dll";
+#else
+            return "lib" + lib.name + ".so";
+#endif
+        }
+
+        // Archives stay in the profile's build directory. Shared libraries go to bin/ next to
+        // the executables, which find them through their runtime path.
+        static std::string output_file(const CppApplication& app, const std::string& builddir) {
+            if (app.type == AppType::StaticLibrary) return builddir + "/" + app.name + "/" + library_file_name(app);
+            if (app.type == AppType::SharedLibrary) return "bin/" + library_file_name(app);
+#ifdef _WIN32
+            return "bin/" + app.name + ".exe";
+#else
+            return "bin/" + app.name;
+#endif
+        }
+
+        std::vector<TargetScope> buildScopes(const Project& project, const std::vector<CppApplication>& targets,
+                                             const std::string& builddir, std::ostream& rules) {
+            std::vector<TargetScope> scopes;
+            std::map<std::string, std::string> linkerFlags;  // by toolchain
+            std::set<std::string> emittedRules;
+            std::set<std::string> emittedModuleRules;
+
+            // Compile action key -> the object the first target compiling it writes
+            std::map<std::string, std::string> compiledObjects;
+
+            const TargetIndex index = index_targets(targets);
+            const std::set<std::string> pic = position_independent_targets(index, targets);
 
             for (const auto& app : targets) {
-                std::vector<std::string> object_files;
+                const std::vector<const CppApplication*> used = usage_closure(index, app);
+                check_pool(project, app, app.compile_pool);
+                check_pool(project, app, app.link_pool);
 
-                std::string flags = "-MD -MF $out.d";
-                if (app.standard == CppStandard::CPP_20) flags += " -std=c++20";
-                if (app.standard == CppStandard::CPP_17) flags += " -std=c++17";
+                const Optimization level = app.optimization.value_or(project.profile);
+                const auto toolchain = make_toolchain(app.compilerId);
+                const std::string suffix = toolchain->getName() + "_" + profile_name(level);
 
-                std::string includes;
-                for (const auto& inc : app.include_dirs) includes += " -I" + inc;
+                if (!linkerFlags.count(toolchain->getName())) {
+                    std::cerr << "[Anvil] Configured Toolchain: " << toolchain->getCompiler() << std::endl;
+                    // Chosen at configure time; a linker uninstalled since then falls back to the default
+                    std::string linkerFlag;
+                    auto linker = project.fast_linkers.find(toolchain->getName());
+                    if (project.fast_link && linker != project.fast_linkers.end() &&
+                        !find_program("ld." + linker->second.flag.substr(linker->second.flag.find('=') + 1)).empty()) {
+                        linkerFlag = linker->second.flag;
+                    }
+                    if (timeTrace && toolchain->getTimeTraceFlags().empty()) {
+                        std::cerr << "[Anvil] " << toolchain->getCompiler() << " can't write time traces; --analyze-includes needs Clang" << std::endl;
+                    }
+                    linkerFlags[toolchain->getName()] = linkerFlag;
+                }
+                if (emittedRules.insert(suffix).second) {
+                    generateRules(rules, *toolchain, level, suffix, linkerFlags[toolchain->getName()]);
+                }
 
-                for (const auto& src : app.sources) {
-                    // Unique object file path per target to avoid collisions if same source is used
-                    std::string obj = "$builddir/" + app.name + "/" + src + ".o";
-                    object_files.push_back(obj);
+                TargetScope scope;
+                scope.file = builddir + "/" + app.name + ".ninja";
+                scope.rule = suffix;
+                scope.compilePool = app.compile_pool;
+                scope.linkPool = app.link_pool;
+                scope.binary = output_file(app, builddir);
+                scope.archive = app.type == AppType::StaticLibrary;
 
-                    out << "build " << obj << ": cxx " << src << "\n";
-                    out << "  FLAGS = " << flags << "\n";
-                    out << "  INCLUDES = " << includes << "\n";
-                    out << "  depfile = " << obj << ".d\n\n";
+                std::vector<std::string>& flagItems = scope.lists["FLAGS"];
+                flagItems.push_back(standard_flag(app.standard));
+#ifndef _WIN32
+                if (pic.count(app.name)) flagItems.emplace_back(" -fPIC");
+#endif
+                const UsageRequirements usage = usage_requirements(app, used);
+                for (const auto& def : usage.defines) flagItems.push_back(" -D" + def);
+                const std::string flags = join_items(flagItems);
+
+                std::vector<std::string>& includeItems = scope.lists["INCLUDES"];
+                for (const auto& inc : usage.include_dirs) includeItems.push_back(" -I" + inc);
+                const std::string includes = join_items(includeItems);
+
+                std::vector<std::string>& linkItems = scope.lists["LINK_FLAGS"];
+                for (const auto& flag : app.link_flags) linkItems.push_back(" " + flag);
+                if (app.type == AppType::SharedLibrary) {
+                    for (const auto& flag : toolchain->getSharedLibraryFlags(library_file_name(app))) linkItems.push_back(" " + flag);
+                }
+                if (!scope.archive) {
+                    const std::vector<const CppApplication*> linked = link_closure(index, app);
+                    bool usesShared = false;
+                    for (const CppApplication* lib : linked) {
+                        scope.libraries.push_back(output_file(*lib, builddir));
+                        usesShared = usesShared || lib->type == AppType::SharedLibrary;
+                    }
+                    // Flags of static libraries (e.g. their packages' libraries) are needed
+                    // wherever the archive is linked
+                    for (const CppApplication* lib : linked) {
+                        if (lib->type != AppType::StaticLibrary) continue;
+                        for (const auto& flag : lib->link_flags) linkItems.push_back(" " + flag);
+                    }
+#if defined(__APPLE__)
+                    if (usesShared) linkItems.emplace_back(" -Wl,-rpath,@loader_path");
+#elif !defined(_WIN32)
+                    if (usesShared) linkItems.emplace_back(" '-Wl,-rpath,$$ORIGIN'");
+#endif
                 }
 
-                std::string binary = "bin/" + app.name;
-                #ifdef _WIN32
-                    binary += ".exe";
-                #endif
+                scope.variables = {
+                    { "FLAGS", flags },
+                    { "INCLUDES", includes },
+                    { "LINK_FLAGS", join_items(linkItems) },
+                    { "objdir", "$builddir/" + app.name },
+                };
 
-                std::string link_flags;
-                for (const auto& flag : app.link_flags) link_flags += " " + flag;
+                if (!app.precompiled_header.empty()) {
+                    // The PCH is built from a one-line wrapper that includes the real header, so a
+                    // "#pragma once" in it isn't compiled as a main file. GCC then finds
+                    // "<wrapper>.gch" when the wrapper is force-included.
+                    const std::string wrapper = "pch/" + app.precompiled_header;
+                    write_file_if_changed(fs::path(builddir) / app.name / wrapper,
+                                          "#include \"" + fs::absolute(app.precompiled_header).generic_string() + "\"\n");
 
-                out << "build " << binary << ": link";
-                for (const auto& obj : object_files) out << " " << obj;
-                out << "\n";
-                out << "  LINK_FLAGS = " << link_flags << "\n";
+                    const std::string header = "$objdir/" + wrapper;
+                    scope.pchSource = app.precompiled_header;
+                    scope.pchWrapper = header;
+                    scope.pch = header + toolchain->getPchExtension();
+
+                    std::string pchFlags;
+                    for (const auto& flag : toolchain->getPchUseFlags(header, scope.pch)) pchFlags += " " + flag;
+                    scope.variables.emplace_back("PCH_FLAGS", pchFlags);
+                }
+
+                if (uses_modules(app, used)) {
+                    if (moduleCollator.empty()) {
+                        throw std::runtime_error("Target '" + app.name + "' uses C++ modules, which need build.ninja to be written by the anvil executable");
+                    }
+                    if (app.standard < CppStandard::CPP_20) {
+                        throw std::runtime_error("Target '" + app.name + "' uses C++ modules, which need C++20 or later");
+                    }
+                    if (emittedModuleRules.insert(suffix).second) {
+                        generateModuleRules(rules, *toolchain, level, suffix);
+                    }
+
+                    scope.modules = true;
+                    std::string moduleMap;
+                    for (const auto& flag : toolchain->getModuleFlags("$objdir/modules.modmap")) moduleMap += " " + flag;
+                    std::string moduleDeps;
+                    for (const CppApplication* lib : used) {
+                        if (lib->module_sources.empty()) continue;
+                        scope.moduleDeps.push_back(builddir + "/" + lib->name + "/modules.json");
+                        moduleDeps += " --deps=" + scope.moduleDeps.back();
+                    }
+                    scope.variables.emplace_back("MODULE_MAP", moduleMap);
+                    scope.variables.emplace_back("MODULE_DEPS", moduleDeps);
+
+                    auto addInterface = [&](const std::string& src, const std::string& stem) {
+                        std::string interfaceFlags;
+                        for (const auto& flag : toolchain->getModuleInterfaceFlags("$objdir/" + stem + toolchain->getBmiExtension())) interfaceFlags += " " + flag;
+                        scope.compiles.push_back({ "$objdir/" + stem + ".o", src, interfaceFlags });
+                        scope.objects.push_back("$objdir/" + stem + ".o");
+                    };
+                    for (const auto& src : app.module_sources) {
+                        addInterface(src, src);
+                    }
+                    if (app.import_std) {
+                        const fs::path stdModule = toolchain->getStdModuleSource();
+                        if (stdModule.empty()) {
+                            throw std::runtime_error("Target '" + app.name + "' imports std, but " + toolchain->getCompiler() + " provides no std module source");
+                        }
+                        addInterface(stdModule.generic_string(), "std.cppm");
+                    }
+                }
+
+                // Everything that determines the object besides the source. The PCH flags name
+                // the target's own PCH, so targets using one never share objects.
+                Hasher action;
+                action.field(suffix);
+                action.field(flags);
+                action.field(includes);
+                if (!scope.pch.empty()) action.field(app.name);
+
+                const std::vector<std::string> sources = app.unity_batch_size > 0 ? generate_unity_sources(app) : app.sources;
+                for (const auto& src : sources) {
+                    // Objects of module-using targets depend on the target's module map and BMIs
+                    const std::string key = Hasher(action).field(src).hex();
+                    auto owner = compiledObjects.find(key);
+                    if (scope.modules || owner == compiledObjects.end()) {
+                        // Object path per target, so the same source built differently doesn't collide
+                        scope.compiles.push_back({ "$objdir/" + src + ".o", src, "" });
+                        scope.objects.push_back("$objdir/" + src + ".o");
+                        if (!scope.modules) compiledObjects.emplace(key, builddir + "/" + app.name + "/" + src + ".o");
+                    } else {
+                        scope.objects.push_back(owner->second);
+                    }
+                }
+                scopes.push_back(std::move(scope));
+            }
+            return scopes;
+        }
+
+        static std::string join_items(const std::vector<std::string>& items) {
+            std::string joined;
+            for (const auto& item : items) joined += item;
+            return joined;
+        }
+
+        // Splits each target's lists into runs of consecutive items used by the same set of
+        // targets, and interns the runs more than one target has as variables in build.ninja.
+        // The dependency include dirs every target gets thus become one variable even though
+        // each target puts its own dirs in front of them.
+        void internSharedRuns(std::vector<TargetScope>& scopes) {
+            std::map<std::pair<std::string, std::string>, std::set<size_t>> itemUsers;
+            for (size_t i = 0; i < scopes.size(); ++i) {
+                for (const auto& [name, items] : scopes[i].lists) {
+                    for (const auto& item : items) itemUsers[{ name, item }].insert(i);
+                }
+            }
+
+            std::vector<std::map<std::string, std::vector<std::string>>> runs(scopes.size());
+            std::map<std::string, std::set<size_t>> runUsers;
+            for (size_t i = 0; i < scopes.size(); ++i) {
+                for (const auto& [name, items] : scopes[i].lists) {
+                    std::vector<std::string>& split = runs[i][name];
+                    const std::set<size_t>* users = nullptr;
+                    for (const auto& item : items) {
+                        const std::set<size_t>& itemUsersOf = itemUsers[{ name, item }];
+                        if (!users || *users != itemUsersOf) split.emplace_back();
+                        users = &itemUsersOf;
+                        split.back() += item;
+                    }
+                    for (const auto& run : split) runUsers[run].insert(i);
+                }
+            }
+
+            std::map<std::string, std::string> interned;
+            for (size_t i = 0; i < scopes.size(); ++i) {
+                for (auto& [name, value] : scopes[i].variables) {
+                    auto split = runs[i].find(name);
+                    if (split == runs[i].end()) continue;
+
+                    value.clear();
+                    for (const auto& run : split->second) {
+                        // Runs referring to the target's own $objdir would mean something else in build.ninja
+                        if (run.size() <= 32 || runUsers[run].size() < 2 || run.find("$objdir") != std::string::npos) {
+                            value += run;
+                            continue;
+                        }
+                        // Stored without the leading space, which a reference keeps
+                        const bool spaced = run[0] == ' ';
+                        auto [entry, inserted] = interned.emplace(run, "shared_" + std::to_string(interned.size()));
+                        if (inserted) {
+                            out << entry->second << " = " << run.substr(spaced ? 1 : 0) << "\n";
+                            graph.globals.emplace_back(entry->second, run.substr(spaced ? 1 : 0));
+                        }
+                        value += (spaced ? " $" : "$") + entry->second;
+                    }
+                }
+            }
+            if (!interned.empty()) out << "\n";
+        }
+
+        void generateScopes(std::vector<TargetScope>& scopes) {
+            internSharedRuns(scopes);
+
+            std::vector<std::string> all_binaries;
+            for (const auto& scope : scopes) {
+                const int scopeIndex = static_cast<int>(graph.scopes.size());
+                graph.scopes.push_back(scope.variables);
+
+                std::ostringstream target;
+                for (const auto& [name, value] : scope.variables) {
+                    target << name << " = " << value << "\n";
+                }
+                target << "\n";
+
+                Bindings compileBindings;
+                if (!scope.compilePool.empty()) compileBindings.emplace_back("pool", scope.compilePool);
+
+                if (!scope.pch.empty()) {
+                    addEdge(target, { "pch_" + scope.rule, { scope.pch }, {}, { scope.pchWrapper }, { scope.pchSource }, {}, compileBindings }, scopeIndex);
+                }
+
+                if (scope.modules) {
+                    std::vector<std::string> scans;
+                    for (const auto& compile : scope.compiles) {
+                        const std::string scan = compile.object.substr(0, compile.object.size() - 2) + ".ddi";
+                        addEdge(target, { "scan_" + scope.rule, { scan }, {}, { compile.source }, {}, {}, { { "OBJECT", compile.object } } }, scopeIndex);
+                        scans.push_back(scan);
+                    }
+                    addEdge(target, { "collate_" + scope.rule, { "$objdir/modules.dd" }, { "$objdir/modules.modmap", "$objdir/modules.json" },
+                                      scans, scope.moduleDeps, {}, {} }, scopeIndex);
+                    target << "\n";
+                }
+
+                for (const auto& compile : scope.compiles) {
+                    BuildEdge edge{ "cxx_" + scope.rule, { compile.object }, {}, { compile.source }, {}, {}, {} };
+                    if (!scope.pch.empty()) edge.implicitInputs.push_back(scope.pch);
+                    if (scope.modules) {
+                        edge.implicitInputs.emplace_back("$objdir/modules.modmap");
+                        edge.orderOnly.emplace_back("$objdir/modules.dd");
+                        edge.bindings.emplace_back("dyndep", "$objdir/modules.dd");
+                    }
+                    if (!compile.moduleFlags.empty()) edge.bindings.emplace_back("MODULE_FLAGS", compile.moduleFlags.substr(1));
+                    edge.bindings.insert(edge.bindings.end(), compileBindings.begin(), compileBindings.end());
+                    addEdge(target, std::move(edge), scopeIndex);
+                }
+
+                target << "\n";
+                if (scope.archive) {
+                    addEdge(target, { "ar_" + scope.rule, { scope.binary }, {}, scope.objects, {}, {}, {} }, scopeIndex);
+                } else {
+                    std::vector<std::string> inputs = scope.objects;
+                    inputs.insert(inputs.end(), scope.libraries.begin(), scope.libraries.end());
+                    Bindings linkBindings;
+                    if (!scope.linkPool.empty()) linkBindings.emplace_back("pool", scope.linkPool);
+                    addEdge(target, { "link_" + scope.rule, { scope.binary }, {}, inputs, { profile_stamp }, {}, linkBindings }, scopeIndex);
+                }
 
-                all_binaries.push_back(binary);
+                write_file_if_changed(scope.file, target.str());
+                out << "subninja " << scope.file << "\n";
+                all_binaries.push_back(scope.binary);
             }
 
             if (!all_binaries.empty()) {
-                out << "default";
+                out << "\ndefault";
                 for (const auto& bin : all_binaries) {
                     out << " " << bin;
                 }
@@ -95,4 +674,4 @@ namespace anvil {
             }
         }
     };
-}
\ No newline at end of file
+}
@@ -3,8 +3,17 @@
 #include <utility>
 #include <filesystem>
 #include <vector>
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <future>
 #include <cstdlib>
 #include "toolchain.hpp"
+#include "hash.hpp"
+#include "depfile.hpp"
+#include "fingerprint.hpp"
+#include "file_util.hpp"
+#include "trace.hpp"
 #include <iostream>
 #include <fstream>
 
@@ -34,31 +43,67 @@ namespace anvil {
             return std::system(cmd.c_str()) == 0;
         }
 
+        // Compiles build.cpp together with the driver into the runner executable
         [[nodiscard]] fs::path compile(const fs::path& userScript) const {
+            return build(userScript, false);
+        }
+
+        // Compiles build.cpp alone into a shared object exporting configure(),
+        // for anvil to load in-process instead of spawning a runner
+        [[nodiscard]] fs::path compile_shared(const fs::path& userScript) const {
+            return build(userScript, true);
+        }
+
+        // Content hash of the anvil/api.hpp build scripts compile against: the embedded copy,
+        // or the one in sourceDir when Anvil runs without its bundle. A shared build script
+        // is compiled with it and reports it back, so the loader can refuse one built against
+        // another api.hpp, whatever in it changed.
+        [[nodiscard]] uint64_t api_digest() const {
+#if defined(ANVIL_EMBEDDED_BUNDLE)
+            if (const EmbeddedFile* api = embedded_bundle().find("anvil/api.hpp")) {
+                return api->hash;
+            }
+#endif
+            Hasher hasher;
+            hasher.update_file(sourceDir / "anvil" / "api.hpp");
+            return hasher.digest();
+        }
+
+        static std::string shared_library_extension() {
+#if defined(_WIN32)
+            return ".dll";
+#elif defined(__APPLE__)
+            return ".dylib";
+#else
+            return ".so";
+#endif
+        }
+
+    private:
+        fs::path build(const fs::path& userScript, bool shared) const {
+            TraceSpan span(shared ? "Compile build script (shared)" : "Compile build script");
             fs::create_directories(buildDir);
 
             // Hydrate embedded files if available
             fs::path embeddedDir = buildDir / "embedded_src";
-            hydrate_embedded_files(embeddedDir);
+            {
+                TraceSpan hydrate("Hydrate embedded files");
+                hydrate_embedded_files(embeddedDir);
+            }
 
             // Ensure bootstrap JSON is available
             fs::path bootstrapDir = buildDir / "bootstrap";
             ensure_bootstrap_json(bootstrapDir);
 
-            fs::path runnerExe = buildDir / "runner";
+            const std::string variant = shared ? "shared" : "runner";
+            fs::path output;
+            if (shared) {
+                output = buildDir / ("build_script" + shared_library_extension());
+            } else {
+                output = buildDir / "runner";
 #ifdef _WIN32
-            runnerExe += ".exe";
+                output += ".exe";
 #endif
-
-            // Check if we can skip compilation
-            if (fs::exists(runnerExe) && fs::exists(userScript)) {
-                auto runnerTime = fs::last_write_time(runnerExe);
-                auto scriptTime = fs::last_write_time(userScript);
-
-                if (runnerTime > scriptTime) {
-                    // Runner is newer than the script, so we can reuse it
-                    return runnerExe;
-                }
             }
 
             // Use embedded driver if available, otherwise fallback to sourceDir
@@ -71,10 +116,13 @@ namespace anvil {
 
             std::vector<std::string> flags = {
                 "-std=c++20",
-                "-DANVIL_API_V2",
-                driverSrc.string()
+                "-DANVIL_API_V2"
             };
 
+            if (shared) {
+                flags.push_back("-fPIC");
+            }
+
             // Add include paths
             if (fs::exists(embeddedDir)) {
                 flags.push_back("-I" + embeddedDir.string());
@@ -89,47 +137,272 @@ namespace anvil {
             flags.push_back("-I" + sourceDir.string());
 
             // Header Discovery: Scan .anvil/libraries/full_deploy for include directories
-            // This is still needed for other dependencies the user might add
+            // This is still needed for other dependencies the user might add.
+            // Only the script sees them, so adding a dependency does not invalidate the driver.
+            std::vector<std::string> scriptFlags = flags;
             fs::path libDir = buildDir / "libraries" / "full_deploy";
             if (fs::exists(libDir)) {
                 for (const auto& entry : fs::recursive_directory_iterator(libDir)) {
                     if (entry.is_directory() && entry.path().filename() == "include") {
-                        flags.push_back("-I" + entry.path().string());
+                        scriptFlags.push_back("-I" + entry.path().string());
                     }
                 }
             }
 
+            std::vector<std::string> linkFlags;
+            if (shared) {
+                scriptFlags.push_back("-DANVIL_SCRIPT_ABI=" + std::to_string(api_digest()) + "ULL");
+                linkFlags.push_back("-shared");
+            }
 #ifdef _WIN32
-            flags.push_back("-static");
+            linkFlags.push_back("-static");
 #endif
 
-            std::string cmd = toolchain->getCompileCommand(userScript, runnerExe, flags);
+            const std::string driverKey = driver_key(driverSrc, bootstrapDir, flags);
+
+            Hasher scriptKey;
+            scriptKey.field(driverKey);
+            for (const auto& flag : scriptFlags) scriptKey.field(flag);
+            for (const auto& flag : linkFlags) scriptKey.field(flag);
+
+            // Reuse the runner if the script, everything it includes and the toolchain are unchanged.
+            // Contents are compared, so restored caches or checkouts with fresh mtimes stay valid.
+            fs::path fingerprintPath = buildDir / (shared ? "script_shared.fingerprint" : "script.fingerprint");
+            if (fs::exists(output) && fingerprint_matches(fingerprintPath, scriptKey.hex())) {
+                return output;
+            }
 
             std::cerr << "[Anvil] Compiling build script with: " << toolchain->getCompiler() << std::endl;
+
+            // The driver and the script only meet at link time, so on a cold start they compile concurrently
+            std::future<fs::path> driverJob;
+            if (!shared) {
+                driverJob = std::async(std::launch::async, [&]() {
+                    return compile_driver(driverSrc, driverKey, flags);
+                });
+            }
+
+            for (const auto& flag : ensure_script_pch(variant, driverKey, flags)) {
+                scriptFlags.push_back(flag);
+            }
+
+            if (shared) {
+                // Lets the loader refuse a script built against a different api.hpp
+                fs::path abiHeader = buildDir / "script_abi.hpp";
+                std::ofstream abi(abiHeader, std::ios::trunc);
+                abi << "extern \"C\" unsigned long long anvil_script_abi() { return ANVIL_SCRIPT_ABI; }\n";
+                abi.close();
+                scriptFlags.push_back("-include");
+                scriptFlags.push_back(abiHeader.string());
+            }
+
+            fs::path scriptObj = buildDir / (shared ? "build_script_shared.o" : "build_script.o");
+            fs::path scriptDeps = scriptObj;
+            scriptDeps.replace_extension(".d");
+            scriptFlags.push_back("-MMD");
+            scriptFlags.push_back("-MF");
+            scriptFlags.push_back(scriptDeps.string());
+            std::string cmd = toolchain->getObjectCommand(userScript, scriptObj, scriptFlags);
             std::cerr << "  >> " << cmd << std::endl;
+            {
+                TraceSpan compile("Compile build.cpp");
+                if (!exec(cmd)) {
+                    throw std::runtime_error("Failed to compile build script");
+                }
+            }
+
+            std::vector<fs::path> objects = { scriptObj };
+            if (!shared) {
+                TraceSpan wait("Wait for build driver");
+                objects.insert(objects.begin(), driverJob.get());
+            }
+
+            cmd = toolchain->getLinkCommand(objects, output, linkFlags);
+            std::cerr << "  >> " << cmd << std::endl;
+            {
+                TraceSpan link("Link build script");
+                if (!exec(cmd)) {
+                    throw std::runtime_error("Failed to link build script");
+                }
+            }
+
+            std::vector<std::string> inputs = read_depfile(scriptDeps);
+            if (inputs.empty()) {
+                inputs.push_back(userScript.string());
+            }
+            write_fingerprint(fingerprintPath, scriptKey.hex(), inputs);
+
+            return output;
+        }
 
+        // The driver only changes with Anvil itself, so it is compiled once per
+        // (driver sources, compiler, flags) and the object is reused across script edits.
+        std::string driver_key(const fs::path& driverSrc, const fs::path& bootstrapDir, const std::vector<std::string>& flags) const {
+            Hasher key;
+            key.field(toolchain->getIdentity());
+            for (const auto& flag : flags) {
+                key.field(flag);
+            }
+
+            // Everything the driver includes from Anvil lives next to it
+            std::vector<fs::path> driverInputs;
+            for (const auto& entry : fs::directory_iterator(driverSrc.parent_path())) {
+                if (entry.is_regular_file()) {
+                    driverInputs.push_back(entry.path());
+                }
+            }
+            driverInputs.push_back(bootstrapDir / "nlohmann" / "json.hpp");
+            std::sort(driverInputs.begin(), driverInputs.end());
+            for (const auto& input : driverInputs) {
+                key.field(input.filename().string());
+                key.update_file(input);
+            }
+            return key.hex();
+        }
+
+        fs::path compile_driver(const fs::path& driverSrc, const std::string& driverKey, const std::vector<std::string>& flags) const {
+            fs::path cacheDir = buildDir / "script_cache";
+            fs::create_directories(cacheDir);
+            fs::path driverObj = cacheDir / ("driver-" + driverKey + ".o");
+            if (fs::exists(driverObj)) {
+                return driverObj;
+            }
+
+            std::cerr << "[Anvil] Compiling build driver (cached for subsequent script changes)..." << std::endl;
+            TraceSpan span("Compile build driver");
+            fs::path tmpObj = driverObj;
+            tmpObj += ".tmp";
+            std::string cmd = toolchain->getObjectCommand(driverSrc, tmpObj, flags);
+            std::cerr << "  >> " << cmd << std::endl;
             if (!exec(cmd)) {
-                throw std::runtime_error("Failed to compile build script");
+                fs::remove(tmpObj);
+                throw std::runtime_error("Failed to compile build driver");
             }
 
-            return runnerExe;
+            // Drop objects built for other Anvil versions or toolchains
+            for (const auto& entry : fs::directory_iterator(cacheDir)) {
+                const std::string name = entry.path().filename().string();
+                if (name.starts_with("driver-") && entry.path() != driverObj && entry.path() != tmpObj) {
+                    std::error_code ec;
+                    fs::remove(entry.path(), ec);
+                }
+            }
+            fs::rename(tmpObj, driverObj);
+            return driverObj;
         }
 
-    private:
+        // Precompiled build-script API, built once per Anvil version, toolchain and flags.
+        // It only covers api.hpp and the standard headers behind it: build scripts never see
+        // nlohmann/json or the ninja/pkg headers, and loading a PCH that contains them costs
+        // more than it saves for a single small translation unit.
+        // Returns the flags that apply the PCH, or nothing if it could not be built.
+        std::vector<std::string> ensure_script_pch(const std::string& variant, const std::string& driverKey, const std::vector<std::string>& flags) const {
+            fs::path pchDir = buildDir / "script_pch" / variant;
+            fs::create_directories(pchDir);
+
+            fs::path header = pchDir / ("script_api-" + driverKey + ".hpp");
+            fs::path pch = header;
+            pch += toolchain->getPchExtension();
+
+            if (!fs::exists(pch)) {
+                TraceSpan span("Precompile build script API");
+                {
+                    std::ofstream out(header, std::ios::trunc);
+                    out << "#include \"anvil/api.hpp\"\n";
+                }
+
+                fs::path tmpPch = pch;
+                tmpPch += ".tmp";
+                std::string cmd = toolchain->getPchCommand(header, tmpPch, flags);
+                std::cerr << "  >> " << cmd << std::endl;
+                if (!exec(cmd)) {
+                    std::error_code ec;
+                    fs::remove(tmpPch, ec);
+                    std::cerr << "[Warning] Could not precompile the build script API, continuing without it." << std::endl;
+                    return {};
+                }
+
+                for (const auto& entry : fs::directory_iterator(pchDir)) {
+                    const std::string name = entry.path().filename().string();
+                    if (name.starts_with("script_api-") && name.find(driverKey) == std::string::npos) {
+                        std::error_code ec;
+                        fs::remove(entry.path(), ec);
+                    }
+                }
+                fs::rename(tmpPch, pch);
+            }
+
+            return toolchain->getPchUseFlags(header, pch);
+        }
+
+        // Embedded files are written out once per Anvil build. The stamp holds a digest of
+        // every embedded name and content, which identifies the Anvil build that wrote the
+        // tree; when it matches nothing is touched, so the tree keeps its mtimes.
         void hydrate_embedded_files(const fs::path& targetDir) const {
-#if __has_include("embedded_resources.hpp")
-            if (!fs::exists(targetDir)) {
-                fs::create_directories(targetDir);
+#if defined(ANVIL_EMBEDDED_BUNDLE)
+            // The generator recorded the digest, so checking the stamp decompresses nothing
+            const EmbeddedBundle bundle = embedded_bundle();
+            const std::string stamp = "anvil-embedded " + Hasher::to_hex(bundle.digest()) + "\n";
+
+            fs::path stampPath = targetDir / ".anvil_stamp";
+            std::string existingStamp;
+            if (read_file(stampPath, existingStamp) && existingStamp == stamp) {
+                bool complete = true;
+                for (const EmbeddedFile& file : bundle) {
+                    if (!fs::exists(targetDir / file.name)) {
+                        complete = false;
+                        break;
+                    }
+                }
+                if (complete) return;
             }
 
+            fs::create_directories(targetDir);
+            std::string content;
+            for (const EmbeddedFile& file : bundle) {
+                fs::path target = targetDir / file.name;
+
+                // Files already holding these bytes are neither decompressed nor rewritten
+                std::error_code ec;
+                if (fs::file_size(target, ec) == file.size && !ec && hash_file(target) == Hasher::to_hex(file.hash)) {
+                    continue;
+                }
+                if (!bundle.extract(file, content)) {
+                    throw std::runtime_error("Corrupt embedded resource: " + std::string(file.name));
+                }
+                write_file_atomic(target, content);
+            }
+            write_file_atomic(stampPath, stamp);
+#elif __has_include("embedded_resources.hpp")
+            // Resources generated by an older Anvil as plain string literals
             auto files = get_embedded_files();
+
+            Hasher digest;
             for (const auto& [name, content] : files) {
-                fs::path filePath = targetDir / name;
-                fs::create_directories(filePath.parent_path());
+                digest.field(name);
+                digest.field(content);
+            }
+            const std::string stamp = "anvil-embedded " + digest.hex() + "\n";
+
+            fs::path stampPath = targetDir / ".anvil_stamp";
+            std::string existingStamp;
+            if (read_file(stampPath, existingStamp) && existingStamp == stamp) {
+                bool complete = true;
+                for (const auto& [name, content] : files) {
+                    if (!fs::exists(targetDir / name)) {
+                        complete = false;
+                        break;
+                    }
+                }
+                if (complete) return;
+            }
 
-                std::ofstream out(filePath, std::ios::binary);
-                out.write(content.data(), content.size());
+            fs::create_directories(targetDir);
+            for (const auto& [name, content] : files) {
+                // Only files whose bytes differ are replaced, each atomically
+                write_file_if_changed(targetDir / name, content);
             }
+            write_file_atomic(stampPath, stamp);
 #endif
         }
 
@@ -7,6 +7,7 @@
 #include <map>
 #include <memory>
 #include <stdexcept>
+#include <filesystem>
 
 namespace anvil {
 
@@ -17,6 +18,42 @@ namespace anvil {
         virtual void tearDown() {}
     };
 
+    // A temporary directory for tests that work on files. create() gives each test an empty
+    // one; it is removed, and the working directory enter() changed is restored, when the
+    // suite instance goes away, which happens after a failed assertion too.
+    class ScratchDirectory {
+        std::filesystem::path dir;
+        std::filesystem::path previous;
+
+    public:
+        ScratchDirectory() = default;
+
+        ~ScratchDirectory() {
+            std::error_code ec;
+            if (!previous.empty()) std::filesystem::current_path(previous, ec);
+            if (!dir.empty()) std::filesystem::remove_all(dir, ec);
+        }
+
+        ScratchDirectory(const ScratchDirectory&) = delete;
+        ScratchDirectory& operator=(const ScratchDirectory&) = delete;
+
+        // <temp>/<name>_<hash of the working directory>, so checkouts running their tests at
+        // the same time don't share it
+        const std::filesystem::path& create(const std::string& name) {
+            const std::string owner = std::to_string(std::hash<std::string>{}(std::filesystem::current_path().string()));
+            dir = std::filesystem::temp_directory_path() / (name + "_" + owner);
+            std::filesystem::remove_all(dir);
+            std::filesystem::create_directories(dir);
+            return dir;
+        }
+
+        // Makes the directory the working directory for the rest of the test
+        void enter() {
+            previous = std::filesystem::current_path();
+            std::filesystem::current_path(dir);
+        }
+    };
+
     using TestMethod = std::function<void(TestSuite*)>;
 
     struct TestInfo {
@@ -2,20 +2,299 @@
 #include <string>
 #include <vector>
 #include <filesystem>
+#include <cstdlib>
+#include <memory>
+#include <fstream>
+#include <iterator>
+#include <cstdio>
+#include <cctype>
+#include <map>
+#include <set>
+#include <iostream>
+#include <mutex>
+#include <functional>
+#include "api.hpp"
 
 namespace anvil {
     namespace fs = std::filesystem;
 
+    // Looks up an executable in PATH, returns an empty path if it cannot be found
+    inline fs::path find_program(const std::string& name) {
+        const char* pathEnv = std::getenv("PATH");
+        if (!pathEnv) return {};
+
+#ifdef _WIN32
+        const char separator = ';';
+        const std::vector<std::string> suffixes = { ".exe", "" };
+#else
+        const char separator = ':';
+        const std::vector<std::string> suffixes = { "" };
+#endif
+
+        std::string paths = pathEnv;
+        size_t start = 0;
+        while (start <= paths.size()) {
+            size_t end = paths.find(separator, start);
+            if (end == std::string::npos) end = paths.size();
+            std::string dir = paths.substr(start, end - start);
+            start = end + 1;
+
+            if (dir.empty()) continue;
+            for (const auto& suffix : suffixes) {
+                fs::path candidate = fs::path(dir) / (name + suffix);
+                std::error_code ec;
+                if (fs::is_regular_file(candidate, ec)) {
+                    return candidate;
+                }
+            }
+        }
+        return {};
+    }
+
+    // Cheap identity of an installed program: resolved binary path, size and mtime.
+    // Changes whenever the program is upgraded or PATH points somewhere else.
+    inline std::string program_identity(const std::string& name) {
+        fs::path program = fs::path(name).has_parent_path() ? fs::path(name) : find_program(name);
+        if (program.empty()) {
+            return name;
+        }
+
+        std::error_code ec;
+        fs::path resolved = fs::canonical(program, ec);
+        if (ec) resolved = program;
+
+        std::string identity = resolved.string();
+        auto size = fs::file_size(resolved, ec);
+        if (!ec) identity += ":" + std::to_string(size);
+        auto mtime = fs::last_write_time(resolved, ec);
+        if (!ec) identity += ":" + std::to_string(mtime.time_since_epoch().count());
+        return identity;
+    }
+
+    // Answers from running a tool to see what it supports, kept for the life of the process
+    // under a key that names the programs involved (see program_identity). The daemon
+    // probes once; the builds it forks start with the answers.
+    inline std::string probe_once(const std::string& key, const std::function<std::string()>& probe) {
+        static std::mutex mutex;
+        static std::map<std::string, std::string> answers;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = answers.find(key);
+            if (it != answers.end()) return it->second;
+        }
+        std::string answer = probe();
+        std::lock_guard<std::mutex> lock(mutex);
+        return answers.emplace(key, std::move(answer)).first->second;
+    }
+
     class Toolchain {
     public:
         virtual ~Toolchain() = default;
+        // Short identifier used in generated rule names
+        virtual std::string getName() const = 0;
         virtual std::string getCompiler() const = 0;
         virtual std::string getLinker() const = 0;
         virtual std::string getCompileCommand(const fs::path& source, const fs::path& output, const std::vector<std::string>& flags) const = 0;
+
+        // Compiles a single translation unit to an object file
+        virtual std::string getObjectCommand(const fs::path& source, const fs::path& output, const std::vector<std::string>& flags) const {
+            std::string cmd = getCompiler() + " -c";
+            for (const auto& flag : flags) {
+                cmd += " " + flag;
+            }
+            cmd += " " + source.string();
+            cmd += " -o " + output.string();
+            return cmd;
+        }
+
+        virtual std::string getLinkCommand(const std::vector<fs::path>& objects, const fs::path& output, const std::vector<std::string>& flags) const {
+            std::string cmd = getLinker();
+            for (const auto& obj : objects) {
+                cmd += " " + obj.string();
+            }
+            cmd += " -o " + output.string();
+            for (const auto& flag : flags) {
+                cmd += " " + flag;
+            }
+            return cmd;
+        }
+
+        // Static libraries. The archive is recreated rather than updated, so objects of
+        // removed sources don't linger in it.
+        virtual std::string getArchiveCommand(const std::vector<fs::path>& objects, const fs::path& output) const {
+#ifdef _WIN32
+            std::string cmd = "ar rcs " + output.string();
+#else
+            std::string cmd = "rm -f " + output.string() + " && ar rcs " + output.string();
+#endif
+            for (const auto& obj : objects) {
+                cmd += " " + obj.string();
+            }
+            return cmd;
+        }
+
+        // Link flags for a shared library, which dependents find next to them at runtime
+        virtual std::vector<std::string> getSharedLibraryFlags(const std::string& fileName) const {
+#ifdef __APPLE__
+            return { "-dynamiclib", "-Wl,-install_name,@rpath/" + fileName };
+#elif defined(_WIN32)
+            return { "-shared" };
+#else
+            return { "-shared", "-Wl,-soname," + fileName };
+#endif
+        }
+
+        // Compile flags for a build profile. Release-style profiles define NDEBUG; MinSize puts
+        // every function and object in its own section so the linker can drop unused ones.
+        virtual std::vector<std::string> getOptimizationFlags(Optimization level) const {
+            switch (level) {
+                case Optimization::Release: return { "-O3", "-DNDEBUG" };
+                case Optimization::RelWithDebInfo: return { "-O2", "-g", "-DNDEBUG" };
+                case Optimization::MinSize: return { "-Os", "-DNDEBUG", "-ffunction-sections", "-fdata-sections" };
+                case Optimization::Debug: break;
+            }
+            return { "-O0", "-g" };
+        }
+
+        virtual std::vector<std::string> getOptimizationLinkFlags(Optimization level) const {
+            if (level != Optimization::MinSize) return {};
+#ifdef __APPLE__
+            return { "-Wl,-dead_strip" };
+#else
+            return { "-Wl,--gc-sections" };
+#endif
+        }
+
+        // A linker that relinks much faster than the system default, probed at configure
+        // time: mold, then lld. Returns its --version line, e.g. "mold 2.30.0 (compatible with
+        // GNU ld)", and sets flag to what selects it. Empty when neither is installed or the
+        // driver can't use it (-fuse-ld=mold needs GCC 12.1); macOS and Windows keep theirs.
+        std::string findFastLinker(std::string& flag) const {
+#if defined(__APPLE__) || defined(_WIN32)
+            return {};
+#else
+            const std::string key = "linker " + program_identity(getLinker()) + " " + find_program("ld.mold").string() + " " + find_program("ld.lld").string();
+            const std::string answer = probe_once(key, [this] {
+                std::string found;
+                const std::string version = probeFastLinker(found);
+                return found + "\n" + version;
+            });
+            const size_t newline = answer.find('\n');
+            flag = answer.substr(0, newline);
+            return answer.substr(newline + 1);
+#endif
+        }
+
+        // The uncached probe behind findFastLinker
+        std::string probeFastLinker(std::string& flag) const {
+#if defined(__APPLE__) || defined(_WIN32)
+            return {};
+#else
+            for (const std::string name : { "mold", "lld" }) {
+                if (find_program("ld." + name).empty()) continue;
+
+                const std::string probe = getLinker() + " -fuse-ld=" + name + " -Wl,--version 2>/dev/null";
+                std::unique_ptr<FILE, decltype(&pclose)> pipe(popen(probe.c_str(), "r"), pclose);
+                if (!pipe) continue;
+                std::string output;
+                char buffer[512];
+                while (fgets(buffer, sizeof(buffer), pipe.get()) != nullptr) {
+                    output += buffer;
+                }
+                if (pclose(pipe.release()) != 0) continue;
+
+                // The driver may print its own lines first
+                const size_t at = output.find(name == "lld" ? "LLD" : "mold");
+                if (at == std::string::npos) continue;
+                const size_t lineStart = output.rfind('\n', at);
+                const size_t start = lineStart == std::string::npos ? 0 : lineStart + 1;
+                flag = "-fuse-ld=" + name;
+                return output.substr(start, output.find('\n', at) - start);
+            }
+            return {};
+#endif
+        }
+
+        // Debug builds with a fast linker: split DWARF leaves most debug info in .dwo files
+        // next to the objects, so the linker never copies it, and the pubnames sections let
+        // it write a .gdb_index, so gdb doesn't index the binary on every start
+        virtual std::vector<std::string> getSplitDebugFlags() const {
+            return { "-gsplit-dwarf", "-ggnu-pubnames" };
+        }
+
+        virtual std::vector<std::string> getGdbIndexLinkFlags() const {
+            return { "-Wl,--gdb-index" };
+        }
+
+        // Makes every compile write a trace of where its time went (header parsing, template
+        // instantiation) next to the object, as <object without .o>.json. Empty if the
+        // compiler can't.
+        virtual std::vector<std::string> getTimeTraceFlags() const {
+            return {};
+        }
+
+        // Precompiled headers: GCC picks up "<header>.gch" automatically when the header is force-included
+        virtual std::string getPchExtension() const {
+            return ".gch";
+        }
+
+        virtual std::string getPchCommand(const fs::path& header, const fs::path& output, const std::vector<std::string>& flags) const {
+            std::string cmd = getCompiler() + " -x c++-header";
+            for (const auto& flag : flags) {
+                cmd += " " + flag;
+            }
+            cmd += " " + header.string();
+            cmd += " -o " + output.string();
+            return cmd;
+        }
+
+        virtual std::vector<std::string> getPchUseFlags(const fs::path& header, const fs::path& pch) const {
+            return { "-include", header.string(), "-Winvalid-pch" };
+        }
+
+        // C++20 modules. The scan writes the P1689 module dependencies of $in, compiled to
+        // $OBJECT, to $out (GCC 14 or newer).
+        virtual std::string getModuleScanCommand(const std::vector<std::string>& flags) const {
+            std::string cmd = getCompiler();
+            for (const auto& flag : flags) {
+                cmd += " " + flag;
+            }
+            cmd += " -E -x c++ $in -MT $out -MD -MF $out.d -fmodules-ts -fdeps-format=p1689r5 -fdeps-file=$out -fdeps-target=$OBJECT -o $out.i";
+            return cmd;
+        }
+
+        // Extension of a built module interface (BMI)
+        virtual std::string getBmiExtension() const {
+            return ".gcm";
+        }
+
+        // Flags for every source of a target that uses modules; modmap is written by the collator.
+        // -Mno-modules keeps GCC's module rules out of the depfile, where ninja can't parse them.
+        virtual std::vector<std::string> getModuleFlags(const fs::path& modmap) const {
+            return { "-fmodules-ts", "-Mno-modules", "-fmodule-mapper=" + modmap.string() };
+        }
+
+        // Extra flags for a module interface unit. GCC takes the BMI's path from the mapper.
+        virtual std::vector<std::string> getModuleInterfaceFlags(const fs::path& bmi) const {
+            return { "-x", "c++" };
+        }
+
+        // Source of the standard library's "std" module, empty if the toolchain has none
+        virtual fs::path getStdModuleSource() const {
+            return {};
+        }
+
+        std::string getIdentity() const {
+            return program_identity(getCompiler());
+        }
     };
 
     class ClangToolchain : public Toolchain {
     public:
+        std::string getName() const override {
+            return "clang";
+        }
+
         std::string getCompiler() const override {
             return "clang++";
         }
@@ -33,10 +312,88 @@ namespace anvil {
             cmd += " -o " + output.string();
             return cmd;
         }
+
+        std::string getPchExtension() const override {
+            return ".pch";
+        }
+
+        std::vector<std::string> getPchUseFlags(const fs::path& header, const fs::path& pch) const override {
+            return { "-include-pch", pch.string() };
+        }
+
+        // 50us granularity instead of 500, so headers that are cheap once but included everywhere still show up
+        std::vector<std::string> getTimeTraceFlags() const override {
+            return { "-ftime-trace", "-ftime-trace-granularity=50" };
+        }
+
+        std::string getModuleScanCommand(const std::vector<std::string>& flags) const override {
+            std::string cmd = "clang-scan-deps -format=p1689 -- " + getCompiler();
+            for (const auto& flag : flags) {
+                cmd += " " + flag;
+            }
+            cmd += " -x c++ $in -c -o $OBJECT -MT $out -MD -MF $out.d > $out.tmp && mv $out.tmp $out";
+            return cmd;
+        }
+
+        std::string getBmiExtension() const override {
+            return ".pcm";
+        }
+
+        // The collator writes one -fmodule-file=<name>=<bmi> per line
+        std::vector<std::string> getModuleFlags(const fs::path& modmap) const override {
+            return { "@" + modmap.string() };
+        }
+
+        std::vector<std::string> getModuleInterfaceFlags(const fs::path& bmi) const override {
+            return { "-x", "c++-module", "-fmodule-output=" + bmi.string() };
+        }
+
+        // libc++ ships std.cppm and lists it in a manifest next to the library (Clang 19+)
+        fs::path getStdModuleSource() const override {
+            return probe_once("std module " + program_identity(getCompiler()), [this] { return probeStdModuleSource().string(); });
+        }
+
+        fs::path probeStdModuleSource() const {
+            std::string manifestPath;
+#ifdef _WIN32
+            std::unique_ptr<FILE, decltype(&_pclose)> pipe(_popen((getCompiler() + " -print-library-module-manifest-path").c_str(), "r"), _pclose);
+#else
+            std::unique_ptr<FILE, decltype(&pclose)> pipe(popen((getCompiler() + " -print-library-module-manifest-path 2>/dev/null").c_str(), "r"), pclose);
+#endif
+            if (!pipe) return {};
+            char buffer[4096];
+            while (fgets(buffer, sizeof(buffer), pipe.get()) != nullptr) {
+                manifestPath += buffer;
+            }
+            while (!manifestPath.empty() && std::isspace(static_cast<unsigned char>(manifestPath.back()))) {
+                manifestPath.pop_back();
+            }
+
+            std::ifstream in(manifestPath);
+            if (manifestPath.empty() || !in) return {};
+            const std::string manifest((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+            // {"modules": [{"logical-name": "std", "source-path": "<relative to the manifest>", ...}]}
+            const size_t name = manifest.find("\"logical-name\": \"std\"");
+            if (name == std::string::npos) return {};
+            const size_t objectStart = manifest.rfind('{', name);
+            const size_t key = manifest.find("\"source-path\"", objectStart);
+            if (key == std::string::npos) return {};
+            const size_t open = manifest.find('"', manifest.find(':', key) + 1);
+            const size_t close = manifest.find('"', open + 1);
+            if (open == std::string::npos || close == std::string::npos) return {};
+
+            fs::path source = manifest.substr(open + 1, close - open - 1);
+            return source.is_absolute() ? source : fs::path(manifestPath).parent_path() / source;
+        }
     };
 
     class GCCToolchain : public Toolchain {
     public:
+        std::string getName() const override {
+            return "gcc";
+        }
+
         std::string getCompiler() const override {
             return "g++";
         }
@@ -55,4 +412,32 @@ namespace anvil {
             return cmd;
         }
     };
-}
\ No newline at end of file
+
+    // MSVC has no toolchain of its own yet and is built with Clang
+    inline std::unique_ptr<Toolchain> make_toolchain(CompilerId id) {
+        if (id == CompilerId::GCC) {
+            return std::make_unique<GCCToolchain>();
+        }
+        return std::make_unique<ClangToolchain>();
+    }
+
+    // Probes each toolchain the project uses for a fast linker and records the choice in
+    // fast_linkers, where manifest writes read it
+    inline void select_fast_linkers(Project& project) {
+        project.fast_linkers.clear();
+        std::set<std::string> probed;
+        for (const auto& target : project.targets) {
+            const auto toolchain = make_toolchain(target.compilerId);
+            if (!probed.insert(toolchain->getName()).second) continue;
+
+            FastLinker linker;
+            if (project.fast_link) {
+                linker.version = toolchain->findFastLinker(linker.flag);
+            }
+            std::cerr << "[Anvil] Linker (" << toolchain->getName() << "): " << (linker.version.empty() ? "system default" : linker.version) << std::endl;
+            if (!linker.flag.empty()) {
+                project.fast_linkers[toolchain->getName()] = linker;
+            }
+        }
+    }
+}
@@ -0,0 +1,218 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <filesystem>
+#include <cstdlib>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+#include "file_util.hpp"
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace anvil {
+    namespace fs = std::filesystem;
+
+    // Timeline of a build for `anvil build --trace=<file>`, in Chrome's trace event format
+    // (ui.perfetto.dev, chrome://tracing). Every process taking part appends one event per
+    // line to the file named by ANVIL_TRACE; anvil turns them into the trace when the build
+    // is done. Each process is a track and each of its threads a lane.
+    class Tracer {
+        std::mutex mutex;
+        std::ofstream out;
+        std::map<std::thread::id, int> lanes;
+        int pid = 0;
+
+        Tracer() {
+#ifdef _WIN32
+            pid = _getpid();
+#else
+            pid = static_cast<int>(getpid());
+#endif
+            if (const char* path = std::getenv("ANVIL_TRACE"); path && *path) {
+                out.open(path, std::ios::out | std::ios::binary | std::ios::app);
+            }
+        }
+
+        void write(const nlohmann::json& event) {
+            const std::string line = event.dump() + "\n";
+            out.write(line.data(), static_cast<std::streamsize>(line.size()));
+            out.flush();
+        }
+
+    public:
+        static Tracer& instance() {
+            static Tracer tracer;
+            return tracer;
+        }
+
+        // Starts tracing into events, for this process and the ones it starts
+        void open(const fs::path& events) {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::error_code ec;
+            fs::remove(events, ec);
+#ifdef _WIN32
+            _putenv_s("ANVIL_TRACE", events.string().c_str());
+#else
+            setenv("ANVIL_TRACE", events.string().c_str(), 1);
+#endif
+            out.close();
+            out.open(events, std::ios::out | std::ios::binary | std::ios::app);
+        }
+
+        void close() {
+            std::lock_guard<std::mutex> lock(mutex);
+            out.close();
+        }
+
+        [[nodiscard]] bool enabled() const {
+            return out.is_open();
+        }
+
+        // Microseconds on the system clock, which every process of the build shares
+        static int64_t now() {
+            return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        }
+
+        // The calling thread's lane: 0 for the first thread that traces, usually main
+        int lane() {
+            std::lock_guard<std::mutex> lock(mutex);
+            return lanes.emplace(std::this_thread::get_id(), static_cast<int>(lanes.size())).first->second;
+        }
+
+        void name_process(const std::string& name) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!enabled()) return;
+            write({ { "ph", "M" }, { "name", "process_name" }, { "pid", pid }, { "tid", 0 }, { "args", { { "name", name } } } });
+        }
+
+        void name_lane(int tid, const std::string& name) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!enabled()) return;
+            write({ { "ph", "M" }, { "name", "thread_name" }, { "pid", pid }, { "tid", tid }, { "args", { { "name", name } } } });
+        }
+
+        void complete(const std::string& name, const std::string& category, int64_t start, int64_t duration, int tid,
+                      const nlohmann::json& args = nlohmann::json::object()) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!enabled()) return;
+            write({ { "ph", "X" }, { "name", name }, { "cat", category }, { "ts", start }, { "dur", std::max<int64_t>(duration, 1) },
+                    { "pid", pid }, { "tid", tid }, { "args", args } });
+        }
+    };
+
+    // Records the time between its construction and destruction on the current thread's lane
+    class TraceSpan {
+        std::string name;
+        std::string category;
+        int64_t start = 0;
+
+    public:
+        explicit TraceSpan(std::string spanName, std::string spanCategory = "anvil")
+            : name(std::move(spanName)), category(std::move(spanCategory)) {
+            if (Tracer::instance().enabled()) start = Tracer::now();
+        }
+
+        ~TraceSpan() {
+            Tracer& tracer = Tracer::instance();
+            if (!tracer.enabled() || start == 0) return;
+            tracer.complete(name, category, start, Tracer::now() - start, tracer.lane());
+        }
+
+        TraceSpan(const TraceSpan&) = delete;
+        TraceSpan& operator=(const TraceSpan&) = delete;
+    };
+
+    inline std::set<std::string> read_ninja_log_lines(const fs::path& log) {
+        std::set<std::string> lines;
+        std::string content;
+        if (!read_file(log, content)) return lines;
+        std::istringstream in(content);
+        std::string line;
+        while (std::getline(in, line)) {
+            if (!line.empty() && line[0] != '#') lines.insert(line);
+        }
+        return lines;
+    }
+
+    // Adds the actions ninja ran to the trace. .ninja_log keeps the latest entry per output
+    // ("<start ms> <end ms> <mtime> <output> <command hash>", relative to ninja's start), so
+    // the lines that weren't there before the build are the ones it ran. It has no thread
+    // ids; actions are packed into as many lanes as ran at once.
+    inline void trace_ninja_log(const fs::path& log, const std::set<std::string>& before, int64_t ninjaStart) {
+        Tracer& tracer = Tracer::instance();
+        if (!tracer.enabled()) return;
+
+        struct Action {
+            long long start;
+            long long end;
+            std::string output;
+        };
+        std::vector<Action> actions;
+        std::set<std::string> seen;  // edges with several outputs log one line per output
+        for (const auto& line : read_ninja_log_lines(log)) {
+            if (before.count(line)) continue;
+            std::istringstream fields(line);
+            std::string start, end, mtime, output, hash;
+            if (!std::getline(fields, start, '\t') || !std::getline(fields, end, '\t') || !std::getline(fields, mtime, '\t') ||
+                !std::getline(fields, output, '\t') || !std::getline(fields, hash, '\t')) {
+                continue;
+            }
+            if (!seen.insert(start + "/" + end + "/" + hash).second) continue;
+            actions.push_back({ std::atoll(start.c_str()), std::atoll(end.c_str()), output });
+        }
+        std::sort(actions.begin(), actions.end(), [](const Action& a, const Action& b) { return a.start < b.start; });
+
+        // Lanes after the anvil threads' own, named "ninja job N"
+        constexpr int firstLane = 1000;
+        std::vector<long long> laneEnds;
+        for (const auto& action : actions) {
+            size_t lane = 0;
+            while (lane < laneEnds.size() && laneEnds[lane] > action.start) ++lane;
+            if (lane == laneEnds.size()) {
+                laneEnds.push_back(0);
+                tracer.name_lane(firstLane + static_cast<int>(lane), "ninja job " + std::to_string(lane + 1));
+            }
+            laneEnds[lane] = action.end;
+            tracer.complete(fs::path(action.output).filename().string(), "ninja", ninjaStart + action.start * 1000,
+                            (action.end - action.start) * 1000, firstLane + static_cast<int>(lane), { { "output", action.output } });
+        }
+    }
+
+    // Turns the event lines into a trace file, with times counted from the first event
+    inline void write_chrome_trace(const fs::path& events, const fs::path& output) {
+        std::string content;
+        read_file(events, content);
+
+        nlohmann::json list = nlohmann::json::array();
+        int64_t origin = INT64_MAX;
+        std::istringstream in(content);
+        std::string line;
+        while (std::getline(in, line)) {
+            nlohmann::json event = nlohmann::json::parse(line, nullptr, false);
+            if (event.is_discarded()) continue;
+            if (event.contains("ts")) origin = std::min(origin, event["ts"].get<int64_t>());
+            list.push_back(std::move(event));
+        }
+        for (auto& event : list) {
+            if (event.contains("ts")) event["ts"] = event["ts"].get<int64_t>() - origin;
+        }
+
+        nlohmann::json trace = { { "traceEvents", list }, { "displayTimeUnit", "ms" } };
+        write_file_atomic(output, trace.dump() + "\n");
+        std::error_code ec;
+        fs::remove(events, ec);
+    }
+}
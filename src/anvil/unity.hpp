@@ -0,0 +1,91 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <filesystem>
+#include "api.hpp"
+#include "hash.hpp"
+#include "file_util.hpp"
+
+namespace anvil {
+    namespace fs = std::filesystem;
+
+    inline bool is_unity_candidate(const std::string& src) {
+        const std::string ext = fs::path(src).extension().string();
+        return ext == ".cpp" || ext == ".cc" || ext == ".cxx";
+    }
+
+    // Groups sources into batches of about batchSize. Sources are taken in path order and a
+    // batch ends after a source whose path hash is divisible by batchSize (or once it holds
+    // twice that many), so boundaries depend on the paths themselves: adding or removing a
+    // file only changes the batch it falls into, and the other batches keep their contents.
+    inline std::vector<std::vector<std::string>> unity_batches(std::vector<std::string> sources, size_t batchSize) {
+        std::sort(sources.begin(), sources.end());
+        sources.erase(std::unique(sources.begin(), sources.end()), sources.end());
+
+        std::vector<std::vector<std::string>> batches;
+        std::vector<std::string> current;
+        for (const auto& src : sources) {
+            current.push_back(src);
+            const bool boundary = Hasher().update(src).digest() % batchSize == 0;
+            if (boundary || current.size() >= 2 * batchSize) {
+                batches.push_back(std::move(current));
+                current.clear();
+            }
+        }
+        if (!current.empty()) {
+            batches.push_back(std::move(current));
+        }
+        return batches;
+    }
+
+    // Writes the target's unity files to .anvil/generated/unity/<target> and returns what to
+    // compile instead of app.sources: one unity_<hash>.cpp per batch, named after the batch's
+    // first source so names are as stable as the batches, plus every source that is excluded
+    // or isn't C++. Unity files from earlier batchings are removed.
+    inline std::vector<std::string> generate_unity_sources(const CppApplication& app) {
+        const fs::path unityDir = fs::path(".anvil") / "generated" / "unity" / app.name;
+        const std::set<std::string> excluded(app.unity_exclude.begin(), app.unity_exclude.end());
+
+        std::vector<std::string> compiled;
+        std::vector<std::string> merged;
+        for (const auto& src : app.sources) {
+            if (is_unity_candidate(src) && !excluded.count(src) && !excluded.count(fs::path(src).generic_string())) {
+                merged.push_back(src);
+            } else {
+                compiled.push_back(src);
+            }
+        }
+
+        std::set<std::string> written;
+        for (const auto& batch : unity_batches(merged, static_cast<size_t>(app.unity_batch_size))) {
+            if (batch.size() == 1) {
+                compiled.push_back(batch.front());
+                continue;
+            }
+
+            std::string content = "// Generated by Anvil: unity batch for target " + app.name + "\n";
+            for (const auto& src : batch) {
+                content += "#include \"" + fs::absolute(src).generic_string() + "\"\n";
+            }
+
+            const std::string name = "unity_" + Hasher().update(batch.front()).hex().substr(0, 8) + ".cpp";
+            write_file_if_changed(unityDir / name, content);
+            written.insert(name);
+            compiled.push_back((unityDir / name).generic_string());
+        }
+
+        std::vector<fs::path> stale;
+        std::error_code ec;
+        for (const auto& entry : fs::directory_iterator(unityDir, ec)) {
+            if (!written.count(entry.path().filename().string())) {
+                stale.push_back(entry.path());
+            }
+        }
+        for (const auto& path : stale) {
+            fs::remove(path, ec);
+        }
+        return compiled;
+    }
+}
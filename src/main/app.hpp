@@ -8,25 +8,38 @@
 #include "run_command.hpp"
 #include "test_command.hpp"
 #include "bsp_command.hpp"
+#include "cache_command.hpp"
+#include "modules_command.hpp"
+#include "report_command.hpp"
+#include "daemon_command.hpp"
 
 namespace anvil {
     class App {
     public:
         static int run(int argc, char *argv[]) {
-            std::cerr << "[Anvil] Starting..." << std::endl;
+            // ninja shows whatever an edge prints, so the commands build.ninja runs stay quiet
+            const std::string commandName = argc > 1 ? argv[1] : "";
+            const std::string action = argc > 2 ? argv[2] : "";
+            const bool fromNinja = (commandName == "cache" && action == "compile") || (commandName == "modules" && action == "collate");
+            if (!fromNinja) {
+                std::cerr << "[Anvil] Starting..." << std::endl;
+            }
             CommandRegistry registry;
             registry.registerCommand(std::make_unique<BuildCommand>());
             registry.registerCommand(std::make_unique<CleanCommand>());
             registry.registerCommand(std::make_unique<RunCommand>());
             registry.registerCommand(std::make_unique<TestCommand>());
             registry.registerCommand(std::make_unique<BspCommand>());
+            registry.registerCommand(std::make_unique<CacheCommand>());
+            registry.registerCommand(std::make_unique<ModulesCommand>());
+            registry.registerCommand(std::make_unique<ReportCommand>());
+            registry.registerCommand(std::make_unique<DaemonCommand>());
 
             if (argc < 2) {
                 registry.printHelp();
                 return 0;
             }
 
-            const std::string commandName = argv[1];
             std::vector<std::string> args;
             for (int i = 2; i < argc; ++i) {
                 args.emplace_back(argv[i]);
@@ -1,8 +1,6 @@
 #pragma once
 #include "cli.hpp"
-#include "anvil/script_compiler.hpp"
-#include "anvil/toolchain.hpp"
-#include "process.hpp"
+#include "script_host.hpp"
 #include <filesystem>
 #include <iostream>
 #include <fstream>
@@ -53,15 +51,8 @@ namespace anvil {
                 return 1;
             }
 
-            fs::path buildDir = projectRoot / ".anvil";
             fs::path userScript = projectRoot / "build.cpp";
 
-            // Resolve include directory with fallback for development environment
-            fs::path includeDir = absExePath.parent_path().parent_path() / "include";
-            if (!fs::exists(includeDir / "anvil" / "driver.cpp")) {
-                includeDir = projectRoot / "src";
-            }
-
             // 3. Implement Auto-Repair
             if (!fs::exists(userScript)) {
                 std::cerr << "[Anvil] Repairing: 'build.cpp' not found..." << std::endl;
@@ -82,19 +73,13 @@ namespace anvil {
                 }
             }
 
-            try {
-                std::cerr << "[Anvil] Starting BSP Mode..." << std::endl;
-                ScriptCompiler compiler(includeDir, buildDir);
-                fs::path runnerExe = compiler.compile(userScript);
-
-                std::string cmd = runnerExe.string() + " --bsp";
+            std::cerr << "[Anvil] Starting BSP Mode..." << std::endl;
+            std::vector<std::string> driverArgs = args;
+            driverArgs.emplace_back("--bsp");
 
-                return std::system(cmd.c_str());
-
-            } catch (const std::exception &e) {
-                std::cerr << "Error: " << e.what() << std::endl;
-                return 1;
-            }
+            ScriptHost host(projectRoot, absExePath.string());
+            host.consume_args(driverArgs);
+            return host.run(driverArgs);
         }
     };
 }
\ No newline at end of file
@@ -1,9 +1,10 @@
 #pragma once
 #include "cli.hpp"
-#include "anvil/script_compiler.hpp"
-#include "process.hpp"
+#include "script_host.hpp"
+#include "daemon_client.hpp"
 #include <filesystem>
 #include <iostream>
+#include <algorithm>
 
 namespace fs = std::filesystem;
 
@@ -19,44 +20,17 @@ namespace anvil {
         }
 
         int execute(const std::vector<std::string> &args, const std::string &exePath) override {
-            fs::path rootDir = fs::current_path();
-            fs::path userScript = rootDir / "build.cpp";
-
-            fs::path exeDir = fs::absolute(exePath).parent_path();
-            fs::path includeDir = exeDir.parent_path() / "include";
-
-            if (!fs::exists(includeDir / "anvil" / "driver.cpp")) {
-                includeDir = rootDir / "src";
-            }
-
-            if (!fs::exists(userScript)) {
-                std::cerr << "Error: build.cpp not found." << std::endl;
-                return 1;
-            }
-
-            try {
-                std::cout << "[Anvil] Compiling Build Script..." << std::endl;
-
-                // Check for compiler override via environment variable
-                std::unique_ptr<Toolchain> toolchain;
-                const char* env_compiler = std::getenv("ANVIL_SCRIPT_COMPILER");
-                if (env_compiler && std::string(env_compiler) == "gcc") {
-                     toolchain = std::make_unique<GCCToolchain>();
-                } else {
-                     toolchain = std::make_unique<ClangToolchain>();
-                }
-
-                ScriptCompiler compiler(includeDir, rootDir / ".anvil", std::move(toolchain));
-                fs::path runner = compiler.compile(userScript);
-
-                std::cout << "[Anvil] Loading..." << std::endl;
-                exec(runner.string());
-            } catch (const std::exception &e) {
-                std::cerr << "[Anvil Error] " << e.what() << std::endl;
-                return 1;
+            std::vector<std::string> driverArgs = args;
+
+            ScriptHost host(fs::current_path(), exePath);
+            // A BSP server talks to the IDE over stdin/stdout for as long as it runs, so it
+            // never goes through the daemon, which serves one build at a time
+            const bool bsp = std::find(driverArgs.begin(), driverArgs.end(), "--bsp") != driverArgs.end();
+            if (std::optional<int> result = bsp ? std::nullopt : forward_to_daemon(driverArgs, host.executable())) {
+                return *result;
             }
-
-            return 0;
+            host.consume_args(driverArgs);
+            return host.run(driverArgs);
         }
     };
 }
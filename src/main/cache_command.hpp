@@ -0,0 +1,68 @@
+#pragma once
+#include "cli.hpp"
+#include "anvil/compile_cache.hpp"
+#include <filesystem>
+#include <iostream>
+
+namespace fs = std::filesystem;
+
+namespace anvil {
+    class CacheCommand : public Command {
+        static std::string format_size(unsigned long long bytes) {
+            if (bytes >= (1ULL << 30)) return std::to_string(bytes >> 30) + " GiB";
+            if (bytes >= (1ULL << 20)) return std::to_string(bytes >> 20) + " MiB";
+            return std::to_string(bytes >> 10) + " KiB";
+        }
+
+    public:
+        [[nodiscard]] std::string getName() const override {
+            return "cache";
+        }
+
+        [[nodiscard]] std::string getDescription() const override {
+            return "Shows (stats) or empties (clear) the compile cache";
+        }
+
+        int execute(const std::vector<std::string> &args, const std::string &exePath) override {
+            const std::string action = args.empty() ? "stats" : args[0];
+            CompileCache cache = CompileCache::open();
+
+            // build.ninja runs every compile as "anvil cache compile -- <command>"
+            if (action == "compile") {
+                size_t start = 1;
+                if (start < args.size() && args[start] == "--") ++start;
+                if (start >= args.size()) {
+                    std::cerr << "[Anvil Error] cache compile: missing compiler command" << std::endl;
+                    return 1;
+                }
+
+                try {
+                    bool hit = false;
+                    const int result = cache.compile(std::vector<std::string>(args.begin() + static_cast<long>(start), args.end()), hit);
+                    record_compile_cache_result(compile_cache_log(), hit);
+                    return result;
+                } catch (const std::exception &e) {
+                    std::cerr << "[Anvil Error] " << e.what() << std::endl;
+                    return 1;
+                }
+            }
+
+            if (action == "stats") {
+                const CompileCache::Usage usage = cache.usage();
+                std::cout << "[Anvil] Compile cache: " << cache.directory().string() << std::endl;
+                std::cout << "  Objects: " << usage.entries << std::endl;
+                std::cout << "  Size: " << format_size(usage.bytes) << " of " << format_size(cache.limit()) << std::endl;
+                return 0;
+            }
+
+            if (action == "clear") {
+                cache.clear();
+                std::cout << "[Anvil] Cleared the compile cache." << std::endl;
+                return 0;
+            }
+
+            std::cerr << "Unknown cache action: " << action << " (expected stats or clear)" << std::endl;
+            return 1;
+        }
+    };
+}
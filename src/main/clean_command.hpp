@@ -26,6 +26,11 @@ namespace anvil {
                 std::cout << "[Anvil] Cleaned build artifacts." << std::endl;
             }
 
+            // build.ninja pulls in per-target files from the build directory, so it can't outlive it
+            if (fs::exists(rootDir / "build.ninja")) {
+                fs::remove(rootDir / "build.ninja");
+            }
+
             if (fs::exists(anvilDir)) {
                 fs::remove_all(anvilDir);
                 std::cout << "[Anvil] Cleaned configuration." << std::endl;
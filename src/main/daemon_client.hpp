@@ -0,0 +1,168 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <optional>
+#include <filesystem>
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+extern char** environ;
+#endif
+
+namespace anvil {
+    namespace fs = std::filesystem;
+
+    // `anvil daemon` listens here, relative to the workspace root. Relative, because a
+    // socket path is limited to ~100 characters.
+    inline const char* daemon_socket_path() {
+        return ".anvil/daemon.sock";
+    }
+
+#ifndef _WIN32
+    inline bool write_all(int fd, const void* data, size_t size) {
+        const char* bytes = static_cast<const char*>(data);
+        while (size > 0) {
+            const ssize_t written = ::write(fd, bytes, size);
+            if (written < 0 && errno == EINTR) continue;
+            if (written <= 0) return false;
+            bytes += written;
+            size -= static_cast<size_t>(written);
+        }
+        return true;
+    }
+
+    inline bool read_all(int fd, void* data, size_t size) {
+        char* bytes = static_cast<char*>(data);
+        while (size > 0) {
+            const ssize_t got = ::read(fd, bytes, size);
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) return false;
+            bytes += got;
+            size -= static_cast<size_t>(got);
+        }
+        return true;
+    }
+
+    // Reads up to and excluding '\n'; false if the connection closed first
+    inline bool read_line(int fd, std::string& line) {
+        line.clear();
+        char c = 0;
+        while (read_all(fd, &c, 1)) {
+            if (c == '\n') return true;
+            line += c;
+        }
+        return false;
+    }
+
+    // Connects to the workspace's daemon, -1 if none is listening
+    inline int connect_daemon() {
+        const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        std::strncpy(address.sun_path, daemon_socket_path(), sizeof(address.sun_path) - 1);
+        if (::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+            ::close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    // Sends a request: a 4-byte length carrying our stdin, stdout and stderr as
+    // SCM_RIGHTS, then that many bytes of JSON. The daemon's build writes straight to
+    // the terminal the client runs in.
+    inline bool send_daemon_request(int fd, const nlohmann::json& request) {
+        const std::string payload = request.dump();
+        const uint32_t size = static_cast<uint32_t>(payload.size());
+
+        int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))] = {};
+        iovec iov{ const_cast<uint32_t*>(&size), sizeof(size) };
+        msghdr message{};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        cmsghdr* header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(fds));
+        std::memcpy(CMSG_DATA(header), fds, sizeof(fds));
+
+        ssize_t sent = 0;
+        do {
+            sent = ::sendmsg(fd, &message, 0);
+        } while (sent < 0 && errno == EINTR);
+        return sent == static_cast<ssize_t>(sizeof(size)) && write_all(fd, payload.data(), payload.size());
+    }
+
+    // The daemon's side of send_daemon_request. fds receives the client's stdin, stdout and
+    // stderr when they were passed, and is left alone otherwise. False for a short read, a
+    // body over 64 MiB or one that isn't JSON.
+    inline bool receive_daemon_request(int fd, int (&fds)[3], nlohmann::json& request) {
+        uint32_t size = 0;
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))] = {};
+        iovec iov{ &size, sizeof(size) };
+        msghdr message{};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        if (::recvmsg(fd, &message, MSG_WAITALL) != static_cast<ssize_t>(sizeof(size))) return false;
+        for (cmsghdr* header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+            if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS && header->cmsg_len == CMSG_LEN(sizeof(fds))) {
+                std::memcpy(fds, CMSG_DATA(header), sizeof(fds));
+            }
+        }
+        if (size > (64u << 20)) return false;
+        std::string body(size, '\0');
+        if (!read_all(fd, body.data(), body.size())) return false;
+        request = nlohmann::json::parse(body, nullptr, false);
+        return !request.is_discarded();
+    }
+#endif
+
+    // Runs a build, test or run through the workspace's daemon, if one is running:
+    // sends the driver arguments, the environment and the terminal, then waits for
+    // "exit <status>". Returns nothing when there is no daemon to ask, or it declined,
+    // and the command should run here. ANVIL_NO_DAEMON=1 never asks.
+    inline std::optional<int> forward_to_daemon(const std::vector<std::string>& driverArgs, const fs::path& exeFile) {
+#ifdef _WIN32
+        return std::nullopt;
+#else
+        const char* disabled = std::getenv("ANVIL_NO_DAEMON");
+        if ((disabled && *disabled && std::string(disabled) != "0") || !fs::exists(daemon_socket_path())) {
+            return std::nullopt;
+        }
+        const int fd = connect_daemon();
+        if (fd < 0) return std::nullopt;
+
+        nlohmann::json request = { { "type", "build" }, { "args", driverArgs }, { "exe", exeFile.string() },
+                                   { "cwd", fs::current_path().string() }, { "env", nlohmann::json::array() } };
+        for (char** var = environ; *var; ++var) {
+            request["env"].push_back(*var);
+        }
+
+        std::string reply;
+        const bool answered = send_daemon_request(fd, request) && read_line(fd, reply);
+        ::close(fd);
+        if (answered && reply.rfind("exit ", 0) == 0) {
+            return std::atoi(reply.c_str() + 5);
+        }
+        if (answered && reply.rfind("declined ", 0) == 0) {
+            std::cerr << "[Anvil] Daemon declined (" << reply.substr(9) << "), building without it." << std::endl;
+            return std::nullopt;
+        }
+        std::cerr << "[Anvil Error] Lost the connection to the daemon." << std::endl;
+        return 1;
+#endif
+    }
+}
@@ -0,0 +1,524 @@
+#pragma once
+#include "cli.hpp"
+#include "script_host.hpp"
+#include "daemon_client.hpp"
+#include "anvil/toolchain.hpp"
+#include <filesystem>
+#include <iostream>
+#include <optional>
+#include <deque>
+#include <map>
+#include <set>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#endif
+
+namespace fs = std::filesystem;
+
+namespace anvil {
+#ifndef _WIN32
+    // Tells the daemon when its configuration may be stale: files or directories appearing,
+    // disappearing or being renamed in the workspace (configure() may glob), and writes to
+    // anything except the project's own sources, whose edits only ninja cares about.
+    // Hidden directories (.anvil, .anvil_build, .git) and bin/ are not watched. Without
+    // inotify every build counts as a change and the configuration is checked as usual.
+    class WorkspaceWatcher {
+        int fd = -1;
+        fs::path root;
+        std::map<int, fs::path> watches;  // descriptor -> directory, relative to root
+        std::set<std::string> sources;
+        bool changed = true;
+
+        static bool ignored_directory(const fs::path& relative) {
+            const std::string name = relative.filename().string();
+            return (!name.empty() && name[0] == '.') || relative == "bin";
+        }
+
+        // build.ninja (and its temporary) is rewritten by builds themselves
+        static bool ignored_file(const fs::path& relative) {
+            return relative.generic_string().rfind("build.ninja", 0) == 0;
+        }
+
+        void watch_tree(const fs::path& relative) {
+#ifdef __linux__
+            const uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | IN_DELETE_SELF;
+            auto add = [&](const fs::path& dir) {
+                const int wd = inotify_add_watch(fd, (root / dir).c_str(), mask);
+                if (wd < 0) return false;
+                watches[wd] = dir;
+                return true;
+            };
+            if (!add(relative)) {
+                stop();
+                return;
+            }
+            std::error_code ec;
+            for (auto it = fs::recursive_directory_iterator(root / relative, ec); !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+                if (!it->is_directory(ec)) continue;
+                const fs::path dir = fs::relative(it->path(), root, ec);
+                if (ignored_directory(dir)) {
+                    it.disable_recursion_pending();
+                } else if (!add(dir)) {
+                    stop();
+                    return;
+                }
+            }
+#endif
+        }
+
+        void stop() {
+            if (fd >= 0) ::close(fd);
+            fd = -1;
+            watches.clear();
+        }
+
+    public:
+        explicit WorkspaceWatcher(fs::path workspace) : root(std::move(workspace)) {
+#ifdef __linux__
+            fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if (fd >= 0) watch_tree(".");
+#endif
+        }
+
+        ~WorkspaceWatcher() {
+            stop();
+        }
+
+        WorkspaceWatcher(const WorkspaceWatcher&) = delete;
+        WorkspaceWatcher& operator=(const WorkspaceWatcher&) = delete;
+
+        // For poll(); -1 when the workspace isn't being watched
+        [[nodiscard]] int descriptor() const {
+            return fd;
+        }
+
+        void set_sources(const Project& project) {
+            sources.clear();
+            for (const auto& target : project.targets) {
+                for (const auto& src : target.sources) sources.insert(fs::path(src).lexically_normal().generic_string());
+                for (const auto& src : target.module_sources) sources.insert(fs::path(src).lexically_normal().generic_string());
+            }
+        }
+
+        // Whether anything changed since the last call
+        bool take_changed() {
+            const bool result = changed || fd < 0;
+            changed = false;
+            return result;
+        }
+
+        void read_events() {
+#ifdef __linux__
+            alignas(inotify_event) char buffer[64 * 1024];
+            while (fd >= 0) {
+                const ssize_t size = ::read(fd, buffer, sizeof(buffer));
+                if (size <= 0) break;
+                for (ssize_t offset = 0; offset < size;) {
+                    const auto* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+                    offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+                    if (event->mask & IN_Q_OVERFLOW) {
+                        changed = true;
+                        continue;
+                    }
+                    auto dir = watches.find(event->wd);
+                    if (dir == watches.end()) continue;
+                    if (event->mask & (IN_DELETE_SELF | IN_IGNORED)) {
+                        watches.erase(dir);
+                        continue;
+                    }
+
+                    const fs::path relative = (dir->second / (event->len ? event->name : "")).lexically_normal();
+                    if (event->mask & IN_ISDIR) {
+                        if (ignored_directory(relative)) continue;
+                        if (event->mask & (IN_CREATE | IN_MOVED_TO)) watch_tree(relative);
+                        changed = true;
+                    } else if (!ignored_file(relative) && (!(event->mask & IN_CLOSE_WRITE) || !sources.count(relative.generic_string()))) {
+                        changed = true;
+                    }
+                }
+            }
+#endif
+        }
+    };
+
+    // `anvil daemon`: keeps a workspace's resolved configuration in memory and runs the
+    // builds that build/test/run forward to it over a Unix socket only its user can open.
+    // Each build is a fork of the daemon, so it starts with that state and can't corrupt
+    // it; it uses the client's terminal, environment and arguments, and its exit status
+    // is sent back. Builds run one at a time, in the order they arrive.
+    class Daemon {
+        struct Request {
+            int socket = -1;
+            int fds[3] = { -1, -1, -1 };
+            nlohmann::json body;
+        };
+
+        fs::path root;
+        std::string exePath;
+        fs::path exeFile;
+        std::string exeIdentity;
+        std::chrono::seconds idleTimeout;
+        int listener = -1;
+        std::unique_ptr<WorkspaceWatcher> watcher;
+
+        std::optional<Project> project;
+        fs::file_time_type configTime;
+        std::string projectKey;
+        std::deque<Request> queue;
+        std::optional<Request> running;
+        pid_t child = -1;
+        size_t served = 0;
+        bool stopping = false;
+        const std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point lastActivity = started;
+
+        static inline volatile sig_atomic_t terminated = 0;
+
+        static void close_request(Request& request) {
+            for (int& fd : request.fds) {
+                if (fd >= 0) ::close(fd);
+                fd = -1;
+            }
+            if (request.socket >= 0) ::close(request.socket);
+            request.socket = -1;
+        }
+
+        static void reply(Request& request, const std::string& line) {
+            write_all(request.socket, line.data(), line.size());
+        }
+
+        // Only the user the daemon runs as may hand it builds to run: a build executes the
+        // workspace's script with the daemon's rights
+        static bool trusted_peer(int socket) {
+#ifdef __linux__
+            ucred peer{};
+            socklen_t size = sizeof(peer);
+            return getsockopt(socket, SOL_SOCKET, SO_PEERCRED, &peer, &size) == 0 && peer.uid == getuid();
+#else
+            uid_t uid = 0;
+            gid_t gid = 0;
+            return getpeereid(socket, &uid, &gid) == 0 && uid == getuid();
+#endif
+        }
+
+        void apply_environment(const nlohmann::json& env) {
+            clearenv();
+            for (const auto& entry : env) {
+                const std::string var = entry.get<std::string>();
+                const size_t eq = var.find('=');
+                if (eq != std::string::npos && eq > 0) setenv(var.substr(0, eq).c_str(), var.c_str() + eq + 1, 1);
+            }
+        }
+
+        std::string status() const {
+            const auto uptime = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - started).count();
+            nlohmann::json info = { { "pid", static_cast<int>(getpid()) }, { "workspace", root.string() }, { "uptimeSeconds", uptime },
+                                    { "builds", served }, { "queued", queue.size() + (running ? 1 : 0) },
+                                    { "configuration", project ? "loaded" : "not loaded" }, { "watching", watcher->descriptor() >= 0 },
+                                    { "idleTimeoutMinutes", idleTimeout.count() / 60 } };
+            return "status " + info.dump() + "\n";
+        }
+
+        void start(Request request) {
+            const nlohmann::json& body = request.body;
+            if (body.value("cwd", "") != root.string()) {
+                reply(request, "declined it serves " + root.string() + "\n");
+                close_request(request);
+                return;
+            }
+            if (program_identity(body.value("exe", "")) != exeIdentity) {
+                // A rebuilt or different anvil: this daemon is out of date
+                reply(request, "declined anvil changed since the daemon started\n");
+                close_request(request);
+                stopping = true;
+                return;
+            }
+
+            apply_environment(body.value("env", nlohmann::json::array()));
+            std::vector<std::string> args = body.value("args", std::vector<std::string>());
+            ScriptHost host(root, exePath);
+            host.consume_args(args);
+
+            // Reloaded when something in the workspace changed, a build reconfigured or the
+            // request's environment keys a different configuration (e.g. ANVIL_SCRIPT_COMPILER)
+            std::error_code ec;
+            const auto configTimeNow = fs::last_write_time(root / ".anvil" / "config.cache", ec);
+            const std::string key = host.config_key();
+            if (watcher->take_changed() || ec || configTimeNow != configTime || key != projectKey) {
+                project = host.load_cached_project();
+                configTime = configTimeNow;
+                projectKey = key;
+                if (project) watcher->set_sources(*project);
+            }
+            if (project) host.use_project(*project);
+
+            std::cout.flush();
+            std::cerr.flush();
+            const pid_t pid = fork();
+            if (pid < 0) {
+                reply(request, "declined fork failed\n");
+                close_request(request);
+                return;
+            }
+            if (pid == 0) {
+                // The build: in its own process group so it can be interrupted as a whole
+                setpgid(0, 0);
+                signal(SIGINT, SIG_DFL);
+                signal(SIGTERM, SIG_DFL);
+                signal(SIGPIPE, SIG_DFL);
+                for (int i = 0; i < 3; ++i) {
+                    if (request.fds[i] >= 0) dup2(request.fds[i], i);
+                }
+                close_request(request);
+                for (auto& queued : queue) close_request(queued);
+                ::close(listener);
+                setenv("ANVIL_NO_DAEMON", "1", 1);
+                int code = 1;
+                try {
+                    code = host.run(args);
+                } catch (const std::exception& e) {
+                    std::cerr << "[Anvil Error] " << e.what() << std::endl;
+                }
+                std::cout.flush();
+                std::cerr.flush();
+                _exit(code);
+            }
+            setpgid(pid, pid);
+            for (int& fd : request.fds) {
+                if (fd >= 0) ::close(fd);
+                fd = -1;
+            }
+            child = pid;
+            running = std::move(request);
+        }
+
+        void accept_request() {
+            const int socket = ::accept(listener, nullptr, nullptr);
+            if (socket < 0) return;
+            fcntl(socket, F_SETFD, FD_CLOEXEC);
+            timeval timeout{ 5, 0 };
+            setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+            Request request;
+            request.socket = socket;
+            if (!trusted_peer(socket) || !receive_daemon_request(socket, request.fds, request.body)) {
+                close_request(request);
+                return;
+            }
+            const std::string type = request.body.value("type", "");
+            if (type == "build") {
+                queue.push_back(std::move(request));
+                return;
+            }
+            if (type == "status") {
+                reply(request, status());
+            } else if (type == "stop") {
+                reply(request, "stopping\n");
+                stopping = true;
+            } else {
+                reply(request, "declined unknown request\n");
+            }
+            close_request(request);
+        }
+
+        void reap(bool wait) {
+            int status = 0;
+            if (child < 0 || waitpid(child, &status, wait ? 0 : WNOHANG) != child) return;
+            const int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + (WIFSIGNALED(status) ? WTERMSIG(status) : 0);
+            if (running) {
+                reply(*running, "exit " + std::to_string(code) + "\n");
+                close_request(*running);
+                running.reset();
+            }
+            child = -1;
+            ++served;
+            lastActivity = std::chrono::steady_clock::now();
+        }
+
+    public:
+        Daemon(fs::path workspace, std::string exe, std::chrono::minutes idle)
+            : root(std::move(workspace)), exePath(std::move(exe)), idleTimeout(idle) {
+            exeFile = ScriptHost(root, exePath).executable();
+            exeIdentity = program_identity(exeFile.string());
+        }
+
+        // Binds the socket; a socket left behind by a daemon that died is replaced
+        void listen() {
+            fs::create_directories(root / ".anvil");
+            if (const int existing = connect_daemon(); existing >= 0) {
+                ::close(existing);
+                throw std::runtime_error("A daemon is already running for this workspace");
+            }
+            std::error_code ec;
+            fs::remove(daemon_socket_path(), ec);
+
+            listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            sockaddr_un address{};
+            address.sun_family = AF_UNIX;
+            std::strncpy(address.sun_path, daemon_socket_path(), sizeof(address.sun_path) - 1);
+            if (listener < 0 || ::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+                ::chmod(daemon_socket_path(), 0600) != 0 || ::listen(listener, 16) != 0) {
+                throw std::runtime_error(std::string("Could not listen on ") + daemon_socket_path() + ": " + std::strerror(errno));
+            }
+            fcntl(listener, F_SETFD, FD_CLOEXEC);
+        }
+
+        int serve() {
+            signal(SIGPIPE, SIG_IGN);
+            signal(SIGTERM, [](int) { terminated = 1; });
+            signal(SIGINT, [](int) { terminated = 1; });
+            watcher = std::make_unique<WorkspaceWatcher>(root);
+            std::cerr << "[Anvil] Daemon " << getpid() << " serving " << root.string() << (watcher->descriptor() >= 0 ? "" : " (no file watching)") << std::endl;
+
+            while (!terminated && !(stopping && !running)) {
+                int timeout = 100;
+                if (!running && queue.empty()) {
+                    const auto idle = std::chrono::steady_clock::now() - lastActivity;
+                    if (idle >= idleTimeout) {
+                        std::cerr << "[Anvil] Daemon idle for " << idleTimeout.count() / 60 << " min, exiting." << std::endl;
+                        break;
+                    }
+                    timeout = static_cast<int>(std::min<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(idleTimeout - idle).count(), 60000));
+                }
+
+                std::vector<pollfd> fds = { { listener, POLLIN, 0 } };
+                if (watcher->descriptor() >= 0) fds.push_back({ watcher->descriptor(), POLLIN, 0 });
+                if (running) fds.push_back({ running->socket, POLLIN, 0 });
+                if (::poll(fds.data(), fds.size(), timeout) < 0 && errno != EINTR) break;
+
+                watcher->read_events();
+                if (running && (fds.back().revents & (POLLIN | POLLHUP | POLLERR))) {
+                    // The client went away (e.g. Ctrl-C): stop its build
+                    killpg(child, SIGINT);
+                    reap(true);
+                }
+                reap(false);
+                if (fds[0].revents & POLLIN) accept_request();
+
+                if (!running && !queue.empty() && !stopping) {
+                    Request next = std::move(queue.front());
+                    queue.pop_front();
+                    start(std::move(next));
+                }
+            }
+
+            if (running) {
+                killpg(child, SIGTERM);
+                reap(true);
+            }
+            for (auto& request : queue) {
+                reply(request, "declined the daemon is stopping\n");
+                close_request(request);
+            }
+            ::close(listener);
+            std::error_code ec;
+            fs::remove(root / daemon_socket_path(), ec);
+            return 0;
+        }
+    };
+#endif
+
+    // anvil daemon [start|stop|status] [--foreground] [--idle-timeout=<minutes>]
+    class DaemonCommand : public Command {
+    public:
+        [[nodiscard]] std::string getName() const override {
+            return "daemon";
+        }
+
+        [[nodiscard]] std::string getDescription() const override {
+            return "Keeps the workspace's configuration warm for build, test and run (start, stop, status)";
+        }
+
+        int execute(const std::vector<std::string> &args, const std::string &exePath) override {
+#ifdef _WIN32
+            std::cerr << "[Anvil Error] The daemon is not supported on Windows." << std::endl;
+            return 1;
+#else
+            std::string action = "start";
+            bool foreground = false;
+            int idleMinutes = 30;
+            for (const auto& arg : args) {
+                if (arg == "start" || arg == "stop" || arg == "status") {
+                    action = arg;
+                } else if (arg == "--foreground") {
+                    foreground = true;
+                } else if (arg.rfind("--idle-timeout=", 0) == 0) {
+                    idleMinutes = std::max(1, std::atoi(arg.c_str() + 15));
+                } else {
+                    std::cerr << "Usage: anvil daemon [start|stop|status] [--foreground] [--idle-timeout=<minutes>]" << std::endl;
+                    return 1;
+                }
+            }
+
+            if (action == "stop" || action == "status") {
+                const int fd = connect_daemon();
+                if (fd < 0) {
+                    std::cout << "[Anvil] No daemon is running for this workspace." << std::endl;
+                    return action == "stop" ? 0 : 1;
+                }
+                std::string line;
+                const bool answered = send_daemon_request(fd, { { "type", action } }) && read_line(fd, line);
+                ::close(fd);
+                if (!answered) {
+                    std::cerr << "[Anvil Error] The daemon did not answer." << std::endl;
+                    return 1;
+                }
+                if (action == "stop") {
+                    std::cout << "[Anvil] Daemon stopping." << std::endl;
+                } else {
+                    const nlohmann::json info = nlohmann::json::parse(line.substr(7), nullptr, false);
+                    std::cout << "[Anvil] Daemon " << info.value("pid", 0) << " serving " << info.value("workspace", "") << std::endl;
+                    std::cout << "  Uptime: " << info.value("uptimeSeconds", 0) << "s, builds: " << info.value("builds", 0)
+                              << ", queued: " << info.value("queued", 0) << std::endl;
+                    std::cout << "  Configuration: " << info.value("configuration", "") << ", file watching: "
+                              << (info.value("watching", false) ? "on" : "off") << ", idle timeout: " << info.value("idleTimeoutMinutes", 0) << "m" << std::endl;
+                }
+                return 0;
+            }
+
+            try {
+                Daemon daemon(fs::current_path(), exePath, std::chrono::minutes(idleMinutes));
+                daemon.listen();
+                if (foreground) {
+                    return daemon.serve();
+                }
+
+                const pid_t pid = fork();
+                if (pid < 0) {
+                    throw std::runtime_error("fork failed");
+                }
+                if (pid == 0) {
+                    // Detached from the terminal, logging next to the socket
+                    setsid();
+                    const int null = ::open("/dev/null", O_RDONLY);
+                    const int log = ::open(".anvil/daemon.log", O_WRONLY | O_CREAT | O_APPEND, 0644);
+                    if (null >= 0) dup2(null, STDIN_FILENO);
+                    if (log >= 0) {
+                        dup2(log, STDOUT_FILENO);
+                        dup2(log, STDERR_FILENO);
+                    }
+                    _exit(daemon.serve());
+                }
+                std::cout << "[Anvil] Daemon " << pid << " started; build, test and run in this workspace now go through it. "
+                          << "It exits after " << idleMinutes << " idle minutes or on `anvil daemon stop`." << std::endl;
+                return 0;
+            } catch (const std::exception &e) {
+                std::cerr << "[Anvil Error] " << e.what() << std::endl;
+                return 1;
+            }
+#endif
+        }
+    };
+}
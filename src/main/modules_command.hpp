@@ -0,0 +1,59 @@
+#pragma once
+#include "cli.hpp"
+#include "anvil/modules.hpp"
+#include <filesystem>
+#include <iostream>
+
+namespace fs = std::filesystem;
+
+namespace anvil {
+    // Run by build.ninja once a target's sources are scanned:
+    //   anvil modules collate --format=<gcc|clang> --bmi-ext=<ext> --dyndep=<file>
+    //       --modmap=<file> --exports=<file> [--deps=<exports of a linked library>]... <scans>
+    class ModulesCommand : public Command {
+    public:
+        [[nodiscard]] std::string getName() const override {
+            return "modules";
+        }
+
+        [[nodiscard]] std::string getDescription() const override {
+            return "Collates C++ module scans (run by build.ninja)";
+        }
+
+        int execute(const std::vector<std::string> &args, const std::string &exePath) override {
+            if (args.empty() || args[0] != "collate") {
+                std::cerr << "Usage: anvil modules collate [options] <scans>" << std::endl;
+                return 1;
+            }
+
+            ModuleCollation collation;
+            for (size_t i = 1; i < args.size(); ++i) {
+                const std::string& arg = args[i];
+                auto value = [&](const std::string& option) { return arg.substr(option.size()); };
+                if (arg.rfind("--format=", 0) == 0) {
+                    collation.format = value("--format=");
+                } else if (arg.rfind("--bmi-ext=", 0) == 0) {
+                    collation.bmiExtension = value("--bmi-ext=");
+                } else if (arg.rfind("--dyndep=", 0) == 0) {
+                    collation.dyndep = value("--dyndep=");
+                } else if (arg.rfind("--modmap=", 0) == 0) {
+                    collation.modmap = value("--modmap=");
+                } else if (arg.rfind("--exports=", 0) == 0) {
+                    collation.exports = value("--exports=");
+                } else if (arg.rfind("--deps=", 0) == 0) {
+                    collation.deps.emplace_back(value("--deps="));
+                } else {
+                    collation.scans.emplace_back(arg);
+                }
+            }
+
+            try {
+                collate_modules(collation);
+                return 0;
+            } catch (const std::exception &e) {
+                std::cerr << "[Anvil Error] " << e.what() << std::endl;
+                return 1;
+            }
+        }
+    };
+}
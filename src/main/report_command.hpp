@@ -0,0 +1,135 @@
+#pragma once
+#include "cli.hpp"
+#include "anvil/build_report.hpp"
+#include <filesystem>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+namespace anvil {
+    // anvil report build [--json] [--top=<n>] [-j <jobs> | --jobs=<jobs>]
+    // Reads build.ninja and the log of the executor that built last (.ninja_log or the
+    // native .anvil_log) and reports where that build spent its time.
+    class ReportCommand : public Command {
+        static std::string seconds(int64_t ms) {
+            std::ostringstream out;
+            out << std::fixed << std::setprecision(2) << static_cast<double>(ms) / 1000.0 << "s";
+            return out.str();
+        }
+
+        static void print(const nlohmann::json& report) {
+            std::cout << "[Anvil] Build report (" << report["log"].get<std::string>() << ")" << std::endl;
+            std::cout << "  Commands: " << report["actions"].get<size_t>() << std::endl;
+            std::cout << "  Wall time: " << seconds(report["wallMs"]) << ", command time: " << seconds(report["totalMs"]) << std::endl;
+            std::cout << std::fixed << std::setprecision(1)
+                      << "  Parallelism: " << report["parallelism"].get<double>() << " of " << report["jobs"].get<int>()
+                      << " jobs (" << report["utilization"].get<double>() * 100.0 << "%)" << std::endl;
+            std::cout << "  Critical path: " << seconds(report["criticalPathMs"]) << std::endl;
+            for (const auto& step : report["criticalPath"]) {
+                std::cout << "    " << std::setw(8) << seconds(step["ms"]) << "  " << step["output"].get<std::string>()
+                          << " (" << step["target"].get<std::string>() << ")" << std::endl;
+            }
+
+            std::cout << "\n  Targets (commands, total, wall, on critical path):" << std::endl;
+            for (const auto& target : report["targets"]) {
+                std::cout << "    " << target["target"].get<std::string>() << ": " << target["actions"].get<int64_t>() << ", "
+                          << seconds(target["totalMs"]) << ", " << seconds(target["spanMs"]) << ", " << seconds(target["criticalMs"]) << std::endl;
+            }
+
+            // Compiles are named by their source, links by what they produce
+            auto list = [](const char* title, const nlohmann::json& items, const char* key) {
+                if (items.empty()) return;
+                std::cout << "\n  " << title << ":" << std::endl;
+                for (const auto& item : items) {
+                    const std::string name = item.value(key, item["output"].get<std::string>());
+                    std::cout << "    " << std::setw(8) << seconds(item["ms"]) << "  " << name << " (" << item["target"].get<std::string>() << ")" << std::endl;
+                }
+            };
+            list("Slowest compiles", report["slowestCompiles"], "input");
+            list("Slowest links", report["slowestLinks"], "output");
+
+            if (!report["splitCandidates"].empty()) {
+                std::cout << "\n  Targets that hold back their dependents on the critical path (splitting them would shorten the build):" << std::endl;
+                for (const auto& candidate : report["splitCandidates"]) {
+                    std::cout << "    " << candidate["target"].get<std::string>() << ": " << seconds(candidate["criticalMs"]) << " over "
+                              << candidate["commands"].get<size_t>() << " commands" << std::endl;
+                }
+            }
+        }
+
+    public:
+        [[nodiscard]] std::string getName() const override {
+            return "report";
+        }
+
+        [[nodiscard]] std::string getDescription() const override {
+            return "Reports the critical path and hotspots of the last build (report build [--json])";
+        }
+
+        int execute(const std::vector<std::string> &args, const std::string &exePath) override {
+            if (args.empty() || args[0] != "build") {
+                std::cerr << "Usage: anvil report build [--json] [--top=<n>] [-j <jobs>]" << std::endl;
+                return 1;
+            }
+
+            bool json = false;
+            size_t top = 10;
+            int jobs = static_cast<int>(std::thread::hardware_concurrency()) + 2;  // the default of both executors
+            for (size_t i = 1; i < args.size(); ++i) {
+                const std::string& arg = args[i];
+                if (arg == "--json") {
+                    json = true;
+                } else if (arg.rfind("--top=", 0) == 0) {
+                    top = static_cast<size_t>(std::atoi(arg.c_str() + 6));
+                } else if (arg == "-j" && i + 1 < args.size()) {
+                    jobs = std::atoi(args[++i].c_str());
+                } else if (arg.rfind("-j", 0) == 0 && arg.size() > 2) {
+                    jobs = std::atoi(arg.c_str() + 2);
+                } else if (arg.rfind("--jobs=", 0) == 0) {
+                    jobs = std::atoi(arg.c_str() + 7);
+                } else {
+                    std::cerr << "[Anvil Error] Unknown option for report build: " << arg << std::endl;
+                    return 1;
+                }
+            }
+
+            try {
+                if (!fs::exists("build.ninja")) {
+                    std::cerr << "[Anvil Error] No build.ninja here. Run anvil build first." << std::endl;
+                    return 1;
+                }
+                const BuildManifest manifest = read_build_manifest("build.ninja");
+
+                // Whichever executor wrote its log last ran the last build
+                const fs::path ninjaLog = fs::path(manifest.builddir) / ".ninja_log";
+                const fs::path nativeLog = fs::path(manifest.builddir) / ".anvil_log";
+                std::error_code ec;
+                const auto ninjaTime = fs::last_write_time(ninjaLog, ec);
+                const bool hasNinja = !ec;
+                const auto nativeTime = fs::last_write_time(nativeLog, ec);
+                const bool hasNative = !ec;
+                if (!hasNinja && !hasNative) {
+                    std::cerr << "[Anvil Error] No build log in " << manifest.builddir << ". Run anvil build first." << std::endl;
+                    return 1;
+                }
+                const bool native = hasNative && (!hasNinja || nativeTime > ninjaTime);
+                const fs::path log = native ? nativeLog : ninjaLog;
+
+                nlohmann::json report = analyze_build(manifest, native ? read_native_build_timings(log) : read_ninja_build_timings(log), jobs, top);
+                report["log"] = log.generic_string();
+                if (json) {
+                    std::cout << report.dump(2) << std::endl;
+                } else {
+                    print(report);
+                }
+                return 0;
+            } catch (const std::exception &e) {
+                std::cerr << "[Anvil Error] " << e.what() << std::endl;
+                return 1;
+            }
+        }
+    };
+}
@@ -0,0 +1,338 @@
+#pragma once
+#include "anvil/script_compiler.hpp"
+#include "anvil/driver.hpp"
+#include "anvil/hash.hpp"
+#include "anvil/fingerprint.hpp"
+#include "anvil/config_cache.hpp"
+#include "anvil/toolchain.hpp"
+#include "anvil/trace.hpp"
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+
+#ifndef _WIN32
+#include <dlfcn.h>
+#include <sys/wait.h>
+#endif
+
+namespace anvil {
+    namespace fs = std::filesystem;
+
+    // A build script compiled as a shared object. Only configure() is called, and the
+    // resulting Project holds plain data, so the library is unloaded right afterwards.
+    class ScriptModule {
+#ifndef _WIN32
+        void* handle = nullptr;
+#endif
+        using ConfigureFn = void (*)(Project&);
+        using AbiFn = unsigned long long (*)();
+        ConfigureFn configureFn = nullptr;
+
+    public:
+        // abi is the api.hpp digest the host expects; see ScriptCompiler::api_digest()
+        ScriptModule(const fs::path& library, unsigned long long abi) {
+#ifdef _WIN32
+            throw std::runtime_error("Loading build scripts in-process is not supported on Windows");
+#else
+            handle = dlopen(library.string().c_str(), RTLD_NOW | RTLD_LOCAL);
+            if (!handle) {
+                throw std::runtime_error(std::string("Failed to load build script: ") + dlerror());
+            }
+
+            auto abiFn = reinterpret_cast<AbiFn>(dlsym(handle, "anvil_script_abi"));
+            if (!abiFn || abiFn() != abi) {
+                dlclose(handle);
+                throw std::runtime_error("Build script was compiled against a different anvil/api.hpp");
+            }
+
+            configureFn = reinterpret_cast<ConfigureFn>(dlsym(handle, "configure"));
+            if (!configureFn) {
+                dlclose(handle);
+                throw std::runtime_error("Build script does not export configure()");
+            }
+#endif
+        }
+
+        ~ScriptModule() {
+#ifndef _WIN32
+            if (handle) dlclose(handle);
+#endif
+        }
+
+        ScriptModule(const ScriptModule&) = delete;
+        ScriptModule& operator=(const ScriptModule&) = delete;
+
+        void configure(Project& project) const {
+            configureFn(project);
+        }
+    };
+
+    // Compiles build.cpp and hands control to the driver, either by spawning the runner
+    // executable or, in in-process mode, by loading the script into anvil itself.
+    class ScriptHost {
+        fs::path rootDir;
+        fs::path includeDir;
+        fs::path exeFile;
+        bool inProcess = false;
+        bool reconfigure = false;
+        fs::path tracePath;
+        std::optional<Project> warmProject;  // handed over by the daemon, already validated
+
+    public:
+        ScriptHost(fs::path root, const std::string& exePath) : rootDir(std::move(root)), exeFile(current_executable(exePath)) {
+            fs::path exeDir = fs::absolute(exePath).parent_path();
+            includeDir = exeDir.parent_path() / "include";
+
+            if (!fs::exists(includeDir / "anvil" / "driver.cpp")) {
+                includeDir = rootDir / "src";
+            }
+
+            const char* mode = std::getenv("ANVIL_SCRIPT_MODE");
+            inProcess = mode && std::string(mode) == "in-process";
+        }
+
+        // Strips --in-process, --reconfigure and --trace[=<file>] from the arguments meant for the driver
+        void consume_args(std::vector<std::string>& args) {
+            auto it = std::find(args.begin(), args.end(), "--in-process");
+            if (it != args.end()) {
+                inProcess = true;
+                args.erase(it);
+            }
+            it = std::find(args.begin(), args.end(), "--reconfigure");
+            if (it != args.end()) {
+                reconfigure = true;
+                args.erase(it);
+            }
+            it = std::find_if(args.begin(), args.end(), [](const std::string& arg) { return arg == "--trace" || arg.rfind("--trace=", 0) == 0; });
+            if (it != args.end()) {
+                tracePath = *it == "--trace" ? rootDir / ".anvil_build" / "build.trace.json" : fs::path(it->substr(8));
+                args.erase(it);
+            }
+        }
+
+        [[nodiscard]] const fs::path& executable() const {
+            return exeFile;
+        }
+
+        // Everything a cached configuration depends on apart from the directory listings:
+        // the build script and what it includes (via its fingerprint), the Anvil binary
+        // whose driver resolved it, and the script compiler. Empty if the script is stale.
+        std::string config_key() const {
+            fs::path fingerprint = rootDir / ".anvil" / (inProcess ? "script_shared.fingerprint" : "script.fingerprint");
+            std::string scriptKey = read_fingerprint_key(fingerprint);
+            if (scriptKey.empty() || !fingerprint_matches(fingerprint, scriptKey)) {
+                return "";
+            }
+
+            uintmax_t size = 0;
+            long long mtime = 0;
+            if (!stat_file(exeFile, size, mtime)) {
+                return "";
+            }
+
+            const char* scriptCompiler = std::getenv("ANVIL_SCRIPT_COMPILER");
+            Hasher key;
+            key.field(fingerprint.string());
+            key.field(scriptKey);
+            key.field(exeFile.string());
+            key.field(std::to_string(size));
+            key.field(std::to_string(mtime));
+            key.field(scriptCompiler ? scriptCompiler : "");
+            return key.hex();
+        }
+
+        // The resolved configuration in .anvil/config.cache, if the build script, Anvil and
+        // the project's directory listings are unchanged since it was saved
+        std::optional<Project> load_cached_project() const {
+            return ConfigCache(rootDir / ".anvil" / "config.cache").load(config_key(), rootDir);
+        }
+
+        // Builds from project instead of loading the cached configuration, unless the
+        // arguments ask for a reconfigure
+        void use_project(Project project) {
+            warmProject = std::move(project);
+        }
+
+        int run(const std::vector<std::string>& driverArgs) {
+            if (tracePath.empty()) {
+                return run_build(driverArgs);
+            }
+
+            // Kept out of the project tree's listings, which the config cache snapshots
+            const fs::path events = rootDir / ".anvil_build" / "trace.events";
+            std::error_code ec;
+            fs::create_directories(events.parent_path(), ec);
+            Tracer& tracer = Tracer::instance();
+            tracer.open(events);
+            tracer.name_process("anvil");
+            int result = 0;
+            {
+                TraceSpan span("anvil build");
+                result = run_build(driverArgs);
+            }
+            tracer.close();
+            try {
+                write_chrome_trace(events, tracePath);
+                std::cerr << "[Anvil] Trace written to " << tracePath.string() << std::endl;
+            } catch (const std::exception& e) {
+                std::cerr << "[Anvil Error] Could not write trace: " << e.what() << std::endl;
+            }
+            return result;
+        }
+
+    private:
+        int run_build(const std::vector<std::string>& driverArgs) {
+            fs::path userScript = rootDir / "build.cpp";
+            if (!fs::exists(userScript)) {
+                std::cerr << "Error: build.cpp not found." << std::endl;
+                return 1;
+            }
+
+            try {
+#ifdef _WIN32
+                if (inProcess) {
+                    std::cerr << "[Anvil] In-process build scripts are not supported on Windows, using the runner." << std::endl;
+                    inProcess = false;
+                }
+#endif
+                // Used by the driver for build.ninja's regeneration rule
+                set_env("ANVIL_EXE", exeFile.string());
+
+                DriverOptions options = parse_driver_args(driverArgs);
+                if (!reconfigure && !options.runBsp) {
+                    std::optional<Project> project = warmProject;
+                    if (!project) {
+                        TraceSpan span("Load cached configuration");
+                        project = load_cached_project();
+                    }
+                    if (project) {
+                        std::cerr << "[Anvil] Configuration unchanged." << std::endl;
+                        if (is_anvil_source_tree(rootDir)) {
+                            TraceSpan span("Generate embedded resources");
+                            generate_embedded_resources(rootDir / ".anvil" / "libraries");
+                        }
+                        return run_driver(*project, options);
+                    }
+                }
+
+                std::cerr << "[Anvil] Compiling Build Script..." << std::endl;
+                if (inProcess) {
+                    return run_in_process(userScript, driverArgs);
+                }
+
+                ScriptCompiler compiler(includeDir, rootDir / ".anvil", make_script_toolchain());
+                fs::path runner = compiler.compile(userScript);
+
+                // The runner caches the project it resolves under this key
+                set_env("ANVIL_CONFIG_KEY", config_key());
+
+                std::cerr << "[Anvil] Loading..." << std::endl;
+
+                std::string cmd = runner.string();
+                for (const auto& arg : driverArgs) {
+                    cmd += " " + arg;
+                }
+                TraceSpan span("Run build script");
+                return exit_code(std::system(cmd.c_str()));
+            } catch (const std::exception &e) {
+                std::cerr << "[Anvil Error] " << e.what() << std::endl;
+                return 1;
+            }
+        }
+
+        static std::unique_ptr<Toolchain> make_script_toolchain() {
+            // Check for compiler override via environment variable
+            const char* env_compiler = std::getenv("ANVIL_SCRIPT_COMPILER");
+            if (env_compiler && std::string(env_compiler) == "gcc") {
+                return std::make_unique<GCCToolchain>();
+            }
+            return std::make_unique<ClangToolchain>();
+        }
+
+        static fs::path current_executable(const std::string& exePath) {
+#ifdef __linux__
+            std::error_code ec;
+            fs::path self = fs::read_symlink("/proc/self/exe", ec);
+            if (!ec) return self;
+#endif
+            fs::path path(exePath);
+            if (!path.has_parent_path()) {
+                fs::path found = find_program(exePath);
+                if (!found.empty()) return found;
+            }
+            return fs::absolute(path);
+        }
+
+        static void set_env(const char* name, const std::string& value) {
+#ifdef _WIN32
+            _putenv_s(name, value.c_str());
+#else
+            setenv(name, value.c_str(), 1);
+#endif
+        }
+
+        static int exit_code(int status) {
+#ifdef _WIN32
+            return status;
+#else
+            if (WIFEXITED(status)) return WEXITSTATUS(status);
+            return 1;
+#endif
+        }
+
+        int run_in_process(const fs::path& userScript, const std::vector<std::string>& driverArgs) {
+            std::optional<Project> project = load_project(userScript);
+            if (!project) {
+                return 1;
+            }
+
+            std::cerr << "[Anvil] Loading (in-process)..." << std::endl;
+            ProjectLoader reload = [this, userScript]() {
+                return load_project(userScript);
+            };
+            return run_driver(*project, parse_driver_args(driverArgs), reload);
+        }
+
+        // Compiles the script as a shared object, runs configure() and resolves the result.
+        // Returns nothing if any step fails, so a long-lived host can keep its previous state.
+        std::optional<Project> load_project(const fs::path& userScript) const {
+            try {
+                ScriptCompiler compiler(includeDir, rootDir / ".anvil", make_script_toolchain());
+                fs::path library = compiler.compile_shared(userScript);
+
+                // dlopen() hands back the already loaded image for a path it has seen, so each
+                // build of the script is loaded from its own content-addressed copy
+                fs::path loadDir = rootDir / ".anvil" / "loaded";
+                fs::create_directories(loadDir);
+                fs::path loaded = loadDir / ("build_script-" + hash_file(library) + ScriptCompiler::shared_library_extension());
+                fs::copy_file(library, loaded, fs::copy_options::overwrite_existing);
+
+                Project project;
+                {
+                    TraceSpan span("configure()");
+                    ScriptModule module(loaded, compiler.api_digest());
+                    module.configure(project);
+                }
+                std::error_code ec;
+                fs::remove(loaded, ec);
+
+                if (!resolve_project(project)) {
+                    return std::nullopt;
+                }
+                std::string key = config_key();
+                if (!key.empty()) {
+                    ConfigCache(rootDir / ".anvil" / "config.cache").save(project, key, rootDir);
+                }
+                return project;
+            } catch (const std::exception& e) {
+                std::cerr << "[Anvil Error] " << e.what() << std::endl;
+                return std::nullopt;
+            }
+        }
+    };
+}
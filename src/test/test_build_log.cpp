@@ -0,0 +1,260 @@
+#include "anvil/test.hpp"
+#include "anvil/build_log.hpp"
+#include "anvil/executor.hpp"
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+    anvil::BuildLog::Entry entry(uint64_t command, int64_t started, uint32_t ms) {
+        anvil::BuildLog::Entry result;
+        result.command = command;
+        result.started = started;
+        result.durationMs = ms;
+        return result;
+    }
+}
+
+class BuildLogTests : public anvil::TestSuite {
+    anvil::ScratchDirectory scratch;
+    fs::path root;
+
+    fs::path log_file() const {
+        return root / ".anvil_log";
+    }
+
+public:
+    void setup() override {
+        root = scratch.create("anvil_build_log_test");
+    }
+
+    void testRoundTrip() {
+        {
+            anvil::BuildLog log(log_file());
+            log.load();
+            log.record("obj/a.o", entry(11, 1000, 120), { "src/a.cpp", "include/common.hpp" });
+            log.record("obj/b.o", entry(22, 2000, 80), { "src/b.cpp", "include/common.hpp" });
+            log.record("bin/app", entry(33, 3000, 400), {});
+        }
+
+        anvil::BuildLog log(log_file());
+        log.load(false);
+        ANVIL_ASSERT_EQUALS(size_t(3), log.all().size());
+
+        const anvil::BuildLog::Entry* a = log.find("obj/a.o");
+        ANVIL_ASSERT(a != nullptr);
+        ANVIL_ASSERT_EQUALS(uint64_t(11), a->command);
+        ANVIL_ASSERT_EQUALS(int64_t(1000), a->started);
+        ANVIL_ASSERT_EQUALS(uint32_t(120), a->durationMs);
+        ANVIL_ASSERT_EQUALS(size_t(2), a->deps.size());
+        ANVIL_ASSERT(log.path(a->deps[0]) == "src/a.cpp");
+        ANVIL_ASSERT(log.path(a->deps[1]) == "include/common.hpp");
+
+        // Paths are stored once
+        const anvil::BuildLog::Entry* b = log.find("obj/b.o");
+        ANVIL_ASSERT(b != nullptr);
+        ANVIL_ASSERT_EQUALS(a->deps[1], b->deps[1]);
+
+        ANVIL_ASSERT(log.find("bin/app") != nullptr && log.find("bin/app")->deps.empty());
+        ANVIL_ASSERT(log.find("src/a.cpp") == nullptr);
+        ANVIL_ASSERT(log.find("bin/other") == nullptr);
+    }
+
+    void testLaterEntriesReplaceEarlierOnes() {
+        {
+            anvil::BuildLog log(log_file());
+            log.load();
+            log.record("obj/a.o", entry(1, 100, 10), { "old.hpp" });
+        }
+        {
+            anvil::BuildLog log(log_file());
+            log.load();
+            log.record("obj/a.o", entry(2, 200, 20), { "new.hpp" });
+        }
+
+        anvil::BuildLog log(log_file());
+        log.load(false);
+        const anvil::BuildLog::Entry* a = log.find("obj/a.o");
+        ANVIL_ASSERT(a != nullptr);
+        ANVIL_ASSERT_EQUALS(uint64_t(2), a->command);
+        ANVIL_ASSERT(a->deps.size() == 1 && log.path(a->deps[0]) == "new.hpp");
+    }
+
+    void testTruncatedTailIsDropped() {
+        {
+            anvil::BuildLog log(log_file());
+            log.load();
+            log.record("obj/a.o", entry(1, 100, 10), { "src/a.cpp" });
+            log.record("obj/b.o", entry(2, 200, 20), { "src/b.cpp" });
+        }
+        // A build killed while appending the second record
+        fs::resize_file(log_file(), fs::file_size(log_file()) - 3);
+
+        {
+            anvil::BuildLog log(log_file());
+            log.load();
+            ANVIL_ASSERT(log.find("obj/a.o") != nullptr);
+            ANVIL_ASSERT(log.find("obj/b.o") == nullptr);
+            log.record("obj/c.o", entry(3, 300, 30), {});
+        }
+
+        // The damaged tail was rewritten away, so what's appended after it reads back
+        anvil::BuildLog log(log_file());
+        log.load(false);
+        ANVIL_ASSERT(log.find("obj/a.o") != nullptr);
+        ANVIL_ASSERT(log.find("obj/c.o") != nullptr);
+    }
+
+    void testCompaction() {
+        {
+            anvil::BuildLog log(log_file());
+            log.load();
+            for (uint32_t i = 0; i < 1200; ++i) {
+                log.record("obj/a.o", entry(i, i, i), { "src/a.cpp" });
+            }
+            log.record("obj/b.o", entry(7, 7, 7), { "src/b.cpp" });
+        }
+        const auto grown = fs::file_size(log_file());
+
+        // Reading without appending leaves the file alone
+        {
+            anvil::BuildLog log(log_file());
+            log.load(false);
+            ANVIL_ASSERT_EQUALS(grown, fs::file_size(log_file()));
+        }
+
+        {
+            anvil::BuildLog log(log_file());
+            log.load();
+        }
+        ANVIL_ASSERT(fs::file_size(log_file()) * 100 < grown);
+
+        anvil::BuildLog log(log_file());
+        log.load(false);
+        ANVIL_ASSERT_EQUALS(size_t(2), log.all().size());
+        const anvil::BuildLog::Entry* a = log.find("obj/a.o");
+        ANVIL_ASSERT(a != nullptr);
+        ANVIL_ASSERT_EQUALS(uint64_t(1199), a->command);
+        ANVIL_ASSERT(a->deps.size() == 1 && log.path(a->deps[0]) == "src/a.cpp");
+        const anvil::BuildLog::Entry* b = log.find("obj/b.o");
+        ANVIL_ASSERT(b != nullptr && b->deps.size() == 1 && log.path(b->deps[0]) == "src/b.cpp");
+    }
+};
+
+class NativeExecutorTests : public anvil::TestSuite {
+    anvil::ScratchDirectory scratch;
+    fs::path root;
+
+    std::string path(const std::string& name) const {
+        return (root / name).generic_string();
+    }
+
+    // input.txt -> copy.txt -> final.txt; every command that runs appends its output's name to runs.txt
+    anvil::BuildGraph graph(const std::string& marker = "") const {
+        anvil::BuildGraph result;
+        result.rules["copy"].bindings = {
+            { "command", "cat $in > $out && echo $out >> " + path("runs.txt") + marker },
+            { "description", "COPY $out" },
+        };
+        result.edges.push_back({ "copy", { path("copy.txt") }, {}, { path("input.txt") }, {}, {}, {}, -1 });
+        result.edges.push_back({ "copy", { path("final.txt") }, {}, { path("copy.txt") }, {}, {}, {}, -1 });
+        return result;
+    }
+
+    int build(const anvil::BuildGraph& buildGraph) const {
+        anvil::NativeExecutor executor(buildGraph, root / ".anvil_log");
+        return executor.run(2);
+    }
+
+    size_t runs() const {
+        std::ifstream in(root / "runs.txt");
+        size_t count = 0;
+        for (std::string line; std::getline(in, line);) ++count;
+        return count;
+    }
+
+    void set_time(const std::string& name, fs::file_time_type time) const {
+        fs::last_write_time(root / name, time);
+    }
+
+public:
+    void setup() override {
+        root = scratch.create("anvil_executor_test");
+        std::ofstream(root / "input.txt") << "hello\n";
+        set_time("input.txt", fs::file_time_type::clock::now() - std::chrono::hours(1));
+    }
+
+    void testSkipsUntouchedOutputs() {
+        ANVIL_ASSERT_EQUALS(0, build(graph()));
+        ANVIL_ASSERT_EQUALS(size_t(2), runs());
+        ANVIL_ASSERT(fs::exists(root / "final.txt"));
+
+        ANVIL_ASSERT_EQUALS(0, build(graph()));
+        ANVIL_ASSERT_EQUALS(size_t(2), runs());
+    }
+
+    void testRebuildsOnNewerInput() {
+        ANVIL_ASSERT_EQUALS(0, build(graph()));
+        set_time("input.txt", fs::file_time_type::clock::now());
+        ANVIL_ASSERT_EQUALS(0, build(graph()));
+        ANVIL_ASSERT_EQUALS(size_t(4), runs());
+
+        // And is current again afterwards
+        ANVIL_ASSERT_EQUALS(0, build(graph()));
+        ANVIL_ASSERT_EQUALS(size_t(4), runs());
+    }
+
+    void testInputOlderThanLastRunDoesNotRebuild() {
+        ANVIL_ASSERT_EQUALS(0, build(graph()));
+        // e.g. a checkout restoring an older file: only modification after the command started counts
+        set_time("input.txt", fs::file_time_type::clock::now() - std::chrono::hours(2));
+        ANVIL_ASSERT_EQUALS(0, build(graph()));
+        ANVIL_ASSERT_EQUALS(size_t(2), runs());
+    }
+
+    void testRebuildsMissingOutputAndChangedCommand() {
+        ANVIL_ASSERT_EQUALS(0, build(graph()));
+
+        fs::remove(root / "final.txt");
+        ANVIL_ASSERT_EQUALS(0, build(graph()));
+        ANVIL_ASSERT_EQUALS(size_t(3), runs());
+
+        ANVIL_ASSERT_EQUALS(0, build(graph(" && true")));
+        ANVIL_ASSERT_EQUALS(size_t(5), runs());
+    }
+
+    void testUnchangedOutputDoesNotRebuildDependents() {
+        // copy.txt is only rewritten when its content differs, as with restat
+        anvil::BuildGraph restat = graph();
+        restat.rules["copy"].bindings[0].second = "cmp -s $in $out || cat $in > $out; echo $out >> " + path("runs.txt");
+        ANVIL_ASSERT_EQUALS(0, build(restat));
+        ANVIL_ASSERT_EQUALS(size_t(2), runs());
+
+        set_time("input.txt", fs::file_time_type::clock::now());
+        ANVIL_ASSERT_EQUALS(0, build(restat));
+        ANVIL_ASSERT_EQUALS(size_t(3), runs());
+    }
+
+    void testFailedCommandIsRetried() {
+        anvil::BuildGraph failing = graph();
+        failing.rules["copy"].bindings[0].second = "echo $out >> " + path("runs.txt") + " && false";
+        ANVIL_ASSERT_EQUALS(1, build(failing));
+        ANVIL_ASSERT_EQUALS(1, build(failing));
+        ANVIL_ASSERT_EQUALS(size_t(2), runs());
+    }
+};
+
+ANVIL_TEST(BuildLogTests, testRoundTrip)
+ANVIL_TEST(BuildLogTests, testLaterEntriesReplaceEarlierOnes)
+ANVIL_TEST(BuildLogTests, testTruncatedTailIsDropped)
+ANVIL_TEST(BuildLogTests, testCompaction)
+ANVIL_TEST(NativeExecutorTests, testSkipsUntouchedOutputs)
+ANVIL_TEST(NativeExecutorTests, testRebuildsOnNewerInput)
+ANVIL_TEST(NativeExecutorTests, testInputOlderThanLastRunDoesNotRebuild)
+ANVIL_TEST(NativeExecutorTests, testRebuildsMissingOutputAndChangedCommand)
+ANVIL_TEST(NativeExecutorTests, testUnchangedOutputDoesNotRebuildDependents)
+ANVIL_TEST(NativeExecutorTests, testFailedCommandIsRetried)
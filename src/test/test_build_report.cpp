@@ -0,0 +1,186 @@
+#include "anvil/test.hpp"
+#include "anvil/build_report.hpp"
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+class BuildReportTests : public anvil::TestSuite {
+    anvil::ScratchDirectory scratch;
+    fs::path root;
+
+    static anvil::ManifestEdge edge(const std::string& rule, const std::string& target, const std::string& output, std::vector<std::string> inputs) {
+        return { rule, target, { output }, std::move(inputs), "" };
+    }
+
+    // core: two compiles and an archive; app: a compile and the link against libcore.a
+    static anvil::BuildManifest manifest() {
+        anvil::BuildManifest result;
+        result.builddir = ".anvil_build/debug";
+        result.edges = {
+            edge("cxx_gcc_debug", "core", "core/a.o", { "src/core/a.cpp" }),
+            edge("cxx_gcc_debug", "core", "core/b.o", { "src/core/b.cpp" }),
+            edge("ar_gcc_debug", "core", "core/libcore.a", { "core/a.o", "core/b.o" }),
+            edge("cxx_gcc_debug", "app", "app/main.o", { "src/app/main.cpp" }),
+            edge("cxx_gcc_debug", "app", "app/unused.o", { "src/app/unused.cpp" }),
+            edge("link_gcc_debug", "app", "bin/app", { "app/main.o", "core/libcore.a" }),
+        };
+        return result;
+    }
+
+    static std::vector<anvil::ActionTiming> timings() {
+        return {
+            { "core/a.o", 0, 400 },
+            { "core/b.o", 0, 1000 },
+            { "app/main.o", 0, 300 },
+            { "core/libcore.a", 1000, 1200 },
+            { "bin/app", 1200, 1700 },
+        };
+    }
+
+    static std::vector<std::string> outputs(const nlohmann::json& list) {
+        std::vector<std::string> result;
+        for (const auto& item : list) result.push_back(item["output"].get<std::string>());
+        return result;
+    }
+
+public:
+    void setup() override {
+        root = scratch.create("anvil_build_report_test");
+    }
+
+    void testCriticalPath() {
+        const nlohmann::json report = anvil::analyze_build(manifest(), timings(), 4, 10);
+
+        ANVIL_ASSERT_EQUALS(size_t(5), report["actions"].get<size_t>());
+        ANVIL_ASSERT_EQUALS(int64_t(1700), report["wallMs"].get<int64_t>());
+        ANVIL_ASSERT_EQUALS(int64_t(2400), report["totalMs"].get<int64_t>());
+        ANVIL_ASSERT_EQUALS(int64_t(1700), report["criticalPathMs"].get<int64_t>());
+        ANVIL_ASSERT(outputs(report["criticalPath"]) == std::vector<std::string>({ "core/b.o", "core/libcore.a", "bin/app" }));
+        ANVIL_ASSERT(report["criticalPath"][1]["target"] == "core" && report["criticalPath"][1]["ms"] == 200);
+
+        const double parallelism = report["parallelism"].get<double>();
+        ANVIL_ASSERT(parallelism > 1.41 && parallelism < 1.42);
+        const double utilization = report["utilization"].get<double>();
+        ANVIL_ASSERT(utilization * 4 > parallelism - 1e-9 && utilization * 4 < parallelism + 1e-9);
+    }
+
+    void testTargets() {
+        const nlohmann::json report = anvil::analyze_build(manifest(), timings(), 4, 10);
+        const nlohmann::json& targets = report["targets"];
+        ANVIL_ASSERT_EQUALS(size_t(2), targets.size());
+
+        ANVIL_ASSERT(targets[0] == nlohmann::json({ { "target", "core" }, { "actions", 3 }, { "totalMs", 1600 }, { "spanMs", 1200 }, { "criticalMs", 1200 } }));
+        ANVIL_ASSERT(targets[1] == nlohmann::json({ { "target", "app" }, { "actions", 2 }, { "totalMs", 800 }, { "spanMs", 1700 }, { "criticalMs", 500 } }));
+    }
+
+    void testSlowestCommands() {
+        const nlohmann::json report = anvil::analyze_build(manifest(), timings(), 4, 2);
+        ANVIL_ASSERT(outputs(report["slowestCompiles"]) == std::vector<std::string>({ "core/b.o", "core/a.o" }));
+        ANVIL_ASSERT(report["slowestCompiles"][0]["input"] == "src/core/b.cpp");
+        ANVIL_ASSERT(outputs(report["slowestLinks"]) == std::vector<std::string>({ "bin/app", "core/libcore.a" }));
+    }
+
+    void testSplitCandidates() {
+        // core's compile and archive hold back app's link
+        nlohmann::json report = anvil::analyze_build(manifest(), timings(), 4, 10);
+        ANVIL_ASSERT(report["splitCandidates"] == nlohmann::json::array({ { { "target", "core" }, { "criticalMs", 1200 }, { "commands", 2 } } }));
+
+        // A single command of a target on the path isn't worth splitting
+        std::vector<anvil::ActionTiming> archiveOnly = { { "app/main.o", 0, 200 }, { "core/libcore.a", 0, 800 }, { "bin/app", 800, 1300 } };
+        report = anvil::analyze_build(manifest(), archiveOnly, 4, 10);
+        ANVIL_ASSERT(outputs(report["criticalPath"]) == std::vector<std::string>({ "core/libcore.a", "bin/app" }));
+        ANVIL_ASSERT(report["splitCandidates"].empty());
+
+        // Nor is the target the path ends in
+        std::vector<anvil::ActionTiming> linkOnly = { { "app/main.o", 0, 300 }, { "bin/app", 300, 800 } };
+        report = anvil::analyze_build(manifest(), linkOnly, 4, 10);
+        ANVIL_ASSERT(outputs(report["criticalPath"]) == std::vector<std::string>({ "app/main.o", "bin/app" }));
+        ANVIL_ASSERT(report["splitCandidates"].empty());
+    }
+
+    void testEdgeWithSeveralOutputs() {
+        anvil::BuildManifest modules = manifest();
+        modules.edges[0].outputs.push_back("core/a.gcm");
+        std::vector<anvil::ActionTiming> logged = timings();
+        logged[0] = { "core/a.o", 0, 1500 };
+        logged.push_back({ "core/a.gcm", 0, 1500 });
+        logged[3] = { "core/libcore.a", 1500, 1700 };
+        logged[4] = { "bin/app", 1700, 2200 };
+
+        const nlohmann::json report = anvil::analyze_build(modules, logged, 4, 10);
+        ANVIL_ASSERT_EQUALS(size_t(5), report["actions"].get<size_t>());
+        ANVIL_ASSERT(outputs(report["criticalPath"]) == std::vector<std::string>({ "core/a.o", "core/libcore.a", "bin/app" }));
+    }
+
+    void testEmptyBuild() {
+        const nlohmann::json report = anvil::analyze_build(manifest(), {}, 4, 10);
+        ANVIL_ASSERT_EQUALS(size_t(0), report["actions"].get<size_t>());
+        ANVIL_ASSERT(report["criticalPath"].empty() && report["targets"].empty() && report["splitCandidates"].empty());
+        ANVIL_ASSERT(report["parallelism"].get<double>() == 0.0);
+    }
+
+    void testNinjaLogKeepsTheLastRun() {
+        const fs::path log = root / ".ninja_log";
+        std::ofstream(log) << "# ninja log v5\n"
+                              "0\t500\t1\tcore/a.o\tabc\n"
+                              "0\t900\t1\tcore/b.o\tabc\n"
+                              "10\t300\t2\tapp/main.o\tdef\n"
+                              "300\t800\t2\tbin/app\tdef\n";
+        const std::vector<anvil::ActionTiming> timings = anvil::read_ninja_build_timings(log);
+        ANVIL_ASSERT_EQUALS(size_t(2), timings.size());
+        ANVIL_ASSERT(timings[0].output == "app/main.o" && timings[0].start == 10 && timings[0].end == 300);
+        ANVIL_ASSERT(timings[1].output == "bin/app");
+    }
+
+    void testNativeLogKeepsTheLastBuild() {
+        const fs::path file = root / ".anvil_log";
+        const auto base = std::chrono::floor<std::chrono::milliseconds>(fs::file_time_type::clock::now()) - std::chrono::hours(1);
+        auto record = [&](anvil::BuildLog& log, const std::string& output, std::chrono::milliseconds offset, uint32_t ms) {
+            const fs::file_time_type started = base + offset;
+            anvil::BuildLog::Entry entry;
+            entry.started = static_cast<int64_t>(started.time_since_epoch().count());
+            entry.durationMs = ms;
+            log.record(output, entry, {});
+        };
+        {
+            anvil::BuildLog log(file);
+            log.load();
+            // An earlier build
+            record(log, "old/x.o", std::chrono::milliseconds(0), 100);
+            record(log, "old/y.o", std::chrono::milliseconds(50), 100);
+            // The last one, 10s later: overlapping commands, then one after a short pause
+            record(log, "core/a.o", std::chrono::milliseconds(10000), 300);
+            record(log, "core/b.o", std::chrono::milliseconds(10200), 500);
+            record(log, "bin/app", std::chrono::milliseconds(11500), 100);
+        }
+
+        const std::vector<anvil::ActionTiming> timings = anvil::read_native_build_timings(file);
+        ANVIL_ASSERT_EQUALS(size_t(3), timings.size());
+        ANVIL_ASSERT(timings[0].output == "core/a.o" && timings[0].start == 0 && timings[0].end == 300);
+        ANVIL_ASSERT(timings[1].output == "core/b.o" && timings[1].start == 200 && timings[1].end == 700);
+        ANVIL_ASSERT(timings[2].output == "bin/app" && timings[2].start == 1500 && timings[2].end == 1600);
+
+        // Over a second after everything before it finished starts a new build
+        {
+            anvil::BuildLog log(file);
+            log.load();
+            record(log, "bin/app", std::chrono::milliseconds(11701), 100);
+        }
+        const std::vector<anvil::ActionTiming> later = anvil::read_native_build_timings(file);
+        ANVIL_ASSERT_EQUALS(size_t(1), later.size());
+        ANVIL_ASSERT(later[0].output == "bin/app" && later[0].start == 0 && later[0].end == 100);
+    }
+};
+
+ANVIL_TEST(BuildReportTests, testCriticalPath)
+ANVIL_TEST(BuildReportTests, testTargets)
+ANVIL_TEST(BuildReportTests, testSlowestCommands)
+ANVIL_TEST(BuildReportTests, testSplitCandidates)
+ANVIL_TEST(BuildReportTests, testEdgeWithSeveralOutputs)
+ANVIL_TEST(BuildReportTests, testEmptyBuild)
+ANVIL_TEST(BuildReportTests, testNinjaLogKeepsTheLastRun)
+ANVIL_TEST(BuildReportTests, testNativeLogKeepsTheLastBuild)
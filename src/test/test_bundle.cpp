@@ -0,0 +1,135 @@
+#include "anvil/test.hpp"
+#include "anvil/bundle.hpp"
+#include <string>
+
+class BundleCodecTests : public anvil::TestSuite {
+    static bool decode(const std::string& packed, std::string& output, size_t size) {
+        output.assign(size, '\0');
+        return anvil::lz::decompress(reinterpret_cast<const unsigned char*>(packed.data()), packed.size(), output.data(), output.size());
+    }
+
+    static void round_trip(const std::string& input) {
+        const std::string packed = anvil::lz::compress(input);
+        std::string output;
+        ANVIL_ASSERT(decode(packed, output, input.size()));
+        ANVIL_ASSERT(output == input);
+    }
+
+    // Deterministic bytes with no 4-byte repeats a match could use
+    static std::string noise(size_t size) {
+        std::string out;
+        uint32_t state = 0x12345678;
+        for (size_t i = 0; i < size; ++i) {
+            state = state * 1664525u + 1013904223u;
+            out += static_cast<char>(state >> 24);
+        }
+        return out;
+    }
+
+public:
+    void testEmpty() {
+        const std::string packed = anvil::lz::compress("");
+        ANVIL_ASSERT_EQUALS(size_t(1), packed.size());
+        round_trip("");
+    }
+
+    void testShorterThanMinimumMatch() {
+        round_trip("a");
+        round_trip("ab");
+        round_trip("abc");
+    }
+
+    void testLongLiteralRuns() {
+        // 15 needs one extension byte, 270 = 15 + 255 needs a 255-run and a terminator
+        round_trip(noise(15));
+        round_trip(noise(270));
+        round_trip(noise(5000));
+    }
+
+    void testLongMatchRuns() {
+        const std::string unit = noise(32);
+        std::string input;
+        for (int i = 0; i < 40; ++i) input += unit;
+        const std::string packed = anvil::lz::compress(input);
+        ANVIL_ASSERT(packed.size() < input.size() / 4);
+        round_trip(input);
+
+        // Match lengths just below and at the boundaries of the length encoding
+        for (size_t length : { size_t(18), size_t(19), size_t(270), size_t(273), size_t(274), size_t(600) }) {
+            round_trip(unit + unit.substr(0, 4) + std::string(length, 'x') + unit);
+        }
+    }
+
+    void testOverlappingMatch() {
+        // A run of one byte is a match at offset 1 that copies its own output
+        const std::string input = "ab" + std::string(1000, 'z') + "cd";
+        const std::string packed = anvil::lz::compress(input);
+        ANVIL_ASSERT(packed.size() < 32);
+        round_trip(input);
+        round_trip(std::string(300, 'q') + "abcabcabcabcabcabcabcabcabc");
+    }
+
+    void testRejectsTruncatedBlock() {
+        const std::string input = noise(100) + std::string(500, 'r') + noise(100);
+        const std::string packed = anvil::lz::compress(input);
+        ANVIL_ASSERT_EQUALS('\0', packed.back());
+        std::string output;
+        for (size_t size = 0; size + 1 < packed.size(); ++size) {
+            ANVIL_ASSERT(!decode(packed.substr(0, size), output, input.size()));
+        }
+
+        // Only the final, empty sequence can go missing without losing anything
+        ANVIL_ASSERT(decode(packed.substr(0, packed.size() - 1), output, input.size()));
+        ANVIL_ASSERT(output == input);
+    }
+
+    void testRejectsWrongSize() {
+        const std::string input = noise(64) + noise(64);
+        const std::string packed = anvil::lz::compress(input);
+        std::string output;
+        ANVIL_ASSERT(!decode(packed, output, input.size() - 1));
+        ANVIL_ASSERT(!decode(packed, output, input.size() + 1));
+    }
+
+    void testRejectsCorruptBlocks() {
+        std::string output;
+
+        // Offset 0, and an offset reaching before the start of the output
+        const std::string zeroOffset = std::string("\x10", 1) + "a" + std::string("\x00\x00", 2);
+        ANVIL_ASSERT(!decode(zeroOffset, output, 5));
+        const std::string farOffset = std::string("\x10", 1) + "a" + std::string("\x02\x00", 2);
+        ANVIL_ASSERT(!decode(farOffset, output, 5));
+
+        // Literal length running past the end of the input
+        const std::string longLiterals = std::string("\x50", 1) + "abc";
+        ANVIL_ASSERT(!decode(longLiterals, output, 5));
+
+        // Length extension that never terminates
+        const std::string openLength = std::string("\xf0\xff\xff", 3);
+        ANVIL_ASSERT(!decode(openLength, output, 600));
+
+        // Match running past the end of the output
+        const std::string longMatch = std::string("\x1f", 1) + "a" + std::string("\x01\x00\xff\x10", 4);
+        ANVIL_ASSERT(!decode(longMatch, output, 100));
+
+        // Flipping any byte of a real block must never write out of bounds; most are rejected
+        const std::string input = noise(200) + std::string(300, 'k') + noise(200);
+        const std::string packed = anvil::lz::compress(input);
+        size_t rejected = 0;
+        for (size_t i = 0; i < packed.size(); ++i) {
+            std::string corrupt = packed;
+            corrupt[i] = static_cast<char>(corrupt[i] ^ 0xff);
+            if (!decode(corrupt, output, input.size())) ++rejected;
+        }
+        ANVIL_ASSERT(rejected > 0);
+    }
+};
+
+ANVIL_TEST(BundleCodecTests, testEmpty)
+ANVIL_TEST(BundleCodecTests, testShorterThanMinimumMatch)
+ANVIL_TEST(BundleCodecTests, testLongLiteralRuns)
+ANVIL_TEST(BundleCodecTests, testLongMatchRuns)
+ANVIL_TEST(BundleCodecTests, testOverlappingMatch)
+ANVIL_TEST(BundleCodecTests, testRejectsTruncatedBlock)
+ANVIL_TEST(BundleCodecTests, testRejectsWrongSize)
+ANVIL_TEST(BundleCodecTests, testRejectsCorruptBlocks)
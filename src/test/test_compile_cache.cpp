@@ -0,0 +1,174 @@
+#include "anvil/test.hpp"
+#include "anvil/compile_cache.hpp"
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+class CompileCacheTests : public anvil::TestSuite {
+    anvil::ScratchDirectory scratch;
+    fs::path root;
+
+    // A stand-in compiler: the object is the source followed by header.hpp, and every run
+    // is counted in runs.txt
+    std::string compiler;
+
+    std::vector<std::string> command(const std::string& object, std::vector<std::string> extra = {}) const {
+        std::vector<std::string> args = { compiler, "-c", "a.cpp" };
+        args.insert(args.end(), extra.begin(), extra.end());
+        args.insert(args.end(), { "-o", object, "-MF", object.substr(0, object.size() - 2) + ".d" });
+        return args;
+    }
+
+    static std::string key(const std::vector<std::string>& args) {
+        const auto invocation = anvil::CompileCache::parse_invocation(args);
+        ANVIL_ASSERT(invocation.has_value());
+        return anvil::CompileCache::base_key(*invocation);
+    }
+
+    // A fresh cache per compile, as every compile runs its own launcher process
+    int compile(const std::string& object, bool& hit) const {
+        fs::create_directories(fs::path(object).parent_path());
+        anvil::CompileCache cache(root / "cache", 1ULL << 30);
+        return cache.compile(command(object), hit);
+    }
+
+    size_t runs() const {
+        std::ifstream in(root / "runs.txt");
+        size_t count = 0;
+        for (std::string line; std::getline(in, line);) ++count;
+        return count;
+    }
+
+    static std::string read(const fs::path& path) {
+        std::string content;
+        anvil::read_file(path, content);
+        return content;
+    }
+
+    void write_entry(const std::string& name, size_t bytes, std::chrono::hours age) const {
+        const fs::path object = root / "cache" / "objects" / name.substr(0, 2) / (name + ".o");
+        fs::create_directories(object.parent_path());
+        std::ofstream(object) << std::string(bytes, 'x');
+        fs::path diagnostics = object;
+        diagnostics.replace_extension(".stderr");
+        std::ofstream(diagnostics) << "w";
+        const auto used = fs::file_time_type::clock::now() - age;
+        fs::last_write_time(object, used);
+        fs::last_write_time(diagnostics, used);
+    }
+
+public:
+    void setup() override {
+        root = scratch.create("anvil_compile_cache_test");
+        scratch.enter();
+        compiler = (root / "cc.sh").string();
+        std::ofstream("cc.sh") << "#!/bin/sh\n"
+                                  "while [ $# -gt 0 ]; do\n"
+                                  "  case \"$1\" in -o) out=$2; shift ;; -MF) dep=$2; shift ;; -*) ;; *) src=$1 ;; esac\n"
+                                  "  shift\n"
+                                  "done\n"
+                                  "echo run >> runs.txt\n"
+                                  "cat \"$src\" header.hpp > \"$out\"\n"
+                                  "printf '%s: %s header.hpp\\n' \"$out\" \"$src\" > \"$dep\"\n";
+        fs::permissions("cc.sh", fs::perms::owner_all);
+        std::ofstream("a.cpp") << "int a() { return 1; }\n";
+        std::ofstream("header.hpp") << "#pragma once\n";
+    }
+
+    void testParseInvocation() {
+        const auto invocation = anvil::CompileCache::parse_invocation(command("obj/a.o", { "-gsplit-dwarf" }));
+        ANVIL_ASSERT(invocation.has_value());
+        ANVIL_ASSERT_EQUALS(std::string("obj/a.o"), invocation->object);
+        ANVIL_ASSERT_EQUALS(std::string("obj/a.d"), invocation->depfile);
+        ANVIL_ASSERT_EQUALS(fs::path("obj/a.dwo").string(), invocation->dwo);
+
+        // Not a compile, no depfile, or modules whose BMIs the depfile doesn't name
+        ANVIL_ASSERT(!anvil::CompileCache::parse_invocation({ compiler, "a.o", "-o", "app" }).has_value());
+        ANVIL_ASSERT(!anvil::CompileCache::parse_invocation({ compiler, "-c", "a.cpp", "-o", "a.o" }).has_value());
+        ANVIL_ASSERT(!anvil::CompileCache::parse_invocation(command("a.o", { "-fmodule-mapper=map" })).has_value());
+        ANVIL_ASSERT(!anvil::CompileCache::parse_invocation(command("a.o", { "@flags.rsp" })).has_value());
+    }
+
+    void testKeyIgnoresOutputPaths() {
+        ANVIL_ASSERT_EQUALS(key(command("one/a.o")), key(command("two/other.o")));
+        ANVIL_ASSERT(key(command("one/a.o")) != key(command("one/a.o", { "-O2" })));
+        ANVIL_ASSERT_EQUALS(anvil::Sha256::hex_size, key(command("one/a.o")).size());
+    }
+
+    void testKeyWithDebugInfo() {
+        fs::create_directories("elsewhere");
+        const std::string plain = key(command("a.o"));
+        const std::string debug = key(command("a.o", { "-g" }));
+        const std::string noDebug = key(command("a.o", { "-g0" }));
+
+        // Debug info records the working directory
+        fs::current_path("elsewhere");
+        ANVIL_ASSERT_EQUALS(plain, key(command("a.o")));
+        ANVIL_ASSERT_EQUALS(noDebug, key(command("a.o", { "-g0" })));
+        ANVIL_ASSERT(debug != key(command("a.o", { "-g" })));
+        fs::current_path(root);
+
+        // A split DWARF object names its .dwo
+        ANVIL_ASSERT_EQUALS(key(command("one/a.o", { "-g" })), key(command("two/a.o", { "-g" })));
+        ANVIL_ASSERT(key(command("one/a.o", { "-gsplit-dwarf" })) != key(command("two/a.o", { "-gsplit-dwarf" })));
+    }
+
+    void testRestoreRewritesDepfile() {
+        bool hit = true;
+        ANVIL_ASSERT_EQUALS(0, compile("one/a.o", hit));
+        ANVIL_ASSERT(!hit);
+
+        ANVIL_ASSERT_EQUALS(0, compile("two/a.o", hit));
+        ANVIL_ASSERT(hit);
+        ANVIL_ASSERT_EQUALS(size_t(1), runs());
+        ANVIL_ASSERT_EQUALS(read("one/a.o"), read("two/a.o"));
+        ANVIL_ASSERT_EQUALS(std::string("two/a.o: \\\n a.cpp \\\n header.hpp\n"), read("two/a.d"));
+        ANVIL_ASSERT(anvil::read_depfile("two/a.d") == std::vector<std::string>({ "a.cpp", "header.hpp" }));
+
+        // A changed input misses
+        std::ofstream("header.hpp") << "#pragma once\nint b();\n";
+        ANVIL_ASSERT_EQUALS(0, compile("three/a.o", hit));
+        ANVIL_ASSERT(!hit);
+        ANVIL_ASSERT_EQUALS(size_t(2), runs());
+    }
+
+    void testTimestampMacrosAreNotCached() {
+        std::ofstream("header.hpp") << "const char* built = __DATE__;\n";
+        bool hit = true;
+        ANVIL_ASSERT_EQUALS(0, compile("one/a.o", hit));
+        ANVIL_ASSERT_EQUALS(0, compile("two/a.o", hit));
+        ANVIL_ASSERT(!hit);
+        ANVIL_ASSERT_EQUALS(size_t(2), runs());
+        ANVIL_ASSERT_EQUALS(size_t(0), anvil::CompileCache(root / "cache", 1ULL << 30).usage().entries);
+    }
+
+    void testTrimEvictsLeastRecentlyUsed() {
+        write_entry("aa01", 1000, std::chrono::hours(3));
+        write_entry("bb02", 1000, std::chrono::hours(1));
+        write_entry("cc03", 1000, std::chrono::hours(2));
+
+        // Within the limit nothing goes
+        anvil::CompileCache(root / "cache", 4000).trim();
+        ANVIL_ASSERT_EQUALS(size_t(3), anvil::CompileCache(root / "cache", 4000).usage().entries);
+
+        // Over it, the oldest entries go until the store is at 90%, each with all its files
+        anvil::CompileCache cache(root / "cache", 2500);
+        cache.trim();
+        ANVIL_ASSERT_EQUALS(size_t(2), cache.usage().entries);
+        ANVIL_ASSERT(!fs::exists(root / "cache" / "objects" / "aa" / "aa01.o"));
+        ANVIL_ASSERT(!fs::exists(root / "cache" / "objects" / "aa" / "aa01.stderr"));
+        ANVIL_ASSERT(fs::exists(root / "cache" / "objects" / "bb" / "bb02.o"));
+        ANVIL_ASSERT(fs::exists(root / "cache" / "objects" / "cc" / "cc03.o"));
+    }
+};
+
+ANVIL_TEST(CompileCacheTests, testParseInvocation)
+ANVIL_TEST(CompileCacheTests, testKeyIgnoresOutputPaths)
+ANVIL_TEST(CompileCacheTests, testKeyWithDebugInfo)
+ANVIL_TEST(CompileCacheTests, testRestoreRewritesDepfile)
+ANVIL_TEST(CompileCacheTests, testTimestampMacrosAreNotCached)
+ANVIL_TEST(CompileCacheTests, testTrimEvictsLeastRecentlyUsed)
@@ -0,0 +1,162 @@
+#include "anvil/test.hpp"
+#include "anvil/config_cache.hpp"
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+namespace fs = std::filesystem;
+
+class ConfigCacheTests : public anvil::TestSuite {
+    anvil::ScratchDirectory scratch;
+    fs::path root;
+
+    fs::path cache_file() const {
+        return root / ".anvil" / "config.cache";
+    }
+
+    void touch(const std::string& relative) const {
+        fs::create_directories((root / relative).parent_path());
+        std::ofstream(root / relative) << "// " << relative << "\n";
+    }
+
+    static anvil::CppApplication full_target(const std::string& name, anvil::AppType type) {
+        anvil::CppApplication app;
+        app.name = name;
+        app.type = type;
+        app.standard = anvil::CppStandard::CPP_23;
+        app.linkage = anvil::Linkage::Dynamic;
+        app.compilerId = anvil::CompilerId::GCC;
+        app.sources = { "src/" + name + "/a.cpp", "src/" + name + "/b.cpp" };
+        app.include_dirs = { "include", ".anvil/libraries/full_deploy/host/include" };
+        app.defines = { "FEATURE=1", "NAME=\"" + name + "\"" };
+        app.link_flags = { "-lpthread", "-Wl,--as-needed" };
+        app.dependencies = { "nlohmann_json/3.11.2" };
+        app.links = { "core" };
+        app.public_include_dirs = { "src/" + name + "/public" };
+        app.public_defines = { "USES_" + name };
+        app.optimization = anvil::Optimization::MinSize;
+        app.compile_pool = "heavy";
+        app.link_pool = "link";
+        app.precompiled_header = "src/" + name + "/pch.hpp";
+        app.unity_batch_size = 12;
+        app.unity_exclude = { "src/" + name + "/b.cpp" };
+        app.module_sources = { "src/" + name + "/mod.cppm" };
+        app.import_std = true;
+        return app;
+    }
+
+    // Every field the cache stores. The legacy `application` member isn't one of them:
+    // resolution has already moved it into targets.
+    static anvil::Project full_project() {
+        anvil::Project project;
+        project.name = "demo";
+        project.version = "1.2.3";
+        project.profile = anvil::Optimization::RelWithDebInfo;
+        project.pools = { { "heavy", 2 }, { "link", 1 } };
+        project.compile_cache = false;
+        project.fast_link = false;
+        project.fast_linkers["gcc"] = { "-fuse-ld=mold", "mold 2.30.0 (compatible with GNU ld)" };
+        project.fast_linkers["clang"] = { "-fuse-ld=lld", "LLD 17.0.6" };
+        project.targets.push_back(full_target("core", anvil::AppType::StaticLibrary));
+        project.targets.push_back(full_target("app", anvil::AppType::Executable));
+        project.targets.back().optimization.reset();
+        return project;
+    }
+
+    static bool same(const anvil::CppApplication& a, const anvil::CppApplication& b) {
+        return a.name == b.name && a.type == b.type && a.standard == b.standard && a.linkage == b.linkage &&
+               a.compilerId == b.compilerId && a.sources == b.sources && a.include_dirs == b.include_dirs &&
+               a.defines == b.defines && a.link_flags == b.link_flags && a.dependencies == b.dependencies &&
+               a.links == b.links && a.public_include_dirs == b.public_include_dirs && a.public_defines == b.public_defines &&
+               a.optimization == b.optimization && a.compile_pool == b.compile_pool && a.link_pool == b.link_pool &&
+               a.precompiled_header == b.precompiled_header && a.unity_batch_size == b.unity_batch_size &&
+               a.unity_exclude == b.unity_exclude && a.module_sources == b.module_sources && a.import_std == b.import_std;
+    }
+
+    static bool same(const anvil::Project& a, const anvil::Project& b) {
+        if (a.name != b.name || a.version != b.version || a.profile != b.profile || a.pools != b.pools ||
+            a.compile_cache != b.compile_cache || a.fast_link != b.fast_link || a.fast_linkers.size() != b.fast_linkers.size() ||
+            a.targets.size() != b.targets.size()) {
+            return false;
+        }
+        for (const auto& [toolchain, linker] : a.fast_linkers) {
+            auto it = b.fast_linkers.find(toolchain);
+            if (it == b.fast_linkers.end() || it->second.flag != linker.flag || it->second.version != linker.version) return false;
+        }
+        for (size_t i = 0; i < a.targets.size(); ++i) {
+            if (!same(a.targets[i], b.targets[i])) return false;
+        }
+        return true;
+    }
+
+public:
+    void setup() override {
+        root = scratch.create("anvil_config_cache_test");
+        for (const auto& target : full_project().targets) {
+            for (const auto& src : target.sources) touch(src);
+            for (const auto& src : target.module_sources) touch(src);
+        }
+    }
+
+    void testRoundTrip() {
+        const anvil::Project project = full_project();
+        anvil::ConfigCache(cache_file()).save(project, "key-1", root);
+
+        const std::optional<anvil::Project> loaded = anvil::ConfigCache(cache_file()).load("key-1", root);
+        ANVIL_ASSERT(loaded.has_value());
+        ANVIL_ASSERT(same(project, *loaded));
+    }
+
+    void testInvalidation() {
+        const anvil::ConfigCache cache(cache_file());
+        cache.save(full_project(), "key-1", root);
+        ANVIL_ASSERT(cache.load("key-1", root).has_value());
+
+        // A different script, Anvil binary or environment
+        ANVIL_ASSERT(!cache.load("key-2", root).has_value());
+        ANVIL_ASSERT(!cache.load("", root).has_value());
+
+        // Editing a source keeps the listings, so the cache still holds
+        std::ofstream(root / "src" / "app" / "a.cpp") << "int main() { return 0; }\n";
+        ANVIL_ASSERT(cache.load("key-1", root).has_value());
+
+        // A new file where configure() globs, however deep
+        touch("src/main/c.cpp");
+        ANVIL_ASSERT(!cache.load("key-1", root).has_value());
+        cache.save(full_project(), "key-1", root);
+        touch("test/unit/d.cpp");
+        ANVIL_ASSERT(!cache.load("key-1", root).has_value());
+
+        // Saved again, then a new directory; generated and hidden entries don't count, nor
+        // do files below src/ outside src/main and src/test
+        cache.save(full_project(), "key-1", root);
+        touch("bin/app");
+        touch(".git/HEAD");
+        touch("src/app/c.cpp");
+        touch("src/app/detail/e.cpp");
+        ANVIL_ASSERT(cache.load("key-1", root).has_value());
+        fs::create_directories(root / "src" / "extra");
+        ANVIL_ASSERT(!cache.load("key-1", root).has_value());
+
+        // A source the cached configuration names has gone
+        cache.save(full_project(), "key-1", root);
+        fs::remove(root / "src" / "core" / "mod.cppm");
+        ANVIL_ASSERT(!cache.load("key-1", root).has_value());
+    }
+
+    void testRejectsCorruptCache() {
+        const anvil::ConfigCache cache(cache_file());
+        cache.save(full_project(), "key-1", root);
+        std::string data;
+        ANVIL_ASSERT(anvil::read_file(cache_file(), data));
+
+        std::ofstream(cache_file(), std::ios::binary | std::ios::trunc) << data.substr(0, data.size() - 3);
+        ANVIL_ASSERT(!cache.load("key-1", root).has_value());
+        std::ofstream(cache_file(), std::ios::binary | std::ios::trunc) << data << "x";
+        ANVIL_ASSERT(!cache.load("key-1", root).has_value());
+    }
+};
+
+ANVIL_TEST(ConfigCacheTests, testRoundTrip)
+ANVIL_TEST(ConfigCacheTests, testInvalidation)
+ANVIL_TEST(ConfigCacheTests, testRejectsCorruptCache)
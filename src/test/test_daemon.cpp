@@ -0,0 +1,133 @@
+#include "anvil/test.hpp"
+#include "main/daemon_command.hpp"
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+class DaemonTests : public anvil::TestSuite {
+    anvil::ScratchDirectory scratch;
+    int client = -1;
+    int server = -1;
+
+    static void touch(const fs::path& path, const std::string& content = "x") {
+        std::ofstream(path) << content;
+    }
+
+    static bool same_file(int a, int b) {
+        struct stat first{}, second{};
+        return fstat(a, &first) == 0 && fstat(b, &second) == 0 && first.st_dev == second.st_dev && first.st_ino == second.st_ino;
+    }
+
+    // Sends a length prefix and then body, which may be shorter than the prefix claims
+    bool receive_raw(uint32_t size, const std::string& body, nlohmann::json& request) {
+        anvil::write_all(client, &size, sizeof(size));
+        anvil::write_all(client, body.data(), body.size());
+        ::shutdown(client, SHUT_WR);
+        int fds[3] = { -1, -1, -1 };
+        return anvil::receive_daemon_request(server, fds, request);
+    }
+
+    // A fresh connection, as every request arrives on its own
+    void reconnect() {
+        if (client >= 0) ::close(client);
+        if (server >= 0) ::close(server);
+        int pair[2];
+        ANVIL_ASSERT_EQUALS(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, pair));
+        client = pair[0];
+        server = pair[1];
+    }
+
+public:
+    void setup() override {
+        reconnect();
+    }
+
+    void tearDown() override {
+        ::close(client);
+        ::close(server);
+    }
+
+    void testRequestCarriesBodyAndTerminal() {
+        const nlohmann::json sent = { { "type", "build" }, { "args", { "--profile=release" } }, { "env", { "A=b=c" } } };
+        ANVIL_ASSERT(anvil::send_daemon_request(client, sent));
+
+        int fds[3] = { -1, -1, -1 };
+        nlohmann::json received;
+        ANVIL_ASSERT(anvil::receive_daemon_request(server, fds, received));
+        ANVIL_ASSERT(received == sent);
+        for (int i = 0; i < 3; ++i) {
+            ANVIL_ASSERT(fds[i] >= 0 && fds[i] != i);
+            ANVIL_ASSERT(same_file(fds[i], i));
+            ::close(fds[i]);
+        }
+    }
+
+    void testMalformedRequestsAreRejected() {
+        nlohmann::json request;
+        ANVIL_ASSERT(receive_raw(2, "{}", request));
+
+        // Over 64 MiB, not JSON, or cut short
+        reconnect();
+        ANVIL_ASSERT(!receive_raw((64u << 20) + 1, "{}", request));
+        reconnect();
+        ANVIL_ASSERT(!receive_raw(5, "{oops", request));
+        reconnect();
+        ANVIL_ASSERT(!receive_raw(10, "{}", request));
+        reconnect();
+        ANVIL_ASSERT(!receive_raw(0, "", request));
+    }
+
+#ifdef __linux__
+    void testWatcherIgnoresSourceEditsAndBuildOutput() {
+        const fs::path root = scratch.create("anvil_daemon_test");
+        fs::create_directories(root / "src" / "main");
+        fs::create_directories(root / ".git");
+        fs::create_directories(root / "bin");
+        touch(root / "src" / "main" / "a.cpp");
+        touch(root / "README.md");
+
+        anvil::WorkspaceWatcher watcher(root);
+        ANVIL_ASSERT(watcher.descriptor() >= 0);
+        ANVIL_ASSERT(watcher.take_changed());
+        ANVIL_ASSERT(!watcher.take_changed());
+
+        anvil::Project project;
+        anvil::CppApplication app;
+        app.sources = { "./src/main/a.cpp" };
+        project.targets.push_back(app);
+        watcher.set_sources(project);
+
+        auto changed_after = [&](const std::function<void()>& action) {
+            action();
+            watcher.read_events();
+            return watcher.take_changed();
+        };
+        ANVIL_ASSERT(!changed_after([&] { touch(root / "src" / "main" / "a.cpp", "int a;"); }));
+        ANVIL_ASSERT(!changed_after([&] { touch(root / "build.ninja"); touch(root / "build.ninja.tmp"); }));
+        ANVIL_ASSERT(!changed_after([&] { touch(root / ".git" / "index"); touch(root / "bin" / "app"); }));
+        ANVIL_ASSERT(!changed_after([&] { fs::create_directories(root / ".anvil_build" / "obj"); }));
+
+        ANVIL_ASSERT(changed_after([&] { touch(root / "README.md", "changed"); }));
+        ANVIL_ASSERT(changed_after([&] { touch(root / "src" / "main" / "b.cpp"); }));
+        ANVIL_ASSERT(changed_after([&] { fs::remove(root / "src" / "main" / "a.cpp"); }));
+        ANVIL_ASSERT(changed_after([&] { fs::create_directories(root / "src" / "extra"); }));
+        // A new directory is watched too
+        ANVIL_ASSERT(changed_after([&] { touch(root / "src" / "extra" / "c.cpp"); }));
+    }
+#endif
+};
+
+ANVIL_TEST(DaemonTests, testRequestCarriesBodyAndTerminal)
+ANVIL_TEST(DaemonTests, testMalformedRequestsAreRejected)
+#ifdef __linux__
+ANVIL_TEST(DaemonTests, testWatcherIgnoresSourceEditsAndBuildOutput)
+#endif
+#endif
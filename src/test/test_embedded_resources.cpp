@@ -0,0 +1,57 @@
+#include "anvil/test.hpp"
+#include "anvil/embedded_resources.hpp"
+#include "anvil/file_util.hpp"
+#include "anvil/hash.hpp"
+#include <filesystem>
+#include <string>
+
+namespace fs = std::filesystem;
+
+// The bundle is checked in and hydrated into every project an installed anvil builds, so
+// it has to match src/anvil. Run from the repository root; `anvil build` regenerates it.
+class EmbeddedResourcesTests : public anvil::TestSuite {
+public:
+    void testBundleMatchesSources() {
+        ANVIL_ASSERT(fs::exists("src/anvil/driver.cpp"));
+        const anvil::EmbeddedBundle bundle = anvil::embedded_bundle();
+
+        for (const auto& entry : fs::directory_iterator("src/anvil")) {
+            const fs::path& path = entry.path();
+            if (path.extension() != ".hpp" && path.extension() != ".cpp") continue;
+            if (path.filename() == "embedded_resources.hpp") continue;
+
+            const std::string name = "anvil/" + path.filename().string();
+            const anvil::EmbeddedFile* file = bundle.find(name);
+            if (!file) {
+                throw anvil::TestException("Not in the embedded bundle (stale, run anvil build): " + name);
+            }
+            std::string content;
+            ANVIL_ASSERT(anvil::read_file(path, content));
+            if (file->hash != anvil::Hasher().update(content).digest()) {
+                throw anvil::TestException("Embedded copy differs from the source (stale, run anvil build): " + name);
+            }
+        }
+    }
+
+    void testBundleHasNoRemovedSources() {
+        for (const anvil::EmbeddedFile& file : anvil::embedded_bundle()) {
+            if (file.name.substr(0, 6) != "anvil/") continue;
+            if (!fs::exists(fs::path("src") / std::string(file.name))) {
+                throw anvil::TestException("Embedded file no longer exists (stale, run anvil build): " + std::string(file.name));
+            }
+        }
+    }
+
+    void testFilesExtract() {
+        const anvil::EmbeddedBundle bundle = anvil::embedded_bundle();
+        for (const anvil::EmbeddedFile& file : bundle) {
+            std::string content;
+            ANVIL_ASSERT(bundle.extract(file, content));
+            ANVIL_ASSERT_EQUALS(file.hash, anvil::Hasher().update(content).digest());
+        }
+    }
+};
+
+ANVIL_TEST(EmbeddedResourcesTests, testBundleMatchesSources)
+ANVIL_TEST(EmbeddedResourcesTests, testBundleHasNoRemovedSources)
+ANVIL_TEST(EmbeddedResourcesTests, testFilesExtract)
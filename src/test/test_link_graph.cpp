@@ -0,0 +1,122 @@
+#include "anvil/test.hpp"
+#include "anvil/link_graph.hpp"
+#include <set>
+#include <string>
+#include <vector>
+
+class LinkGraphTests : public anvil::TestSuite {
+    std::vector<anvil::CppApplication> targets;
+
+    void add(const std::string& name, anvil::AppType type, std::vector<std::string> links = {}) {
+        anvil::CppApplication app;
+        app.name = name;
+        app.type = type;
+        app.links = std::move(links);
+        targets.push_back(std::move(app));
+    }
+
+    anvil::CppApplication& target(const std::string& name) {
+        for (auto& app : targets) {
+            if (app.name == name) return app;
+        }
+        throw std::runtime_error("No target " + name);
+    }
+
+    static std::vector<std::string> names(const std::vector<const anvil::CppApplication*>& libs) {
+        std::vector<std::string> result;
+        for (const auto* lib : libs) result.push_back(lib->name);
+        return result;
+    }
+
+    std::vector<std::string> link_order(const std::string& name) {
+        const anvil::TargetIndex index = anvil::index_targets(targets);
+        return names(anvil::link_closure(index, target(name)));
+    }
+
+    bool usage_throws(const std::string& name, const std::string& expected) {
+        const anvil::TargetIndex index = anvil::index_targets(targets);
+        try {
+            anvil::usage_closure(index, target(name));
+        } catch (const std::runtime_error& e) {
+            return std::string(e.what()).find(expected) != std::string::npos;
+        }
+        return false;
+    }
+
+public:
+    void testDiamondLinksSharedBaseLast() {
+        add("base", anvil::AppType::StaticLibrary);
+        add("left", anvil::AppType::StaticLibrary, { "base" });
+        add("right", anvil::AppType::StaticLibrary, { "base" });
+        add("app", anvil::AppType::Executable, { "left", "right" });
+
+        ANVIL_ASSERT(link_order("app") == std::vector<std::string>({ "left", "right", "base" }));
+        ANVIL_ASSERT(link_order("left") == std::vector<std::string>({ "base" }));
+    }
+
+    void testSharedLibraryAbsorbsStaticOnes() {
+        add("core", anvil::AppType::SharedLibrary);
+        add("util", anvil::AppType::StaticLibrary, { "core" });
+        add("plugin", anvil::AppType::SharedLibrary, { "util" });
+        add("app", anvil::AppType::Executable, { "plugin" });
+        add("direct", anvil::AppType::Executable, { "plugin", "util" });
+
+        // util is inside libplugin.so; the shared library below it is still linked
+        ANVIL_ASSERT(link_order("app") == std::vector<std::string>({ "plugin", "core" }));
+        ANVIL_ASSERT(link_order("plugin") == std::vector<std::string>({ "util", "core" }));
+        // Linking the archive directly still needs it
+        ANVIL_ASSERT(link_order("direct") == std::vector<std::string>({ "plugin", "util", "core" }));
+    }
+
+    void testCyclesAndBadLinksAreErrors() {
+        add("a", anvil::AppType::StaticLibrary, { "b" });
+        add("b", anvil::AppType::StaticLibrary, { "c" });
+        add("c", anvil::AppType::StaticLibrary, { "a" });
+        add("app", anvil::AppType::Executable, { "a" });
+        add("self", anvil::AppType::StaticLibrary, { "self" });
+        add("tool", anvil::AppType::Executable, { "app" });
+        add("typo", anvil::AppType::Executable, { "missing" });
+
+        ANVIL_ASSERT(usage_throws("app", "Circular link dependency: c links a"));
+        ANVIL_ASSERT(usage_throws("self", "Circular link dependency: self links self"));
+        ANVIL_ASSERT(usage_throws("tool", "Target 'tool' links 'app', which is not a library of this project"));
+        ANVIL_ASSERT(usage_throws("typo", "Target 'typo' links 'missing'"));
+    }
+
+    void testPicReachesStaticLibrariesOfSharedOnes() {
+        add("deep", anvil::AppType::StaticLibrary);
+        add("util", anvil::AppType::StaticLibrary, { "deep" });
+        add("other", anvil::AppType::StaticLibrary);
+        add("plugin", anvil::AppType::SharedLibrary, { "util" });
+        add("app", anvil::AppType::Executable, { "plugin", "other" });
+
+        const anvil::TargetIndex index = anvil::index_targets(targets);
+        const std::set<std::string> pic = anvil::position_independent_targets(index, targets);
+        ANVIL_ASSERT(pic == std::set<std::string>({ "plugin", "util", "deep" }));
+    }
+
+    void testUsageRequirementsFollowTheClosure() {
+        add("base", anvil::AppType::StaticLibrary);
+        target("base").include_dirs = { "src/base/private" };
+        target("base").defines = { "BASE_INTERNAL" };
+        target("base").public_include_dirs = { "src/base/include" };
+        target("base").public_defines = { "USE_BASE" };
+        add("net", anvil::AppType::SharedLibrary, { "base" });
+        target("net").public_include_dirs = { "src/net/include", "src/base/include" };
+        add("app", anvil::AppType::Executable, { "net" });
+        target("app").include_dirs = { "src/app", "deps/include" };
+        target("app").defines = { "APP" };
+
+        const anvil::TargetIndex index = anvil::index_targets(targets);
+        const anvil::UsageRequirements usage = anvil::usage_requirements(target("app"), anvil::usage_closure(index, target("app")));
+        // Other targets' private dirs and defines stay theirs; a dir reached twice is listed once
+        ANVIL_ASSERT(usage.include_dirs == std::vector<std::string>({ "src/app", "deps/include", "src/net/include", "src/base/include" }));
+        ANVIL_ASSERT(usage.defines == std::vector<std::string>({ "APP", "USE_BASE" }));
+    }
+};
+
+ANVIL_TEST(LinkGraphTests, testDiamondLinksSharedBaseLast)
+ANVIL_TEST(LinkGraphTests, testSharedLibraryAbsorbsStaticOnes)
+ANVIL_TEST(LinkGraphTests, testCyclesAndBadLinksAreErrors)
+ANVIL_TEST(LinkGraphTests, testPicReachesStaticLibrariesOfSharedOnes)
+ANVIL_TEST(LinkGraphTests, testUsageRequirementsFollowTheClosure)
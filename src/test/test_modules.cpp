@@ -0,0 +1,152 @@
+#include "anvil/test.hpp"
+#include "anvil/modules.hpp"
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+class ModuleCollationTests : public anvil::TestSuite {
+    anvil::ScratchDirectory scratch;
+    fs::path root;
+
+    // A scan as GCC writes it with -fdeps-format=p1689r5
+    fs::path scan(const std::string& name, const std::string& object, const std::string& provides, const std::vector<std::string>& imports) const {
+        nlohmann::json rule = { { "primary-output", object } };
+        if (!provides.empty()) {
+            rule["provides"] = { { { "logical-name", provides }, { "is-interface", true } } };
+        }
+        for (const auto& imported : imports) {
+            rule["requires"].push_back({ { "logical-name", imported } });
+        }
+        const fs::path path = root / (name + ".ddi");
+        std::ofstream(path) << nlohmann::json({ { "version", 0 }, { "revision", 0 }, { "rules", { rule } } }).dump(2);
+        return path;
+    }
+
+    anvil::ModuleCollation collation(const std::string& format, std::vector<fs::path> scans) const {
+        anvil::ModuleCollation result;
+        result.format = format;
+        result.bmiExtension = format == "gcc" ? ".gcm" : ".pcm";
+        result.dyndep = root / "modules.dd";
+        result.modmap = root / "modules.modmap";
+        result.exports = root / "modules.json";
+        result.scans = std::move(scans);
+        return result;
+    }
+
+    std::string read(const std::string& name) const {
+        std::string content;
+        ANVIL_ASSERT(anvil::read_file(root / name, content));
+        return content;
+    }
+
+    static bool throws(const anvil::ModuleCollation& collation, const std::string& expected) {
+        try {
+            anvil::collate_modules(collation);
+        } catch (const std::runtime_error& e) {
+            return std::string(e.what()).find(expected) != std::string::npos;
+        }
+        return false;
+    }
+
+public:
+    void setup() override {
+        root = scratch.create("anvil_modules_test");
+    }
+
+    void testGccOutputs() {
+        anvil::collate_modules(collation("gcc", {
+            scan("math", "obj/math.cppm.o", "math", { "math:detail" }),
+            scan("detail", "obj/detail.cppm.o", "math:detail", {}),
+            scan("main", "obj/main.cpp.o", "", { "math" }),
+        }));
+
+        ANVIL_ASSERT_EQUALS(std::string(
+            "ninja_dyndep_version = 1\n\n"
+            "build obj/math.cppm.o | obj/math.cppm.gcm: dyndep | obj/detail.cppm.gcm\n\n"
+            "build obj/detail.cppm.o | obj/detail.cppm.gcm: dyndep\n\n"
+            "build obj/main.cpp.o: dyndep | obj/math.cppm.gcm\n\n"), read("modules.dd"));
+        ANVIL_ASSERT_EQUALS(std::string(
+            "$root .\n"
+            "math obj/math.cppm.gcm\n"
+            "math:detail obj/detail.cppm.gcm\n"), read("modules.modmap"));
+
+        const nlohmann::json exports = nlohmann::json::parse(read("modules.json"));
+        ANVIL_ASSERT(exports == nlohmann::json({ { "math", "obj/math.cppm.gcm" }, { "math:detail", "obj/detail.cppm.gcm" } }));
+    }
+
+    void testClangModmapAndEscaping() {
+        anvil::collate_modules(collation("clang", {
+            scan("geo", "obj dir/geo.cppm.o", "geo", {}),
+        }));
+        ANVIL_ASSERT_EQUALS(std::string(
+            "ninja_dyndep_version = 1\n\n"
+            "build obj$ dir/geo.cppm.o | obj$ dir/geo.cppm.pcm: dyndep\n\n"), read("modules.dd"));
+        ANVIL_ASSERT_EQUALS(std::string("-fmodule-file=geo=obj dir/geo.cppm.pcm\n"), read("modules.modmap"));
+    }
+
+    void testImportsFromLinkedLibraries() {
+        const fs::path libraryExports = root / "lib.json";
+        std::ofstream(libraryExports) << R"({ "base": "lib/base.cppm.gcm" })";
+
+        anvil::ModuleCollation target = collation("gcc", {
+            scan("app", "obj/app.cppm.o", "app", { "base" }),
+        });
+        target.deps = { libraryExports };
+        anvil::collate_modules(target);
+
+        ANVIL_ASSERT(read("modules.dd").find("build obj/app.cppm.o | obj/app.cppm.gcm: dyndep | lib/base.cppm.gcm\n") != std::string::npos);
+        ANVIL_ASSERT(read("modules.modmap").find("base lib/base.cppm.gcm\n") != std::string::npos);
+        // Only what the target itself provides is exported to its dependents
+        ANVIL_ASSERT(nlohmann::json::parse(read("modules.json")) == nlohmann::json({ { "app", "obj/app.cppm.gcm" } }));
+    }
+
+    void testUnchangedOutputsAreNotRewritten() {
+        const anvil::ModuleCollation target = collation("gcc", {
+            scan("math", "obj/math.cppm.o", "math", {}),
+        });
+        anvil::collate_modules(target);
+        const auto written = fs::last_write_time(root / "modules.dd");
+        fs::last_write_time(root / "modules.dd", written - std::chrono::hours(1));
+        anvil::collate_modules(target);
+        ANVIL_ASSERT(fs::last_write_time(root / "modules.dd") == written - std::chrono::hours(1));
+    }
+
+    void testModuleProvidedTwice() {
+        ANVIL_ASSERT(throws(collation("gcc", {
+            scan("a", "obj/a.cppm.o", "shapes", {}),
+            scan("b", "obj/b.cppm.o", "shapes", {}),
+        }), "Module 'shapes' is provided by both obj/a.cppm.gcm and obj/b.cppm.gcm"));
+    }
+
+    void testMissingImport() {
+        ANVIL_ASSERT(throws(collation("gcc", {
+            scan("main", "obj/main.cpp.o", "", { "nowhere" }),
+        }), "Module 'nowhere' imported by obj/main.cpp.o is not provided"));
+        ANVIL_ASSERT(!fs::exists(root / "modules.dd"));
+    }
+
+    void testSelfImport() {
+        ANVIL_ASSERT(throws(collation("gcc", {
+            scan("loop", "obj/loop.cppm.o", "loop", { "loop" }),
+        }), "Module 'loop' imports itself in obj/loop.cppm.o"));
+    }
+
+    void testMalformedScan() {
+        const fs::path path = root / "broken.ddi";
+        std::ofstream(path) << R"({ "rules": [ { "provides": [] } ] })";
+        ANVIL_ASSERT(throws(collation("gcc", { path }), "Malformed module scan"));
+    }
+};
+
+ANVIL_TEST(ModuleCollationTests, testGccOutputs)
+ANVIL_TEST(ModuleCollationTests, testClangModmapAndEscaping)
+ANVIL_TEST(ModuleCollationTests, testImportsFromLinkedLibraries)
+ANVIL_TEST(ModuleCollationTests, testUnchangedOutputsAreNotRewritten)
+ANVIL_TEST(ModuleCollationTests, testModuleProvidedTwice)
+ANVIL_TEST(ModuleCollationTests, testMissingImport)
+ANVIL_TEST(ModuleCollationTests, testSelfImport)
+ANVIL_TEST(ModuleCollationTests, testMalformedScan)
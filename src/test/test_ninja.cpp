@@ -0,0 +1,201 @@
+#include "anvil/test.hpp"
+#include "anvil/ninja.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+class NinjaWriterTests : public anvil::TestSuite {
+    anvil::ScratchDirectory scratch;
+
+    // What package resolution appends to every target
+    static constexpr const char* fmt_include = ".anvil/libraries/full_deploy/host/fmt/10.2.1/Release/x86_64/include";
+    static constexpr const char* json_include = ".anvil/libraries/full_deploy/host/nlohmann_json/3.11.2/Release/x86_64/include";
+
+    static anvil::CppApplication target(const std::string& name, anvil::AppType type, std::vector<std::string> sources) {
+        anvil::CppApplication app;
+        app.name = name;
+        app.type = type;
+        app.compilerId = anvil::CompilerId::GCC;
+        app.sources = std::move(sources);
+        return app;
+    }
+
+    static anvil::BuildGraph generate(const anvil::Project& project) {
+        anvil::NinjaWriter writer("build.ninja");
+        writer.set_module_collator("anvil modules collate");
+        writer.generate(project);
+        return writer.build_graph();
+    }
+
+    static std::string variable(const anvil::Bindings& bindings, const std::string& name) {
+        for (const auto& [key, value] : bindings) {
+            if (key == name) return value;
+        }
+        return "";
+    }
+
+    // An edge's path as ninja sees it; objdir itself refers to $builddir
+    static std::string resolve(const anvil::BuildGraph& graph, const anvil::BuildEdge& edge, const std::string& path) {
+        return anvil::expand_ninja(path, [&](const std::string& name) {
+            const std::string value = edge.scope >= 0 ? variable(graph.scopes[edge.scope], name) : "";
+            return value.empty() ? variable(graph.globals, name) : resolve(graph, anvil::BuildEdge{}, value);
+        });
+    }
+
+    // The objects compiled from source, resolved
+    static std::vector<std::string> objects_of(const anvil::BuildGraph& graph, const std::string& source) {
+        std::vector<std::string> objects;
+        for (const auto& edge : graph.edges) {
+            if (edge.rule.rfind("cxx_", 0) == 0 && edge.inputs == std::vector<std::string>({ source })) {
+                objects.push_back(resolve(graph, edge, edge.outputs[0]));
+            }
+        }
+        return objects;
+    }
+
+    static std::vector<std::string> link_inputs(const anvil::BuildGraph& graph, const std::string& binary) {
+        for (const auto& edge : graph.edges) {
+            if (edge.rule.rfind("link_", 0) == 0 && resolve(graph, edge, edge.outputs[0]).find(binary) != std::string::npos) {
+                std::vector<std::string> inputs;
+                for (const auto& input : edge.inputs) inputs.push_back(resolve(graph, edge, input));
+                return inputs;
+            }
+        }
+        return {};
+    }
+
+    static bool links(const anvil::BuildGraph& graph, const std::string& binary, const std::string& object) {
+        const std::vector<std::string> inputs = link_inputs(graph, binary);
+        return std::find(inputs.begin(), inputs.end(), object) != inputs.end();
+    }
+
+public:
+    void setup() override {
+        scratch.create("anvil_ninja_test");
+        scratch.enter();
+    }
+
+    void testDependencyIncludesAreInterned() {
+        anvil::Project project;
+        project.targets.push_back(target("app", anvil::AppType::Executable, { "src/app/main.cpp" }));
+        project.targets.back().include_dirs = { "src/app", fmt_include, json_include };
+        project.targets.push_back(target("tests", anvil::AppType::Executable, { "src/test/main.cpp" }));
+        project.targets.back().include_dirs = { "src/test", fmt_include, json_include };
+
+        const anvil::BuildGraph graph = generate(project);
+        const std::string deps = "-I" + std::string(fmt_include) + " -I" + json_include;
+        ANVIL_ASSERT_EQUALS(deps, variable(graph.globals, "shared_0"));
+        ANVIL_ASSERT_EQUALS(std::string(" -Isrc/app $shared_0"), variable(graph.scopes[0], "INCLUDES"));
+        ANVIL_ASSERT_EQUALS(std::string(" -Isrc/test $shared_0"), variable(graph.scopes[1], "INCLUDES"));
+
+        std::string manifest;
+        ANVIL_ASSERT(anvil::read_file("build.ninja", manifest));
+        ANVIL_ASSERT(manifest.find("shared_0 = " + deps + "\n") != std::string::npos);
+        std::string scope;
+        ANVIL_ASSERT(anvil::read_file(".anvil_build/debug/tests.ninja", scope));
+        ANVIL_ASSERT(scope.find("INCLUDES =  -Isrc/test $shared_0\n") != std::string::npos);
+    }
+
+    void testSharedRunsSplitWhereTargetsDiffer() {
+        anvil::Project project;
+        project.targets.push_back(target("core", anvil::AppType::StaticLibrary, { "src/core/a.cpp" }));
+        project.targets.back().include_dirs = { fmt_include, json_include };
+        project.targets.back().public_include_dirs = { "src/core/include" };
+        project.targets.push_back(target("app", anvil::AppType::Executable, { "src/app/main.cpp" }));
+        project.targets.back().include_dirs = { fmt_include, json_include };
+        project.targets.back().links = { "core" };
+
+        // Both get the dependency dirs; core's public dir follows them in both, so it joins the run
+        const anvil::BuildGraph graph = generate(project);
+        const std::string shared = "-I" + std::string(fmt_include) + " -I" + json_include + " -Isrc/core/include";
+        ANVIL_ASSERT_EQUALS(shared, variable(graph.globals, "shared_0"));
+        ANVIL_ASSERT_EQUALS(std::string(" $shared_0"), variable(graph.scopes[0], "INCLUDES"));
+        ANVIL_ASSERT_EQUALS(std::string(" $shared_0"), variable(graph.scopes[1], "INCLUDES"));
+
+        // A third target without core's dir splits the run where their lists part
+        project.targets.push_back(target("tool", anvil::AppType::Executable, { "src/tool/main.cpp" }));
+        project.targets.back().include_dirs = { fmt_include, json_include };
+        const anvil::BuildGraph split = generate(project);
+        ANVIL_ASSERT_EQUALS("-I" + std::string(fmt_include) + " -I" + json_include, variable(split.globals, "shared_0"));
+        ANVIL_ASSERT_EQUALS(std::string(" $shared_0 -Isrc/core/include"), variable(split.scopes[0], "INCLUDES"));
+        ANVIL_ASSERT_EQUALS(std::string(" $shared_0"), variable(split.scopes[2], "INCLUDES"));
+    }
+
+    void testRequiredVersionFollowsFeatures() {
+        auto required = []() {
+            std::string manifest;
+            anvil::read_file("build.ninja", manifest);
+            return manifest.substr(0, manifest.find('\n'));
+        };
+
+        anvil::Project project;
+        project.targets.push_back(target("app", anvil::AppType::Executable, { "src/app/main.cpp" }));
+        generate(project);
+        ANVIL_ASSERT_EQUALS(std::string("ninja_required_version = 1.3"), required());
+
+        project.targets.back().link_pool = "console";
+        generate(project);
+        ANVIL_ASSERT_EQUALS(std::string("ninja_required_version = 1.5"), required());
+
+        // Modules bring in dyndep
+        project.targets.back().module_sources = { "src/app/math.cppm" };
+        generate(project);
+        ANVIL_ASSERT_EQUALS(std::string("ninja_required_version = 1.10"), required());
+    }
+
+    void testIdenticalCompilesShareOneObject() {
+        anvil::Project project;
+        for (const std::string name : { "app", "tool" }) {
+            project.targets.push_back(target(name, anvil::AppType::Executable, { "src/common/util.cpp", "src/" + name + "/main.cpp" }));
+            project.targets.back().include_dirs = { "src/common", fmt_include };
+            project.targets.back().defines = { "COMMON=1" };
+        }
+
+        const anvil::BuildGraph graph = generate(project);
+        const std::vector<std::string> util = objects_of(graph, "src/common/util.cpp");
+        ANVIL_ASSERT_EQUALS(size_t(1), util.size());
+        ANVIL_ASSERT(links(graph, "app", util[0]));
+        ANVIL_ASSERT(links(graph, "tool", util[0]));
+        ANVIL_ASSERT_EQUALS(size_t(1), objects_of(graph, "src/tool/main.cpp").size());
+
+        // A different define is a different object
+        project.targets.back().defines = { "COMMON=2" };
+        ANVIL_ASSERT_EQUALS(size_t(2), objects_of(generate(project), "src/common/util.cpp").size());
+    }
+
+    void testPchAndModuleTargetsNeverShareObjects() {
+        anvil::Project project;
+        for (const std::string name : { "pch", "mod", "app", "tool" }) {
+            project.targets.push_back(target(name, anvil::AppType::Executable, { "src/common/util.cpp" }));
+            project.targets.back().include_dirs = { "src/common" };
+        }
+        project.targets[0].precompiled_header = "src/common/pch.hpp";
+        project.targets[1].module_sources = { "src/mod/math.cppm" };
+
+        // pch and mod each compile their own; app compiles it for itself and tool
+        const anvil::BuildGraph graph = generate(project);
+        const std::vector<std::string> util = objects_of(graph, "src/common/util.cpp");
+        ANVIL_ASSERT_EQUALS(size_t(3), util.size());
+        ANVIL_ASSERT(links(graph, "pch", util[0]));
+        ANVIL_ASSERT(links(graph, "mod", util[1]));
+        ANVIL_ASSERT(links(graph, "app", util[2]));
+        ANVIL_ASSERT(links(graph, "tool", util[2]));
+        ANVIL_ASSERT(util[0] != util[2] && util[1] != util[2]);
+
+        // Nor does a second target with the same PCH or modules reuse theirs
+        project.targets.push_back(project.targets[0]);
+        project.targets.back().name = "pch2";
+        project.targets.push_back(project.targets[1]);
+        project.targets.back().name = "mod2";
+        ANVIL_ASSERT_EQUALS(size_t(5), objects_of(generate(project), "src/common/util.cpp").size());
+    }
+};
+
+ANVIL_TEST(NinjaWriterTests, testDependencyIncludesAreInterned)
+ANVIL_TEST(NinjaWriterTests, testSharedRunsSplitWhereTargetsDiffer)
+ANVIL_TEST(NinjaWriterTests, testRequiredVersionFollowsFeatures)
+ANVIL_TEST(NinjaWriterTests, testIdenticalCompilesShareOneObject)
+ANVIL_TEST(NinjaWriterTests, testPchAndModuleTargetsNeverShareObjects)
@@ -0,0 +1,126 @@
+#include "anvil/test.hpp"
+#include "anvil/unity.hpp"
+#include <algorithm>
+#include <set>
+#include <string>
+#include <vector>
+
+class UnityBatchTests : public anvil::TestSuite {
+    using Batches = std::vector<std::vector<std::string>>;
+
+    static std::vector<std::string> sources(size_t count) {
+        std::vector<std::string> out;
+        for (size_t i = 0; i < count; ++i) {
+            out.push_back("src/part_" + std::to_string(1000 + i) + ".cpp");
+        }
+        return out;
+    }
+
+    static bool contains(const std::vector<std::string>& batch, const std::string& src) {
+        return std::find(batch.begin(), batch.end(), src) != batch.end();
+    }
+
+    // Batches of after that aren't in before
+    static size_t changed(const Batches& before, const Batches& after) {
+        const std::set<std::vector<std::string>> old(before.begin(), before.end());
+        return static_cast<size_t>(std::count_if(after.begin(), after.end(), [&](const auto& batch) { return !old.count(batch); }));
+    }
+
+    static bool is_boundary(const std::string& src, size_t batchSize) {
+        return anvil::Hasher().update(src).digest() % batchSize == 0;
+    }
+
+public:
+    void testOrderAndDuplicatesDontMatter() {
+        std::vector<std::string> input = sources(40);
+        const Batches expected = anvil::unity_batches(input, 4);
+        std::reverse(input.begin(), input.end());
+        input.push_back(input.front());
+        ANVIL_ASSERT(anvil::unity_batches(input, 4) == expected);
+    }
+
+    void testAddingSourceOnlyChangesItsBatch() {
+        constexpr size_t batchSize = 4;
+        const std::vector<std::string> base = sources(60);
+        const Batches before = anvil::unity_batches(base, batchSize);
+        // So that one more file can't reach the size cap and push files into the next batch
+        for (const auto& batch : before) {
+            ANVIL_ASSERT(batch.size() + 1 < 2 * batchSize);
+        }
+
+        size_t boundaries = 0;
+        for (size_t i = 0; i < 30; ++i) {
+            const std::string added = "src/part_" + std::to_string(1000 + 2 * i) + "_extra.cpp";
+            std::vector<std::string> grown = base;
+            grown.push_back(added);
+            const Batches after = anvil::unity_batches(grown, batchSize);
+
+            // Only the batch it joins changes; a file that ends a batch splits that one in two
+            const bool boundary = is_boundary(added, batchSize);
+            boundaries += boundary ? 1 : 0;
+            ANVIL_ASSERT_EQUALS(changed(after, before), size_t(1));
+            ANVIL_ASSERT_EQUALS(changed(before, after), size_t(boundary ? 2 : 1));
+            for (const auto& batch : after) {
+                if (!contains(batch, added) && changed(before, { batch }) != 0) {
+                    ANVIL_ASSERT(boundary);
+                }
+            }
+        }
+        ANVIL_ASSERT(boundaries > 0 && boundaries < 30);
+    }
+
+    void testRemovingSourceOnlyChangesItsBatch() {
+        constexpr size_t batchSize = 4;
+        const std::vector<std::string> base = sources(60);
+        const Batches before = anvil::unity_batches(base, batchSize);
+
+        for (size_t i = 0; i < base.size(); ++i) {
+            std::vector<std::string> shrunk = base;
+            shrunk.erase(shrunk.begin() + static_cast<std::ptrdiff_t>(i));
+            const Batches after = anvil::unity_batches(shrunk, batchSize);
+
+            // Its batch loses it; if it ended that batch, the batch merges with the next one
+            const bool boundary = is_boundary(base[i], batchSize);
+            ANVIL_ASSERT(changed(before, after) <= 1);
+            ANVIL_ASSERT(changed(after, before) <= size_t(boundary ? 2 : 1));
+            ANVIL_ASSERT_EQUALS(before.size() - changed(after, before), after.size() - changed(before, after));
+        }
+    }
+
+    void testBatchSizeOneKeepsEverySourceApart() {
+        const std::vector<std::string> input = sources(25);
+        const Batches batches = anvil::unity_batches(input, 1);
+        ANVIL_ASSERT_EQUALS(input.size(), batches.size());
+        for (size_t i = 0; i < batches.size(); ++i) {
+            ANVIL_ASSERT_EQUALS(size_t(1), batches[i].size());
+            ANVIL_ASSERT(batches[i].front() == input[i]);
+        }
+    }
+
+    void testBatchesAreCappedAtTwiceTheSize() {
+        constexpr size_t batchSize = 64;
+        const std::vector<std::string> input = sources(1000);
+        const Batches batches = anvil::unity_batches(input, batchSize);
+
+        size_t total = 0;
+        size_t capped = 0;
+        for (size_t i = 0; i < batches.size(); ++i) {
+            const auto& batch = batches[i];
+            total += batch.size();
+            ANVIL_ASSERT(batch.size() <= 2 * batchSize);
+            // Every batch but the last ends at a boundary or at the cap
+            if (i + 1 < batches.size() && !is_boundary(batch.back(), batchSize)) {
+                ANVIL_ASSERT_EQUALS(2 * batchSize, batch.size());
+                ++capped;
+            }
+        }
+        ANVIL_ASSERT_EQUALS(input.size(), total);
+        ANVIL_ASSERT(capped > 0);
+    }
+};
+
+ANVIL_TEST(UnityBatchTests, testOrderAndDuplicatesDontMatter)
+ANVIL_TEST(UnityBatchTests, testAddingSourceOnlyChangesItsBatch)
+ANVIL_TEST(UnityBatchTests, testRemovingSourceOnlyChangesItsBatch)
+ANVIL_TEST(UnityBatchTests, testBatchSizeOneKeepsEverySourceApart)
+ANVIL_TEST(UnityBatchTests, testBatchesAreCappedAtTwiceTheSize)